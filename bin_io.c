@@ -0,0 +1,159 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bin_io.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int bin_put_varint(FILE *fp, unsigned long long int v) {
+  do {
+    unsigned char c = v & 0x7f;
+    v >>= 7;
+    if (v != 0) {
+      c |= 0x80;
+    }
+    if (fputc(c, fp) == EOF) {
+      return -1;
+    }
+  } while (v != 0);
+  return 0;
+}
+
+int bin_get_varint(FILE *fp, unsigned long long int *v) {
+  *v = 0;
+  unsigned int shift = 0;
+  while (shift < 64) {
+    int c = fgetc(fp);
+    if (c == EOF) {
+      return -1;
+    }
+    *v |= (unsigned long long int)(c & 0x7f) << shift;
+    if ((c & 0x80) == 0) {
+      return 0;
+    }
+    shift += 7;
+  }
+  return -1;
+}
+
+int bin_get_size(FILE *fp, size_t *v, size_t max) {
+  unsigned long long int tmp;
+  if ((bin_get_varint(fp, &tmp) != 0) || (tmp >= max)) {
+    return -1;
+  }
+  *v = tmp;
+  return 0;
+}
+
+int bin_put_str(FILE *fp, const char *str) {
+  size_t len = strlen(str);
+  if ((bin_put_varint(fp, len) != 0) || (fwrite(str, 1, len, fp) != len)) {
+    return -1;
+  }
+  return 0;
+}
+
+int bin_get_str(FILE *fp, char **str) {
+  /* no longer than a path or an arg */
+  size_t len;
+  if (bin_get_size(fp, &len, 1 << 20) != 0) {
+    return -1;
+  }
+  *str = malloc(len + 1);
+  if (*str == 0) {
+    return -1;
+  }
+  if (fread(*str, 1, len, fp) != len) {
+    free(*str);
+    *str = 0;
+    return -1;
+  }
+  (*str)[len] = '\0';
+  return 0;
+}
+
+int bin_put_strs(FILE *fp, char **strs, size_t size) {
+  int rc = bin_put_varint(fp, size);
+  size_t i = 0;
+  while (i < size) {
+    rc |= bin_put_str(fp, strs[i]);
+    ++i;
+  }
+  return rc;
+}
+
+int bin_get_strs(FILE *fp, char ***strs, size_t *size) {
+  *strs = 0;
+  *size = 0;
+  size_t strs_size;
+  if (bin_get_size(fp, &strs_size, 1 << 20) != 0) {
+    return -1;
+  }
+  *strs = calloc(strs_size + 1, sizeof(**strs));
+  if (*strs == 0) {
+    return -1;
+  }
+  while (*size < strs_size) {
+    if (bin_get_str(fp, &(*strs)[*size]) != 0) {
+      return -1;
+    }
+    ++*size;
+  }
+  return 0;
+}
+
+unsigned char bin_strs_eq(char **a, size_t a_size, char **b, size_t b_size) {
+  if (a_size != b_size) {
+    return 0;
+  }
+  size_t i = 0;
+  while (i < a_size) {
+    if (strcmp(a[i], b[i]) != 0) {
+      return 0;
+    }
+    ++i;
+  }
+  return 1;
+}
+
+void bin_strs_free(char **strs, size_t size) {
+  size_t i = 0;
+  while (i < size) {
+    free(strs[i]);
+    ++i;
+  }
+  free(strs);
+}
+
+int bin_put_header(FILE *fp, const char magic[BIN_IO_MAGIC_SIZE],
+                   unsigned int version) {
+  if (fwrite(magic, 1, BIN_IO_MAGIC_SIZE, fp) != BIN_IO_MAGIC_SIZE) {
+    return -1;
+  }
+  return bin_put_varint(fp, version);
+}
+
+int bin_get_header(FILE *fp, const char magic[BIN_IO_MAGIC_SIZE],
+                   unsigned int version) {
+  char buf[BIN_IO_MAGIC_SIZE];
+  unsigned long long int v;
+  if ((fread(buf, 1, BIN_IO_MAGIC_SIZE, fp) != BIN_IO_MAGIC_SIZE) ||
+      (memcmp(buf, magic, BIN_IO_MAGIC_SIZE) != 0) ||
+      (bin_get_varint(fp, &v) != 0) || (v != version)) {
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,47 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BIN_IO_H
+#define BIN_IO_H
+
+#include <stdio.h>
+
+/* little helpers for the binary files birch writes, integers are LEB128
+ * varints and strings a varint length followed by the bytes. All return 0 on
+ * success and -1 on error or a short read */
+
+#define BIN_IO_MAGIC_SIZE (8)
+
+int bin_put_varint(FILE *fp, unsigned long long int v);
+int bin_get_varint(FILE *fp, unsigned long long int *v);
+/* as bin_get_varint() for values that must fit a size_t below max */
+int bin_get_size(FILE *fp, size_t *v, size_t max);
+int bin_put_str(FILE *fp, const char *str);
+/* *str is allocated and NUL terminated */
+int bin_get_str(FILE *fp, char **str);
+/* a varint count followed by the strings */
+int bin_put_strs(FILE *fp, char **strs, size_t size);
+/* *strs is allocated, on error *size is the number of strings read so
+ * bin_strs_free() can still be called */
+int bin_get_strs(FILE *fp, char ***strs, size_t *size);
+unsigned char bin_strs_eq(char **a, size_t a_size, char **b, size_t b_size);
+void bin_strs_free(char **strs, size_t size);
+/* an 8 byte magic followed by a version */
+int bin_put_header(FILE *fp, const char magic[BIN_IO_MAGIC_SIZE],
+                   unsigned int version);
+int bin_get_header(FILE *fp, const char magic[BIN_IO_MAGIC_SIZE],
+                   unsigned int version);
+
+#endif
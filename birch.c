@@ -13,15 +13,47 @@
  * limitations under the License.
  */
 
+#define _GNU_SOURCE
+
 #include "birch.h"
+#include "birch_engine.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define FILE_BUF_SIZE (1024 * 16)
+#define STREAM_BUF_SIZE (1024 * 1024)
+#define ERROR_SIZE (512)
+
+static const char BIRCH_STDIN[] = "-";
 
 static const char PATH_DELIM = '/';
 
+static _Thread_local char error_str[ERROR_SIZE];
+
+const char *birch_error(void) {
+  return error_str;
+}
+
+void birch_error_set(const char *fmt, ...) {
+  /* the args may include the current message */
+  char tmp[ERROR_SIZE];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(tmp, sizeof(tmp), fmt, args);
+  va_end(args);
+  memcpy(error_str, tmp, sizeof(error_str));
+}
+
+void birch_error_clear(void) {
+  error_str[0] = '\0';
+}
+
 static unsigned int path_delim_count(char *path) {
   unsigned int diff = 0;
   while (*path != '\0') {
@@ -49,10 +81,17 @@ static void ptn_group_match_dist_calc(unsigned long int dist[4],
     dist[MATCH_DIR_DIFF] = 0;
     dist[MATCH_FILE_DIFF] = 0;
     dist[MATCH_OFFS_DIFF] = 0;
+  } else if (lsa->path == lsb->path) {
+    /* matches in the file being scanned share its path */
+    dist[MATCH_NEXIST] = 0;
+    dist[MATCH_DIR_DIFF] = 0;
+    dist[MATCH_FILE_DIFF] = 0;
   } else {
     dist[MATCH_NEXIST] = 0;
     dist[MATCH_DIR_DIFF] = path_dir_diff(lsa->path, lsb->path);
     dist[MATCH_FILE_DIFF] = (strcmp(lsa->path, lsb->path) != 0) ? 1 : 0;
+  }
+  if (dist[MATCH_NEXIST] == 0) {
     bit_size_t tmp = lsa->offs - lsb->offs;
     if (tmp > lsa->offs) {
       tmp = lsb->offs - lsa->offs;
@@ -92,10 +131,12 @@ static void ptn_group_match_dist_update(struct birch_ptn_groups *groups,
   }
 }
 
-static char ptn_group_match_dist_cmp(unsigned long int match_dista[4],
-                                     unsigned long int match_distb[4]) {
+/* compares the first size components */
+static char match_dist_cmp_n(unsigned long int match_dista[4],
+                             unsigned long int match_distb[4],
+                             unsigned int size) {
   unsigned int i = 0;
-  while (i < BIRCH_MATCH_DIST_SIZE) {
+  while (i < size) {
     if (match_dista[i] != match_distb[i]) {
       return (match_dista[i] > match_distb[i]) ? 1 : -1;
     }
@@ -104,27 +145,33 @@ static char ptn_group_match_dist_cmp(unsigned long int match_dista[4],
   return 0;
 }
 
-static int ptn_match(struct birch_ptn *ptn, unsigned char c);
+static char ptn_group_match_dist_cmp(unsigned long int match_dista[4],
+                                     unsigned long int match_distb[4]) {
+  return match_dist_cmp_n(match_dista, match_distb, BIRCH_MATCH_DIST_SIZE);
+}
+
+static int ptn_match(struct birch_ptn *ptn, size_t *index, unsigned char c);
 
-static void ptn_match_backtrack(struct birch_ptn *ptn, size_t count) {
-  ptn->index = 0;
+static void ptn_match_backtrack(struct birch_ptn *ptn, size_t *index,
+                                size_t count) {
+  *index = 0;
   size_t i = 1;
   while (i < count) {
-    ptn_match(ptn, ptn->ptn[i]);
+    ptn_match(ptn, index, ptn->ptn[i]);
     ++i;
   }
 }
 
-static int ptn_match(struct birch_ptn *ptn, unsigned char c) {
-  if ((c & ptn->mask[ptn->index]) == ptn->ptn[ptn->index]) {
-    ++ptn->index;
-    if (ptn->index == ptn->size_bytes) {
-      ptn_match_backtrack(ptn, ptn->index);
+static int ptn_match(struct birch_ptn *ptn, size_t *index, unsigned char c) {
+  if ((c & ptn->mask[*index]) == ptn->ptn[*index]) {
+    ++*index;
+    if (*index == ptn->size_bytes) {
+      ptn_match_backtrack(ptn, index, *index);
       return 1;
     }
-  } else if (ptn->index != 0) {
-    ptn_match_backtrack(ptn, ptn->index);
-    ptn_match(ptn, c);
+  } else if (*index != 0) {
+    ptn_match_backtrack(ptn, index, *index);
+    ptn_match(ptn, index, c);
   }
   return 0;
 }
@@ -178,8 +225,18 @@ static unsigned char groups_cmp(struct birch_ptn_groups *a,
   return 0;
 }
 
-static void result_add(struct birch_ptn_groups *groups,
-                       struct birch_ptn_groups *results, size_t results_size) {
+/* returns the new index of the result changed, or results_size if the results
+ * were not changed */
+static size_t result_add(struct birch_ptn_groups *groups,
+                         struct birch_ptn_groups *results,
+                         size_t results_size) {
+  /* no worse than the worst result, so no better than any result it shares a
+   * match with either */
+  if ((results_size == 0) ||
+      (ptn_group_match_dist_cmp(groups->match_dist,
+                                results[results_size - 1].match_dist) >= 0)) {
+    return results_size;
+  }
   /* look through results and check for any similar matches */
   unsigned char added = 0;
   size_t i = results_size;
@@ -193,7 +250,7 @@ static void result_add(struct birch_ptn_groups *groups,
         added = 1;
         break;
       } else {
-        return;
+        return results_size;
       }
     }
   }
@@ -201,10 +258,11 @@ static void result_add(struct birch_ptn_groups *groups,
   if (added == 0) {
     i = results_size - 1;
     /* replace highest if distance lower */
-    if (ptn_group_match_dist_cmp(groups->match_dist, results[i].match_dist) <
+    if (ptn_group_match_dist_cmp(groups->match_dist, results[i].match_dist) >=
         0) {
-      results_cpy(&results[i], groups);
+      return results_size;
     }
+    results_cpy(&results[i], groups);
   }
   size_t j = i - 1;
   while ((i > 0) && (ptn_group_match_dist_cmp(results[i].match_dist,
@@ -213,61 +271,601 @@ static void result_add(struct birch_ptn_groups *groups,
     --i;
     --j;
   }
+  return i;
+}
+
+size_t birch_combinations2(struct birch_ptn_groups *groups) {
+  size_t size = groups->size;
+  return (size < 2) ? 1 : (size * (size - 1)) >> 1;
 }
 
-int birch_file(struct birch_ptn_groups *results, size_t results_size,
-               char *path, struct birch_ptn_groups *groups) {
-  FILE *fp = fopen(path, "rb");
-  size_t group_index = 0;
-  while (group_index < groups->size) {
-    struct birch_ptn_group *group = &groups->groups[group_index];
-    size_t ptn_index = 0;
-    while (ptn_index < group->size) {
-      struct birch_ptn *ptn = &group->ptns[ptn_index];
-      ptn->index = 0;
-      ++ptn_index;
+/* coppies just enough to be useful as a result */
+static int result_from_groups(struct birch_ptn_groups *to,
+                              struct birch_ptn_groups *from) {
+  to->groups = calloc(from->size, sizeof(*to->groups));
+  if ((to->groups == 0) && (from->size != 0)) {
+    return -1;
+  }
+  to->size = from->size;
+  memcpy(to->match_dist, from->match_dist, sizeof(from->match_dist));
+
+  size_t i = 0;
+  while (i < from->size) {
+    struct birch_ptn_group *group_to = &to->groups[i];
+    struct birch_ptn_group *group_from = &from->groups[i];
+    group_to->ptns = group_from->ptns;
+    group_to->size = group_from->size;
+    group_to->match.ptn = 0;
+    group_to->match.path = 0;
+    group_to->match.offs = 0;
+    ++i;
+  }
+  return 0;
+}
+
+static unsigned char results_within(struct birch_results *results) {
+  size_t i = 0;
+  while (i < results->size) {
+    unsigned int j = 0;
+    while (j < BIRCH_MATCH_DIST_SIZE) {
+      if (results->results[i].match_dist[j] > results->stop_dist[j]) {
+        return 0;
+      }
+      ++j;
     }
-    ++group_index;
+    ++i;
   }
+  return 1;
+}
 
-  unsigned char buf[FILE_BUF_SIZE];
-  size_t size_read;
-  size_t file_index = 0;
-  do {
-    size_read = fread(&buf, sizeof(unsigned char), FILE_BUF_SIZE, fp);
-    if (ferror(fp) != 0) {
-      fclose(fp);
+int birch_results_init(struct birch_results *results,
+                       struct birch_ptn_groups *groups, size_t size) {
+  results->results = calloc(size, sizeof(*results->results));
+  results->size = 0;
+  results->cb = 0;
+  results->usr = 0;
+  results->stop = 0;
+  results->done = 0;
+  results->max = 0;
+  if (results->results == 0) {
+    return -1;
+  }
+  while (results->size < size) {
+    struct birch_ptn_groups *result = &results->results[results->size];
+    if (result_from_groups(result, groups) != 0) {
+      birch_results_free(results);
+      return -1;
+    }
+    /* empty results are worse than any match */
+    ++result->match_dist[MATCH_NEXIST];
+    ++results->size;
+  }
+  return 0;
+}
+
+void birch_results_free(struct birch_results *results) {
+  size_t i = 0;
+  while (i < results->size) {
+    free(results->results[i].groups);
+    ++i;
+  }
+  free(results->results);
+  results->results = 0;
+  results->size = 0;
+}
+
+int birch_scan_init(struct birch_scan *scan, struct birch_ptn_groups *groups,
+                    struct birch_results *results) {
+  scan->indices = 0;
+  scan->bitap_state = 0;
+  scan->hits = 0;
+  scan->batch = 0;
+  scan->state.groups = 0;
+  scan->engines = groups->engines;
+  scan->engines_own = 0;
+  scan->ranges = 0;
+  scan->ranges_size = 0;
+  if (scan->engines == 0) {
+    if (birch_engines_build(&scan->engines, groups, BIRCH_ENGINE_ALL) != 0) {
       return -1;
     }
+    scan->engines_own = 1;
+  }
+  if (result_from_groups(&scan->state, groups) != 0) {
+    birch_scan_free(scan);
+    return -1;
+  }
+  scan->indices_size = scan->engines->ptns_size;
+  scan->indices = calloc(scan->indices_size + 1, sizeof(*scan->indices));
+  scan->bitap_state =
+      calloc(scan->engines->bitap.words + 1, sizeof(*scan->bitap_state));
+  scan->hits = malloc((scan->indices_size + 1) * sizeof(*scan->hits));
+  scan->batch = malloc(BIRCH_SCAN_BATCH_SIZE * sizeof(*scan->batch));
+  scan->batch_size = 0;
+  if ((scan->indices == 0) || (scan->bitap_state == 0) || (scan->hits == 0) ||
+      (scan->batch == 0)) {
+    birch_scan_free(scan);
+    return -1;
+  }
+  scan->results = results;
+  scan->hit_cb = 0;
+  scan->hit_usr = 0;
+  scan->path = 0;
+  scan->offs = 0;
+  scan->stop = 0;
+  scan->window = 0;
+  scan->window_size = 0;
+  return 0;
+}
+
+void birch_scan_free(struct birch_scan *scan) {
+  free(scan->indices);
+  free(scan->bitap_state);
+  free(scan->hits);
+  free(scan->batch);
+  free(scan->state.groups);
+  if (scan->engines_own != 0) {
+    birch_engines_free(scan->engines);
+  }
+  scan->indices = 0;
+  scan->bitap_state = 0;
+  scan->hits = 0;
+  scan->batch = 0;
+  scan->state.groups = 0;
+  scan->engines = 0;
+}
+
+void birch_scan_begin(struct birch_scan *scan, char *path) {
+  memset(scan->indices, 0, scan->indices_size * sizeof(*scan->indices));
+  memset(scan->bitap_state, 0,
+         scan->engines->bitap.words * sizeof(*scan->bitap_state));
+  scan->path = path;
+  scan->offs = 0;
+  scan->stop = 0;
+  scan->window = 0;
+  scan->window_size = 0;
+}
 
-    size_t buf_index = 0;
-    while (buf_index < size_read) {
-      group_index = 0;
-      while (group_index < groups->size) {
-        struct birch_ptn_group *group = &groups->groups[group_index];
-        size_t ptn_index = 0;
-        while (ptn_index < group->size) {
-          struct birch_ptn *ptn = &group->ptns[ptn_index];
-          if (ptn_match(ptn, buf[buf_index]) != 0) {
-            struct birch_match match = {
-                .ptn = ptn,
-                .path = path,
-                .offs = ((((file_index + buf_index) * CHAR_BIT) + ptn->offs) -
-                         ptn->size) +
-                        CHAR_BIT};
-            ptn_group_match_dist_update(groups, &group->match, &match);
-            group->match = match;
-            /* ptn match */
-            result_add(groups, results, results_size);
-          }
-          ++ptn_index;
+/* returns 1 if the matches are within the max_dist of the results, cheapest
+ * tests first */
+static unsigned char match_within(struct birch_results *results,
+                                  struct birch_match *a,
+                                  struct birch_match *b) {
+  bit_size_t offs = (a->offs > b->offs) ? a->offs - b->offs : b->offs - a->offs;
+  if (offs > results->max_dist[MATCH_OFFS_DIFF]) {
+    return 0;
+  }
+  if ((a->path == b->path) || (strcmp(a->path, b->path) == 0)) {
+    return 1;
+  }
+  return ((results->max_dist[MATCH_FILE_DIFF] >= 1) &&
+          (path_dir_diff(a->path, b->path) <=
+           results->max_dist[MATCH_DIR_DIFF]))
+             ? 1
+             : 0;
+}
+
+/* returns 1 if every pair of matches of the state is within the max_dist of
+ * the results. The state is left as it is, a far match can still pair with
+ * later hits of the other groups. Pairs with the latest match, of group_index,
+ * are tested first as they are the most likely to be far */
+static unsigned char state_within(struct birch_scan *scan,
+                                  size_t group_index) {
+  struct birch_ptn_groups *groups = &scan->state;
+  struct birch_match *match = &groups->groups[group_index].match;
+  size_t i = 0;
+  while (i < groups->size) {
+    struct birch_match *ls = &groups->groups[i].match;
+    if ((i != group_index) && (ls->ptn != 0) &&
+        (match_within(scan->results, ls, match) == 0)) {
+      return 0;
+    }
+    ++i;
+  }
+  i = 0;
+  while (i < groups->size) {
+    struct birch_match *a = &groups->groups[i].match;
+    size_t j = i + 1;
+    while ((a->ptn != 0) && (i != group_index) && (j < groups->size)) {
+      struct birch_match *b = &groups->groups[j].match;
+      if ((j != group_index) && (b->ptn != 0) &&
+          (match_within(scan->results, a, b) == 0)) {
+        return 0;
+      }
+      ++j;
+    }
+    ++i;
+  }
+  return 1;
+}
+
+static void scan_match_state(struct birch_scan *scan, size_t group_index,
+                             struct birch_match *match) {
+  struct birch_ptn_groups *groups = &scan->state;
+  struct birch_ptn_group *group = &groups->groups[group_index];
+  ptn_group_match_dist_update(groups, &group->match, match);
+  group->match = *match;
+}
+
+void birch_scan_match(struct birch_scan *scan, size_t group_index,
+                      struct birch_match *match) {
+  struct birch_results *results = scan->results;
+  scan_match_state(scan, group_index, match);
+  /* a combination with a pair too far apart is never a result */
+  if ((results->max != 0) && (state_within(scan, group_index) == 0)) {
+    return;
+  }
+  /* ptn match */
+  size_t changed = result_add(&scan->state, results->results, results->size);
+  if ((results->cb != 0) && (changed < results->size)) {
+    results->cb(results->results, results->size, changed, results->usr);
+  }
+  if ((results->stop != 0) && (changed < results->size)) {
+    results->done = results_within(results);
+  }
+}
+
+/* applies the hits of a run of the same group, all in the file being scanned.
+ * The existence, directory and file distances of the state are the same after
+ * each of them, so once the first is applied, if those are already worse than
+ * the worst result none of the rest can change the results and only the last
+ * affects the state */
+static void batch_run(struct birch_scan *scan, size_t group_index,
+                      struct birch_scan_hit *hits, size_t size) {
+  struct birch_engines *engines = scan->engines;
+  struct birch_results *results = scan->results;
+  struct birch_match match = {engines->ptns[hits[0].ordinal], scan->path,
+                              hits[0].offs};
+  birch_scan_match(scan, group_index, &match);
+  if (size == 1) {
+    return;
+  }
+  if ((results->size == 0) ||
+      (match_dist_cmp_n(scan->state.match_dist,
+                        results->results[results->size - 1].match_dist,
+                        MATCH_OFFS_DIFF) > 0)) {
+    match.ptn = engines->ptns[hits[size - 1].ordinal];
+    match.offs = hits[size - 1].offs;
+    scan_match_state(scan, group_index, &match);
+    return;
+  }
+  size_t i = 1;
+  while (i < size) {
+    match.ptn = engines->ptns[hits[i].ordinal];
+    match.offs = hits[i].offs;
+    birch_scan_match(scan, group_index, &match);
+    ++i;
+  }
+}
+
+/* applies the batched hits in the order they were found */
+static void batch_flush(struct birch_scan *scan) {
+  struct birch_engines *engines = scan->engines;
+  struct birch_scan_hit *batch = scan->batch;
+  size_t size = scan->batch_size;
+  scan->batch_size = 0;
+  size_t i = 0;
+  if (scan->hit_cb != 0) {
+    while (i < size) {
+      struct birch_match match = {engines->ptns[batch[i].ordinal], scan->path,
+                                  batch[i].offs};
+      scan->hit_cb(engines->ptn_groups[batch[i].ordinal], &match,
+                   scan->hit_usr);
+      ++i;
+    }
+    return;
+  }
+  while (i < size) {
+    size_t group_index = engines->ptn_groups[batch[i].ordinal];
+    size_t j = i + 1;
+    while ((j < size) && (engines->ptn_groups[batch[j].ordinal] == group_index)) {
+      ++j;
+    }
+    batch_run(scan, group_index, &batch[i], j - i);
+    i = j;
+  }
+}
+
+static void scan_hit(struct birch_scan *scan, uint32_t ordinal,
+                     size_t buf_index) {
+  struct birch_ptn *ptn = scan->engines->ptns[ordinal];
+  struct birch_scan_hit *hit = &scan->batch[scan->batch_size];
+  hit->ordinal = ordinal;
+  hit->offs =
+      ((((scan->offs + buf_index) * CHAR_BIT) + ptn->offs) - ptn->size) +
+      CHAR_BIT;
+  ++scan->batch_size;
+  if (scan->batch_size == BIRCH_SCAN_BATCH_SIZE) {
+    batch_flush(scan);
+  }
+}
+
+void birch_scan_buf(struct birch_scan *scan, unsigned char *buf, size_t size) {
+  struct birch_engines *engines = scan->engines;
+  size_t buf_index = 0;
+  while (buf_index < size) {
+    unsigned char c = buf[buf_index];
+    size_t hits_size = birch_engines_step(engines, scan, c);
+    /* hits at the same byte are reported in ordinal order, engine hits are
+     * merged in between the state machine hits */
+    size_t hit = 0;
+    size_t i = 0;
+    while (i < engines->sm_size) {
+      uint32_t ordinal = engines->sm[i];
+      if (ptn_match(engines->ptns[ordinal], &scan->indices[ordinal], c) != 0) {
+        while ((hit < hits_size) && (scan->hits[hit] < ordinal)) {
+          scan_hit(scan, scan->hits[hit], buf_index);
+          ++hit;
         }
-        ++group_index;
+        scan_hit(scan, ordinal, buf_index);
       }
-      ++buf_index;
+      ++i;
+    }
+    while (hit < hits_size) {
+      scan_hit(scan, scan->hits[hit], buf_index);
+      ++hit;
     }
-    file_index += size_read;
-  } while (size_read == FILE_BUF_SIZE);
-  fclose(fp);
+    ++buf_index;
+  }
+  batch_flush(scan);
+  scan->offs += size;
+}
+
+/* fills buf unless the end of the stream is reached first, pipes return at
+ * most their capacity per read */
+static ssize_t read_full(int fd, unsigned char *buf, size_t size) {
+  size_t size_read = 0;
+  while (size_read < size) {
+    ssize_t rc = read(fd, buf + size_read, size - size_read);
+    if (rc == 0) {
+      break;
+    } else if (rc < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    size_read += rc;
+  }
+  return size_read;
+}
+
+/* returns 1 while the rest of the file may change the results */
+static unsigned char scan_reading(struct birch_scan *scan) {
+  return ((scan->results->done == 0) && (scan->stop == 0)) ? 1 : 0;
+}
+
+static int birch_fd_buf(struct birch_scan *scan, int fd, unsigned char *buf,
+                        size_t buf_size) {
+  ssize_t size_read;
+  do {
+    size_read = read_full(fd, buf, buf_size);
+    if (size_read < 0) {
+      return -1;
+    }
+    birch_scan_buf(scan, buf, size_read);
+  } while (((size_t)size_read == buf_size) && (scan_reading(scan) != 0));
+  return 0;
+}
+
+static ssize_t pread_full(int fd, unsigned char *buf, size_t size,
+                          long long int offs) {
+  size_t size_read = 0;
+  while (size_read < size) {
+    ssize_t rc = pread(fd, buf + size_read, size - size_read, offs + size_read);
+    if (rc == 0) {
+      break;
+    } else if (rc < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    size_read += rc;
+  }
+  return size_read;
+}
+
+static int range_cmp(const void *a, const void *b) {
+  const struct birch_range *range_a = a;
+  const struct birch_range *range_b = b;
+  if (range_a->start != range_b->start) {
+    return (range_a->start < range_b->start) ? -1 : 1;
+  }
   return 0;
 }
+
+/* the scan ranges of a file of size bytes, or a stream when size is negative,
+ * sorted with overlaps merged */
+static size_t ranges_resolve(struct birch_scan *scan, long long int size,
+                             struct birch_range *ranges) {
+  size_t ranges_size = 0;
+  size_t i = 0;
+  while (i < scan->ranges_size) {
+    struct birch_range range = scan->ranges[i];
+    ++i;
+    if (size < 0) {
+      if ((range.start < 0) || (range.end < 0)) {
+        continue;
+      }
+    } else {
+      if (range.start < 0) {
+        range.start = (-range.start < size) ? size + range.start : 0;
+      }
+      if (range.end < 0) {
+        range.end = (-range.end < size) ? size + range.end : 0;
+      }
+      if (range.end > size) {
+        range.end = size;
+      }
+    }
+    if (range.start < range.end) {
+      ranges[ranges_size] = range;
+      ++ranges_size;
+    }
+  }
+  if (ranges_size == 0) {
+    return 0;
+  }
+  qsort(ranges, ranges_size, sizeof(*ranges), range_cmp);
+  size_t merged = 1;
+  i = 1;
+  while (i < ranges_size) {
+    struct birch_range *last = &ranges[merged - 1];
+    if (ranges[i].start <= last->end) {
+      if (ranges[i].end > last->end) {
+        last->end = ranges[i].end;
+      }
+    } else {
+      ranges[merged] = ranges[i];
+      ++merged;
+    }
+    ++i;
+  }
+  return merged;
+}
+
+/* scans one range with offsets from the start of the file, pos is where a
+ * stream has been read up to */
+static int birch_fd_range(struct birch_scan *scan, int fd, unsigned char *buf,
+                          size_t buf_size, struct birch_range *range,
+                          long long int *pos, unsigned char seekable) {
+  birch_scan_begin(scan, scan->path);
+  scan->offs = range->start;
+  if (seekable != 0) {
+    *pos = range->start;
+  }
+  while (*pos < range->start) {
+    size_t size = buf_size;
+    if ((unsigned long long int)(range->start - *pos) < size) {
+      size = range->start - *pos;
+    }
+    ssize_t size_read = read_full(fd, buf, size);
+    if (size_read < 0) {
+      return -1;
+    }
+    *pos += size_read;
+    if ((size_t)size_read < size) {
+      return 0;
+    }
+  }
+  while ((*pos < range->end) && (scan_reading(scan) != 0)) {
+    size_t size = buf_size;
+    if ((unsigned long long int)(range->end - *pos) < size) {
+      size = range->end - *pos;
+    }
+    ssize_t size_read = (seekable != 0) ? pread_full(fd, buf, size, *pos)
+                                        : read_full(fd, buf, size);
+    if (size_read < 0) {
+      return -1;
+    }
+    birch_scan_buf(scan, buf, size_read);
+    *pos += size_read;
+    if ((size_t)size_read < size) {
+      break;
+    }
+  }
+  return 0;
+}
+
+static int birch_fd_ranges(struct birch_scan *scan, int fd, unsigned char *buf,
+                           size_t buf_size, long long int size) {
+  struct birch_range *ranges = malloc(scan->ranges_size * sizeof(*ranges));
+  if (ranges == 0) {
+    return -1;
+  }
+  size_t ranges_size = ranges_resolve(scan, size, ranges);
+  long long int pos = 0;
+  int rc = 0;
+  size_t i = 0;
+  while ((i < ranges_size) && (rc == 0) && (scan_reading(scan) != 0)) {
+    rc = birch_fd_range(scan, fd, buf, buf_size, &ranges[i], &pos, size >= 0);
+    ++i;
+  }
+  free(ranges);
+  return rc;
+}
+
+int birch_fd(struct birch_scan *scan, char *path, int fd) {
+  birch_scan_begin(scan, path);
+  struct stat s;
+  if (fstat(fd, &s) != 0) {
+    return -1;
+  }
+  unsigned char file_buf[FILE_BUF_SIZE];
+  unsigned char *buf = file_buf;
+  size_t buf_size = FILE_BUF_SIZE;
+  long long int size = s.st_size;
+  if (!S_ISREG(s.st_mode)) {
+    /* a stream, fewer larger reads keep up with the writer */
+#ifdef F_SETPIPE_SZ
+    if (S_ISFIFO(s.st_mode)) {
+      fcntl(fd, F_SETPIPE_SZ, STREAM_BUF_SIZE);
+    }
+#endif
+    buf = malloc(STREAM_BUF_SIZE);
+    if (buf == 0) {
+      return -1;
+    }
+    buf_size = STREAM_BUF_SIZE;
+    size = -1;
+  }
+  int rc = (scan->ranges_size == 0)
+               ? birch_fd_buf(scan, fd, buf, buf_size)
+               : birch_fd_ranges(scan, fd, buf, buf_size, size);
+  if (buf != file_buf) {
+    free(buf);
+  }
+  return rc;
+}
+
+int birch_file(struct birch_scan *scan, char *path) {
+  if (strcmp(path, BIRCH_STDIN) == 0) {
+    return birch_fd(scan, path, STDIN_FILENO);
+  }
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  int rc = birch_fd(scan, path, fd);
+  close(fd);
+  return rc;
+}
+
+void birch_hits_init(struct birch_hits *hits) {
+  hits->hits = 0;
+  hits->size = 0;
+  hits->cap = 0;
+  hits->err = 0;
+}
+
+void birch_hits_free(struct birch_hits *hits) {
+  free(hits->hits);
+  birch_hits_init(hits);
+}
+
+void birch_hits_cb(size_t group_index, struct birch_match *match, void *usr) {
+  struct birch_hits *hits = usr;
+  if (hits->size == hits->cap) {
+    size_t new_cap = (hits->cap == 0) ? 16 : hits->cap << 1;
+    struct birch_hit *tmp = realloc(hits->hits, new_cap * sizeof(*tmp));
+    if (tmp == 0) {
+      hits->err = 1;
+      return;
+    }
+    hits->hits = tmp;
+    hits->cap = new_cap;
+  }
+  struct birch_hit *hit = &hits->hits[hits->size];
+  hit->group_index = group_index;
+  hit->match = *match;
+  ++hits->size;
+}
+
+void birch_hits_replay(struct birch_scan *scan, struct birch_hits *hits) {
+  size_t i = 0;
+  while (i < hits->size) {
+    birch_scan_match(scan, hits->hits[i].group_index, &hits->hits[i].match);
+    ++i;
+  }
+}
@@ -19,6 +19,7 @@
 #include "bit_arr.h"
 
 #include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #define BIRCH_MATCH_DIST_SIZE (4)
@@ -27,7 +28,37 @@ enum endian { ENDIAN_LITTLE, ENDIAN_BIG, ENDIAN_BOTH };
 
 enum alignment { ALIGNMENT_UNALIGNED, ALIGNMENT_ALIGNED };
 
-enum data_type { DATA_TYPE_INTEGER, DATA_TYPE_FLOAT, DATA_TYPE_STRING };
+enum data_type {
+  DATA_TYPE_INTEGER,
+  DATA_TYPE_FLOAT,
+  DATA_TYPE_STRING,
+  DATA_TYPE_HEX,   /* bytes in memory order, "?" nibbles and "/" masks */
+  DATA_TYPE_STRUCT, /* typed fields at fixed bit offsets, gaps masked */
+  DATA_TYPE_NUMERIC /* every encoding a number is exact in, no size arg */
+};
+
+/* string modifiers, the variants of one arg are added to the same group */
+enum birch_str_flags {
+  BIRCH_STR_WIDE = 1,  /* UTF-16LE and UTF-16BE variants as well */
+  BIRCH_STR_NOCASE = 2 /* ASCII letters of either case, through masks */
+};
+
+/* the encoding of a numeric variant, its size is that of the ptn */
+enum birch_num_enc {
+  BIRCH_NUM_INT,    /* two's complement, signed or unsigned */
+  BIRCH_NUM_FLOAT,  /* IEEE 754 binary16, binary32 or binary64 */
+  BIRCH_NUM_BFLOAT, /* bfloat16, the top half of a binary32 */
+  BIRCH_NUM_VARINT, /* LEB128, protobuf int and uint */
+  BIRCH_NUM_ZIGZAG  /* zigzag LEB128, protobuf sint */
+};
+
+/* matchers birch_ptn_groups_engines() may use besides the per pattern state
+ * machine */
+enum birch_engine_flags {
+  BIRCH_ENGINE_SET = 1,   /* hash sets of aligned literals of up to 64 bits */
+  BIRCH_ENGINE_BITAP = 2, /* shift-and for masked patterns */
+  BIRCH_ENGINE_ALL = BIRCH_ENGINE_SET | BIRCH_ENGINE_BITAP
+};
 
 enum match_dist_indices {
   MATCH_NEXIST,
@@ -41,11 +72,12 @@ struct birch_ptn {
   enum data_type type;
   enum alignment alignment;
   enum endian endian;
+  unsigned char str_flags; /* birch_str_flags of this variant */
+  unsigned char num_enc;   /* birch_num_enc of a numeric variant */
   unsigned char *ptn;
   unsigned char *mask;
   unsigned int offs; /* bits until pattern starts, assumed to be < CHAR_BIT */
   bit_size_t size;   /* does not include offs */
-  size_t index;      /* used in the match process */
   size_t size_bytes;
 };
 
@@ -61,13 +93,182 @@ struct birch_ptn_group {
   struct birch_match match;
 };
 
+struct birch_engines;
+
 struct birch_ptn_groups {
   struct birch_ptn_group *groups;
   size_t size;
   unsigned long int match_dist[BIRCH_MATCH_DIST_SIZE];
+  struct birch_engines *engines; /* built by birch_compile_end(), 0 in results */
+  /* a pattern set file the ptns point into, 0 if they were compiled */
+  void *map;
+  size_t map_size;
+};
+
+/* called each time a result is added or improved, index is its new rank */
+typedef void (*birch_results_cb)(struct birch_ptn_groups *results,
+                                 size_t results_size, size_t index, void *usr);
+
+/* the top results, sorted by match_dist, best first */
+struct birch_results {
+  struct birch_ptn_groups *results;
+  size_t size;
+  birch_results_cb cb; /* may be 0 */
+  void *usr;
+  /* if stop is set, done is set once every result is within stop_dist in each
+   * of its match_dist components and scans stop reading */
+  unsigned char stop;
+  unsigned char done;
+  unsigned long int stop_dist[BIRCH_MATCH_DIST_SIZE];
+  /* if max is set no two matches of a result are further apart than the
+   * MATCH_DIR_DIFF, MATCH_FILE_DIFF and MATCH_OFFS_DIFF of max_dist. A state
+   * with a pair further apart is not added, but is kept to pair with later
+   * hits */
+  unsigned char max;
+  unsigned long int max_dist[BIRCH_MATCH_DIST_SIZE];
+};
+
+/* a pattern hit, group_index is the index of the group containing match->ptn */
+typedef void (*birch_hit_cb)(size_t group_index, struct birch_match *match,
+                             void *usr);
+
+struct birch_hit {
+  size_t group_index;
+  struct birch_match match;
+};
+
+/* hits recorded through birch_hits_cb(), e.g. to keep per file match lists */
+struct birch_hits {
+  struct birch_hit *hits;
+  size_t size;
+  size_t cap;
+  unsigned char err; /* set if a hit could not be recorded */
+};
+
+/* called with each arg birch_compile_arg() consumes, which may not outlive the
+ * call */
+typedef void (*birch_arg_cb)(char *arg, void *usr);
+
+/* state carried from one arg to the next by birch_compile_arg() */
+struct birch_compiler {
+  unsigned char state;
+  enum alignment alignment;
+  enum endian endian;
+  enum data_type data_type;
+  bit_size_t data_size;
+  unsigned char str_flags;
+  unsigned char group_link;
+  birch_arg_cb arg_cb; /* may be 0 */
+  void *arg_usr;
+};
+
+/* a byte range [start, end) of each file to scan, negative values count back
+ * from the end of the file */
+struct birch_range {
+  long long int start;
+  long long int end;
+};
+
+#define BIRCH_RANGE_END LLONG_MAX
+
+/* a hit found while scanning a buffer, not yet applied to the results */
+struct birch_scan_hit {
+  uint32_t ordinal;
+  bit_size_t offs;
 };
 
-int birch_file(struct birch_ptn_groups *results, size_t results_size,
-               char *path, struct birch_ptn_groups *groups);
+/* hits are applied in batches of at most this many */
+#define BIRCH_SCAN_BATCH_SIZE (4096)
+
+/* matches a compiled pattern set against successive buffers, the pattern set
+ * is not modified so may be shared between scanners */
+struct birch_scan {
+  struct birch_ptn_groups state; /* the latest match of each group */
+  size_t *indices;               /* per ptn match progress */
+  size_t indices_size;
+  struct birch_engines *engines;
+  unsigned char engines_own; /* engines built for this scan */
+  uint64_t window;           /* the last bytes scanned, latest least significant */
+  unsigned int window_size;
+  uint64_t *bitap_state;
+  uint32_t *hits; /* ordinals of set and bitap hits at the current byte */
+  /* hits of the current buffer, applied in order once it is scanned */
+  struct birch_scan_hit *batch;
+  size_t batch_size;
+  struct birch_results *results;
+  /* when set hits are passed here instead of updating the results, they can be
+   * applied later, in order, with birch_scan_match() */
+  birch_hit_cb hit_cb;
+  void *hit_usr;
+  char *path;
+  unsigned long long int offs; /* bytes scanned so far in path */
+  /* set by hit_cb to stop reading the current file, the results are not done.
+   * Cleared by birch_scan_begin() */
+  unsigned char stop;
+  /* when set only these ranges of each file are read, not owned */
+  struct birch_range *ranges;
+  size_t ranges_size;
+};
+
+/* why the last failing birch_compile*(), birch_ptn_groups_engines() or
+ * birch_bps_*() call of this thread failed, "" if none has. The library does
+ * not print, callers report this */
+const char *birch_error(void);
+
+/* the number of group pairs, the MATCH_NEXIST distance of an empty result */
+size_t birch_combinations2(struct birch_ptn_groups *groups);
+
+/* compile patterns in the CLI syntax, e.g. "-ial" "32" "42" "-gf" "32" "42",
+ * into a pattern set */
+int birch_compile(struct birch_ptn_groups *groups, int argc, char *argv[]);
+void birch_ptn_groups_init(struct birch_ptn_groups *groups);
+void birch_ptn_groups_free(struct birch_ptn_groups *groups);
+/* incremental form of birch_compile(), settings carry from one arg to the next.
+ * Returns 0 if arg was consumed, 1 if it is not pattern syntax and negative on
+ * error */
+void birch_compiler_init(struct birch_compiler *compiler);
+int birch_compile_arg(struct birch_compiler *compiler,
+                      struct birch_ptn_groups *groups, char *arg);
+int birch_compile_end(struct birch_compiler *compiler,
+                      struct birch_ptn_groups *groups);
+/* (re)builds the matchers of a compiled pattern set, limited to the
+ * birch_engine_flags given. Results are identical whichever are used */
+int birch_ptn_groups_engines(struct birch_ptn_groups *groups,
+                             unsigned int flags);
+/* compiles a file ("-" for standard input) of whitespace separated args as
+ * birch_compile_arg() would, one pattern per line by convention. Args may be
+ * "quoted" and # starts a comment */
+int birch_compile_file(struct birch_compiler *compiler,
+                       struct birch_ptn_groups *groups, char *path);
+
+int birch_results_init(struct birch_results *results,
+                       struct birch_ptn_groups *groups, size_t size);
+void birch_results_free(struct birch_results *results);
+
+int birch_scan_init(struct birch_scan *scan, struct birch_ptn_groups *groups,
+                    struct birch_results *results);
+void birch_scan_free(struct birch_scan *scan);
+/* starts a new file or stream, path must outlive the results */
+void birch_scan_begin(struct birch_scan *scan, char *path);
+void birch_scan_buf(struct birch_scan *scan, unsigned char *buf, size_t size);
+/* updates the latest match of the group and the results with a hit */
+void birch_scan_match(struct birch_scan *scan, size_t group_index,
+                      struct birch_match *match);
+
+/* path "-" is standard input. Pipes and devices are read in large blocks with
+ * constant memory, offsets are cumulative from the start of the stream.
+ * Ranges of regular files are read with pread() and matches do not span
+ * ranges. Streams skip up to each range, ranges counted from the end are
+ * ignored */
+int birch_file(struct birch_scan *scan, char *path);
+
+void birch_hits_init(struct birch_hits *hits);
+void birch_hits_free(struct birch_hits *hits);
+/* a birch_hit_cb, usr is the struct birch_hits */
+void birch_hits_cb(size_t group_index, struct birch_match *match, void *usr);
+/* applies recorded hits in order, as if the data had been scanned again */
+void birch_hits_replay(struct birch_scan *scan, struct birch_hits *hits);
+/* as birch_file() for an already open descriptor, which is not closed */
+int birch_fd(struct birch_scan *scan, char *path, int fd);
 
 #endif
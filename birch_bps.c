@@ -0,0 +1,544 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "birch_bps.h"
+#include "birch_engine.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char BPS_MAGIC[8] = {'B', 'I', 'R', 'C', 'H', 'B', 'P', 'S'};
+static const uint32_t BPS_ORDER = 0x01020304;
+#define BPS_ALIGN (8)
+
+/* all offsets are in bytes from the start of the file, except those of
+ * struct bps_ptn which are from the start of the data section. Each array is
+ * BPS_ALIGN aligned */
+struct bps_set {
+  uint64_t slots;
+  uint64_t slots_cap;
+  uint64_t refs;
+  uint64_t refs_size;
+  uint64_t hash_shift;
+};
+
+struct bps_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t order; /* BPS_ORDER as written */
+  uint32_t slot_size;
+  uint32_t ptn_size;
+  uint64_t size; /* of the file */
+  uint64_t groups_size;
+  uint64_t ptns_size;
+  uint64_t args_size;
+  uint64_t match_dist[BIRCH_MATCH_DIST_SIZE];
+  uint64_t groups; /* uint64_t ptns per group, ptns are in ordinal order */
+  uint64_t ptns;   /* struct bps_ptn by ordinal */
+  uint64_t args;   /* uint64_t data offsets of the args */
+  uint64_t ptn_groups;
+  uint64_t sm;
+  uint64_t sm_size;
+  struct bps_set sets[BIRCH_SET_WIDTH_MAX];
+  uint64_t set_widths;
+  uint64_t bitap_words;
+  uint64_t bitap_masks;
+  uint64_t bitap_starts;
+  uint64_t bitap_ends;
+  uint64_t bitap_ordinals;
+  uint64_t data; /* strings and pattern bytes, the last byte of the file is 0 */
+};
+
+struct bps_ptn {
+  uint64_t arg;
+  uint64_t ptn;
+  uint64_t mask;
+  uint64_t size;
+  uint64_t size_bytes;
+  uint8_t offs;
+  uint8_t type;
+  uint8_t alignment;
+  uint8_t endian;
+  uint8_t str_flags;
+  uint8_t num_enc;
+  uint8_t pad[2];
+};
+
+struct bps_buf {
+  unsigned char *data;
+  size_t size;
+  size_t cap;
+  unsigned char err;
+};
+
+/* appends size bytes of data, or zeros if data is 0, at the next aligned
+ * offset and returns the offset */
+static uint64_t buf_add(struct bps_buf *buf, const void *data, size_t size) {
+  size_t offs = (buf->size + (BPS_ALIGN - 1)) & ~(size_t)(BPS_ALIGN - 1);
+  if ((offs + size) > buf->cap) {
+    size_t new_cap = (buf->cap == 0) ? 4096 : buf->cap;
+    while ((offs + size) > new_cap) {
+      new_cap <<= 1;
+    }
+    unsigned char *tmp = realloc(buf->data, new_cap);
+    if (tmp == 0) {
+      buf->err = 1;
+      return 0;
+    }
+    buf->data = tmp;
+    buf->cap = new_cap;
+  }
+  memset(&buf->data[buf->size], 0, offs - buf->size);
+  if (data != 0) {
+    memcpy(&buf->data[offs], data, size);
+  } else {
+    memset(&buf->data[offs], 0, size);
+  }
+  buf->size = offs + size;
+  return offs;
+}
+
+static uint64_t buf_add_str(struct bps_buf *buf, const char *str) {
+  return buf_add(buf, str, strlen(str) + 1);
+}
+
+/* the number of refs a set's slots index */
+static size_t set_refs_size(struct birch_set *set) {
+  size_t size = 0;
+  size_t i = 0;
+  while (i < set->slots_cap) {
+    struct birch_set_slot *slot = &set->slots[i];
+    if ((slot->refs_size != 0) && ((slot->refs + slot->refs_size) > size)) {
+      size = slot->refs + slot->refs_size;
+    }
+    ++i;
+  }
+  return size;
+}
+
+static int bps_fill(struct bps_buf *buf, struct bps_buf *data,
+                    struct birch_ptn_groups *groups, char **args,
+                    size_t args_size) {
+  struct birch_engines *e = groups->engines;
+  struct bps_header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, BPS_MAGIC, sizeof(h.magic));
+  h.version = BIRCH_BPS_VERSION;
+  h.order = BPS_ORDER;
+  h.slot_size = sizeof(struct birch_set_slot);
+  h.ptn_size = sizeof(struct bps_ptn);
+  h.groups_size = groups->size;
+  h.ptns_size = e->ptns_size;
+  h.args_size = args_size;
+  unsigned int i = 0;
+  while (i < BIRCH_MATCH_DIST_SIZE) {
+    h.match_dist[i] = groups->match_dist[i];
+    ++i;
+  }
+  buf_add(buf, 0, sizeof(h));
+
+  h.groups = buf_add(buf, 0, groups->size * sizeof(uint64_t));
+  size_t j = 0;
+  while ((j < groups->size) && (buf->err == 0)) {
+    uint64_t size = groups->groups[j].size;
+    memcpy(&buf->data[h.groups + (j * sizeof(size))], &size, sizeof(size));
+    ++j;
+  }
+
+  h.ptns = buf_add(buf, 0, e->ptns_size * sizeof(struct bps_ptn));
+  j = 0;
+  while ((j < e->ptns_size) && (buf->err == 0)) {
+    struct birch_ptn *ptn = e->ptns[j];
+    struct bps_ptn p;
+    memset(&p, 0, sizeof(p));
+    /* variants of one arg share it */
+    if ((j != 0) && (ptn->arg_str == e->ptns[j - 1]->arg_str)) {
+      memcpy(&p.arg, &buf->data[h.ptns + ((j - 1) * sizeof(p))],
+             sizeof(p.arg));
+    } else {
+      p.arg = buf_add_str(data, ptn->arg_str);
+    }
+    p.ptn = buf_add(data, ptn->ptn, ptn->size_bytes);
+    p.mask = buf_add(data, ptn->mask, ptn->size_bytes);
+    p.size = ptn->size;
+    p.size_bytes = ptn->size_bytes;
+    p.offs = ptn->offs;
+    p.type = ptn->type;
+    p.alignment = ptn->alignment;
+    p.endian = ptn->endian;
+    p.str_flags = ptn->str_flags;
+    p.num_enc = ptn->num_enc;
+    if (buf->err == 0) {
+      memcpy(&buf->data[h.ptns + (j * sizeof(p))], &p, sizeof(p));
+    }
+    ++j;
+  }
+
+  h.args = buf_add(buf, 0, args_size * sizeof(uint64_t));
+  j = 0;
+  while ((j < args_size) && (buf->err == 0)) {
+    uint64_t arg = buf_add_str(data, args[j]);
+    memcpy(&buf->data[h.args + (j * sizeof(arg))], &arg, sizeof(arg));
+    ++j;
+  }
+
+  h.ptn_groups =
+      buf_add(buf, e->ptn_groups, e->ptns_size * sizeof(*e->ptn_groups));
+  h.sm = buf_add(buf, e->sm, e->sm_size * sizeof(*e->sm));
+  h.sm_size = e->sm_size;
+  i = 0;
+  while (i < BIRCH_SET_WIDTH_MAX) {
+    struct birch_set *set = &e->sets[i];
+    struct bps_set *s = &h.sets[i];
+    if (set->slots_cap != 0) {
+      s->slots_cap = set->slots_cap;
+      s->hash_shift = set->hash_shift;
+      s->refs_size = set_refs_size(set);
+      s->slots = buf_add(buf, set->slots, set->slots_cap * sizeof(*set->slots));
+      s->refs = buf_add(buf, set->refs, s->refs_size * sizeof(*set->refs));
+    }
+    ++i;
+  }
+  h.set_widths = e->set_widths;
+  h.bitap_words = e->bitap.words;
+  if (e->bitap.words != 0) {
+    h.bitap_masks = buf_add(buf, e->bitap.masks,
+                            (UCHAR_MAX + 1) * e->bitap.words * sizeof(uint64_t));
+    h.bitap_starts =
+        buf_add(buf, e->bitap.starts, e->bitap.words * sizeof(uint64_t));
+    h.bitap_ends = buf_add(buf, e->bitap.ends, e->bitap.words * sizeof(uint64_t));
+    h.bitap_ordinals = buf_add(buf, e->bitap.ordinals,
+                               e->bitap.words * 64 * sizeof(uint32_t));
+  }
+
+  /* terminates the last string even if there are none */
+  buf_add(data, "", 1);
+  if (data->err == 0) {
+    h.data = buf_add(buf, data->data, data->size);
+  }
+  h.size = buf->size;
+  if ((buf->err != 0) || (data->err != 0)) {
+    return -1;
+  }
+  memcpy(buf->data, &h, sizeof(h));
+  return 0;
+}
+
+int birch_bps_write(struct birch_ptn_groups *groups, char **args,
+                    size_t args_size, char *path) {
+  if (groups->engines == 0) {
+    birch_error_set("pattern set not compiled");
+    return -1;
+  }
+  struct bps_buf buf = {0, 0, 0, 0};
+  struct bps_buf data = {0, 0, 0, 0};
+  int rc = bps_fill(&buf, &data, groups, args, args_size);
+  free(data.data);
+  if (rc != 0) {
+    birch_error_set("out of memory");
+    free(buf.data);
+    return -1;
+  }
+  FILE *fp = fopen(path, "wb");
+  if (fp == 0) {
+    birch_error_set("could not open pattern set: %s", path);
+    free(buf.data);
+    return -1;
+  }
+  if (fwrite(buf.data, 1, buf.size, fp) != buf.size) {
+    rc = -1;
+  }
+  if (fclose(fp) != 0) {
+    rc = -1;
+  }
+  if (rc != 0) {
+    birch_error_set("could not write pattern set: %s", path);
+  }
+  free(buf.data);
+  return rc;
+}
+
+/* count elements of size at offs are within the map and aligned */
+static unsigned char bps_in(size_t map_size, uint64_t offs, uint64_t count,
+                            size_t size) {
+  return ((offs <= map_size) && ((offs % BPS_ALIGN) == 0) &&
+          (count <= ((map_size - offs) / size)))
+             ? 1
+             : 0;
+}
+
+/* ordinals index ptns and group indices index groups */
+static unsigned char u32s_below(uint32_t *arr, size_t size, uint64_t max) {
+  size_t i = 0;
+  while (i < size) {
+    if (arr[i] >= max) {
+      return 0;
+    }
+    ++i;
+  }
+  return 1;
+}
+
+static unsigned char bps_set_valid(unsigned char *map, size_t map_size,
+                                   struct bps_set *s, uint64_t ptns_size) {
+  if (s->slots_cap == 0) {
+    return 1;
+  }
+  if ((s->hash_shift == 0) || (s->hash_shift >= 64) ||
+      ((1ull << (64 - s->hash_shift)) != s->slots_cap) ||
+      (bps_in(map_size, s->slots, s->slots_cap,
+              sizeof(struct birch_set_slot)) == 0) ||
+      (bps_in(map_size, s->refs, s->refs_size, sizeof(uint32_t)) == 0) ||
+      (u32s_below((uint32_t *)&map[s->refs], s->refs_size, ptns_size) == 0)) {
+    return 0;
+  }
+  /* probes stop at an empty slot, so there must be one */
+  struct birch_set_slot *slots = (struct birch_set_slot *)&map[s->slots];
+  unsigned char empty = 0;
+  size_t i = 0;
+  while (i < s->slots_cap) {
+    if (slots[i].refs_size == 0) {
+      empty = 1;
+    } else if ((slots[i].refs > s->refs_size) ||
+               (slots[i].refs_size > (s->refs_size - slots[i].refs))) {
+      return 0;
+    }
+    ++i;
+  }
+  return empty;
+}
+
+/* the offsets and indices of the file stay within it */
+static unsigned char bps_valid(unsigned char *map, size_t map_size) {
+  if (map_size < sizeof(struct bps_header)) {
+    return 0;
+  }
+  struct bps_header *h = (struct bps_header *)map;
+  if ((memcmp(h->magic, BPS_MAGIC, sizeof(h->magic)) != 0) ||
+      (h->version != BIRCH_BPS_VERSION) || (h->order != BPS_ORDER) ||
+      (h->slot_size != sizeof(struct birch_set_slot)) ||
+      (h->ptn_size != sizeof(struct bps_ptn)) || (h->size != map_size) ||
+      (h->groups_size == 0) ||
+      (h->data >= map_size) || (map[map_size - 1] != '\0') ||
+      (h->ptns_size > UINT32_MAX) ||
+      (bps_in(map_size, h->groups, h->groups_size, sizeof(uint64_t)) == 0) ||
+      (bps_in(map_size, h->ptns, h->ptns_size, sizeof(struct bps_ptn)) == 0) ||
+      (bps_in(map_size, h->args, h->args_size, sizeof(uint64_t)) == 0) ||
+      (bps_in(map_size, h->ptn_groups, h->ptns_size, sizeof(uint32_t)) == 0) ||
+      (bps_in(map_size, h->sm, h->sm_size, sizeof(uint32_t)) == 0) ||
+      (u32s_below((uint32_t *)&map[h->ptn_groups], h->ptns_size,
+                  h->groups_size) == 0) ||
+      (u32s_below((uint32_t *)&map[h->sm], h->sm_size, h->ptns_size) == 0)) {
+    return 0;
+  }
+  size_t data_size = map_size - h->data;
+  uint64_t *groups = (uint64_t *)&map[h->groups];
+  uint64_t ptns_size = 0;
+  size_t i = 0;
+  while (i < h->groups_size) {
+    if (groups[i] > (h->ptns_size - ptns_size)) {
+      return 0;
+    }
+    ptns_size += groups[i];
+    ++i;
+  }
+  if (ptns_size != h->ptns_size) {
+    return 0;
+  }
+  struct bps_ptn *ptns = (struct bps_ptn *)&map[h->ptns];
+  i = 0;
+  while (i < h->ptns_size) {
+    struct bps_ptn *p = &ptns[i];
+    if ((p->arg >= data_size) || (p->size_bytes == 0) ||
+        (p->ptn > data_size) || (p->size_bytes > (data_size - p->ptn)) ||
+        (p->mask > data_size) || (p->size_bytes > (data_size - p->mask)) ||
+        (p->size > (p->size_bytes * CHAR_BIT)) || (p->offs >= CHAR_BIT) ||
+        (p->type > DATA_TYPE_NUMERIC) || (p->alignment > ALIGNMENT_ALIGNED) ||
+        (p->endian > ENDIAN_BOTH) || (p->num_enc > BIRCH_NUM_ZIGZAG)) {
+      return 0;
+    }
+    ++i;
+  }
+  uint64_t *args = (uint64_t *)&map[h->args];
+  i = 0;
+  while (i < h->args_size) {
+    if (args[i] >= data_size) {
+      return 0;
+    }
+    ++i;
+  }
+  i = 0;
+  while (i < BIRCH_SET_WIDTH_MAX) {
+    if ((((h->set_widths >> i) & 1) != ((h->sets[i].slots_cap != 0) ? 1 : 0)) ||
+        (bps_set_valid(map, map_size, &h->sets[i], h->ptns_size) == 0)) {
+      return 0;
+    }
+    ++i;
+  }
+  uint64_t words = h->bitap_words;
+  if ((words != 0) &&
+      ((words > (map_size / 64)) ||
+       (bps_in(map_size, h->bitap_masks, (UCHAR_MAX + 1) * words,
+               sizeof(uint64_t)) == 0) ||
+       (bps_in(map_size, h->bitap_starts, words, sizeof(uint64_t)) == 0) ||
+       (bps_in(map_size, h->bitap_ends, words, sizeof(uint64_t)) == 0) ||
+       (bps_in(map_size, h->bitap_ordinals, words * 64, sizeof(uint32_t)) ==
+        0) ||
+       (u32s_below((uint32_t *)&map[h->bitap_ordinals], words * 64,
+                   h->ptns_size) == 0))) {
+    return 0;
+  }
+  return 1;
+}
+
+/* points the engine tables into the map */
+static struct birch_engines *bps_engines(unsigned char *map,
+                                         struct birch_ptn *ptns) {
+  struct bps_header *h = (struct bps_header *)map;
+  struct birch_engines *e = calloc(1, sizeof(*e));
+  if (e == 0) {
+    return 0;
+  }
+  e->mapped = 1;
+  e->ptns_size = h->ptns_size;
+  e->ptns = malloc((e->ptns_size + 1) * sizeof(*e->ptns));
+  if (e->ptns == 0) {
+    birch_engines_free(e);
+    return 0;
+  }
+  size_t i = 0;
+  while (i < e->ptns_size) {
+    e->ptns[i] = &ptns[i];
+    ++i;
+  }
+  e->ptn_groups = (uint32_t *)&map[h->ptn_groups];
+  e->sm = (uint32_t *)&map[h->sm];
+  e->sm_size = h->sm_size;
+  i = 0;
+  while (i < BIRCH_SET_WIDTH_MAX) {
+    struct bps_set *s = &h->sets[i];
+    if (s->slots_cap != 0) {
+      e->sets[i].slots = (struct birch_set_slot *)&map[s->slots];
+      e->sets[i].slots_cap = s->slots_cap;
+      e->sets[i].hash_shift = s->hash_shift;
+      e->sets[i].refs = (uint32_t *)&map[s->refs];
+    }
+    ++i;
+  }
+  e->set_widths = h->set_widths;
+  e->bitap.words = h->bitap_words;
+  if (e->bitap.words != 0) {
+    e->bitap.masks = (uint64_t *)&map[h->bitap_masks];
+    e->bitap.starts = (uint64_t *)&map[h->bitap_starts];
+    e->bitap.ends = (uint64_t *)&map[h->bitap_ends];
+    e->bitap.ordinals = (uint32_t *)&map[h->bitap_ordinals];
+  }
+  return e;
+}
+
+int birch_bps_load(struct birch_ptn_groups *groups, char *path,
+                   birch_arg_cb arg_cb, void *usr) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    birch_error_set("could not open pattern set: %s", path);
+    return -1;
+  }
+  struct stat s;
+  if ((fstat(fd, &s) != 0) || (s.st_size == 0)) {
+    birch_error_set("invalid pattern set: %s", path);
+    close(fd);
+    return -1;
+  }
+  size_t map_size = s.st_size;
+  unsigned char *map = mmap(0, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    birch_error_set("could not map pattern set: %s", path);
+    return -1;
+  }
+  if (bps_valid(map, map_size) == 0) {
+    birch_error_set(
+        "invalid pattern set, or written by another version or machine: %s",
+        path);
+    munmap(map, map_size);
+    return -1;
+  }
+  struct bps_header *h = (struct bps_header *)map;
+  char *data = (char *)&map[h->data];
+  struct birch_ptn_group *group_arr =
+      calloc(h->groups_size + 1, sizeof(*group_arr));
+  struct birch_ptn *ptns = calloc(h->ptns_size + 1, sizeof(*ptns));
+  if ((group_arr == 0) || (ptns == 0)) {
+    birch_error_set("out of memory");
+    free(group_arr);
+    free(ptns);
+    munmap(map, map_size);
+    return -1;
+  }
+  struct bps_ptn *p = (struct bps_ptn *)&map[h->ptns];
+  size_t i = 0;
+  while (i < h->ptns_size) {
+    struct birch_ptn *ptn = &ptns[i];
+    ptn->arg_str = &data[p[i].arg];
+    ptn->type = p[i].type;
+    ptn->alignment = p[i].alignment;
+    ptn->endian = p[i].endian;
+    ptn->str_flags = p[i].str_flags;
+    ptn->num_enc = p[i].num_enc;
+    ptn->ptn = (unsigned char *)&data[p[i].ptn];
+    ptn->mask = (unsigned char *)&data[p[i].mask];
+    ptn->offs = p[i].offs;
+    ptn->size = p[i].size;
+    ptn->size_bytes = p[i].size_bytes;
+    ++i;
+  }
+  uint64_t *group_sizes = (uint64_t *)&map[h->groups];
+  size_t ordinal = 0;
+  i = 0;
+  while (i < h->groups_size) {
+    group_arr[i].ptns = &ptns[ordinal];
+    group_arr[i].size = group_sizes[i];
+    ordinal += group_sizes[i];
+    ++i;
+  }
+  groups->groups = group_arr;
+  groups->size = h->groups_size;
+  i = 0;
+  while (i < BIRCH_MATCH_DIST_SIZE) {
+    groups->match_dist[i] = h->match_dist[i];
+    ++i;
+  }
+  groups->map = map;
+  groups->map_size = map_size;
+  groups->engines = bps_engines(map, ptns);
+  if (groups->engines == 0) {
+    birch_error_set("out of memory");
+    birch_ptn_groups_free(groups);
+    return -1;
+  }
+  if (arg_cb != 0) {
+    uint64_t *args = (uint64_t *)&map[h->args];
+    i = 0;
+    while (i < h->args_size) {
+      arg_cb(&data[args[i]], usr);
+      ++i;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,37 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BIRCH_BPS_H
+#define BIRCH_BPS_H
+
+#include "birch.h"
+
+/* pattern set files, a compiled pattern set and its engine tables in a fixed
+ * layout of offsets from the start of the file. They are loaded with mmap()
+ * and used in place, nothing is compiled again. The byte order and layout are
+ * those of the machine that wrote the file, which must match to load it */
+
+#define BIRCH_BPS_VERSION (2)
+
+/* groups must have been compiled with birch_compile_end(), args are those it
+ * was compiled from */
+int birch_bps_write(struct birch_ptn_groups *groups, char **args,
+                    size_t args_size, char *path);
+/* groups must be initialised and empty, arg_cb (may be 0) is called with each
+ * arg the set was compiled from as birch_compile_arg() would */
+int birch_bps_load(struct birch_ptn_groups *groups, char *path,
+                   birch_arg_cb arg_cb, void *usr);
+
+#endif
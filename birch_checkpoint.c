@@ -0,0 +1,427 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "birch_checkpoint.h"
+#include "bin_io.h"
+#include "birch_tree.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char CHECKPOINT_MAGIC[BIN_IO_MAGIC_SIZE] = "BIRCHCKP";
+static const unsigned int CHECKPOINT_VERSION = 1;
+static const unsigned long int CHECKPOINT_INTERVAL = 60;
+
+static volatile sig_atomic_t checkpoint_stop = 0;
+
+static void stop_handler(int sig) {
+  (void)sig;
+  checkpoint_stop = 1;
+}
+
+/* a match as the index of its ptn in the group + 1 (0 if none), the index of
+ * its path in the checkpoint and offs */
+struct saved_match {
+  size_t ptn;
+  size_t path;
+  bit_size_t offs;
+};
+
+struct checkpoint_search {
+  struct birch_checkpoint *checkpoint;
+  struct birch_shard *shard;
+  struct birch_scan *scan;
+  size_t done; /* files walked, searched or not in the shard */
+  char *last;  /* the path of the last file walked */
+  unsigned long int next; /* time of the next checkpoint */
+  /* paths of the matches, when writing */
+  char **refs;
+  size_t refs_size;
+  /* when resuming, the files to walk without searching them. The scan state
+   * and results are restored after the last of them, once the paths of the
+   * matches have been found in the tree */
+  size_t skip;
+  char *skip_last;
+  char **paths;
+  size_t paths_size;
+  char **resolved;
+  struct saved_match *matches; /* groups->size for the state then each result */
+  unsigned long int *dists;
+};
+
+void birch_checkpoint_init(struct birch_checkpoint *checkpoint) {
+  checkpoint->path = 0;
+  checkpoint->resume_path = 0;
+  checkpoint->interval = CHECKPOINT_INTERVAL;
+}
+
+/* the scan state then the results */
+static size_t sets_size(struct birch_scan *scan) {
+  return scan->results->size + 1;
+}
+
+static struct birch_ptn_groups *set_get(struct birch_scan *scan, size_t i) {
+  return (i == 0) ? &scan->state : &scan->results->results[i - 1];
+}
+
+static size_t ref_index(struct checkpoint_search *search, char *path) {
+  size_t i = 0;
+  while ((i < search->refs_size) && (search->refs[i] != path)) {
+    ++i;
+  }
+  if (i == search->refs_size) {
+    search->refs[i] = path;
+    ++search->refs_size;
+  }
+  return i;
+}
+
+static int checkpoint_put(struct checkpoint_search *search, FILE *fp) {
+  struct birch_scan *scan = search->scan;
+  struct birch_shard *shard = search->shard;
+  size_t groups_size = scan->state.size;
+  search->refs_size = 0;
+  size_t i = 0;
+  while (i < sets_size(scan)) {
+    struct birch_ptn_groups *set = set_get(scan, i);
+    size_t k = 0;
+    while (k < groups_size) {
+      if (set->groups[k].match.ptn != 0) {
+        ref_index(search, set->groups[k].match.path);
+      }
+      ++k;
+    }
+    ++i;
+  }
+
+  int rc = bin_put_header(fp, CHECKPOINT_MAGIC, CHECKPOINT_VERSION);
+  rc |= bin_put_varint(fp, shard->index);
+  rc |= bin_put_varint(fp, shard->size);
+  rc |= bin_put_varint(fp, scan->results->size);
+  rc |= bin_put_strs(fp, shard->roots, shard->roots_size);
+  rc |= bin_put_strs(fp, shard->args, shard->args_size);
+  rc |= bin_put_varint(fp, search->done);
+  rc |= bin_put_str(fp, (search->last != 0) ? search->last : "");
+  rc |= bin_put_strs(fp, search->refs, search->refs_size);
+  i = 0;
+  while (i < sets_size(scan)) {
+    struct birch_ptn_groups *set = set_get(scan, i);
+    unsigned int j = 0;
+    while (j < BIRCH_MATCH_DIST_SIZE) {
+      rc |= bin_put_varint(fp, set->match_dist[j]);
+      ++j;
+    }
+    size_t k = 0;
+    while (k < groups_size) {
+      struct birch_ptn_group *group = &set->groups[k];
+      struct birch_match *match = &group->match;
+      if (match->ptn == 0) {
+        rc |= bin_put_varint(fp, 0);
+      } else {
+        rc |= bin_put_varint(fp, (match->ptn - group->ptns) + 1);
+        rc |= bin_put_varint(fp, ref_index(search, match->path));
+        rc |= bin_put_varint(fp, match->offs);
+      }
+      ++k;
+    }
+    ++i;
+  }
+  return rc;
+}
+
+/* written to a temporary file then renamed over the checkpoint, so it is
+ * never left half written */
+static int checkpoint_write(struct checkpoint_search *search) {
+  char *path = search->checkpoint->path;
+  size_t len = strlen(path);
+  char *tmp_path = malloc(len + sizeof(".tmp"));
+  if (tmp_path == 0) {
+    return -1;
+  }
+  memcpy(tmp_path, path, len);
+  memcpy(&tmp_path[len], ".tmp", sizeof(".tmp"));
+  int rc = -1;
+  FILE *fp = fopen(tmp_path, "wb");
+  if (fp != 0) {
+    rc = checkpoint_put(search, fp);
+    if ((fflush(fp) != 0) || (fsync(fileno(fp)) != 0)) {
+      rc = -1;
+    }
+    if (fclose(fp) != 0) {
+      rc = -1;
+    }
+    if ((rc == 0) && (rename(tmp_path, path) != 0)) {
+      rc = -1;
+    }
+  }
+  if (rc != 0) {
+    printf("failed to write checkpoint: %s\n", path);
+  }
+  free(tmp_path);
+  return rc;
+}
+
+static int checkpoint_get(struct checkpoint_search *search, FILE *fp,
+                          char *path) {
+  struct birch_scan *scan = search->scan;
+  struct birch_shard *shard = search->shard;
+  unsigned long long int index;
+  unsigned long long int shards_size;
+  size_t results_size;
+  char **roots = 0;
+  size_t roots_size = 0;
+  char **args = 0;
+  size_t args_size = 0;
+  if ((bin_get_header(fp, CHECKPOINT_MAGIC, CHECKPOINT_VERSION) != 0) ||
+      (bin_get_varint(fp, &index) != 0) ||
+      (bin_get_varint(fp, &shards_size) != 0) ||
+      (bin_get_size(fp, &results_size, (size_t)-1) != 0) ||
+      (bin_get_strs(fp, &roots, &roots_size) != 0) ||
+      (bin_get_strs(fp, &args, &args_size) != 0)) {
+    bin_strs_free(roots, roots_size);
+    bin_strs_free(args, args_size);
+    printf("invalid checkpoint: %s\n", path);
+    return -1;
+  }
+  unsigned char eq = (index == shard->index) && (shards_size == shard->size) &&
+                     (results_size == scan->results->size) &&
+                     bin_strs_eq(roots, roots_size, shard->roots,
+                                 shard->roots_size) &&
+                     bin_strs_eq(args, args_size, shard->args, shard->args_size);
+  bin_strs_free(roots, roots_size);
+  bin_strs_free(args, args_size);
+  if (eq == 0) {
+    printf("checkpoint of a different search: %s\n", path);
+    return -1;
+  }
+
+  size_t groups_size = scan->state.size;
+  size_t matches_size = sets_size(scan) * groups_size;
+  if ((bin_get_size(fp, &search->skip, (size_t)-1) != 0) ||
+      (bin_get_str(fp, &search->skip_last) != 0) ||
+      (bin_get_strs(fp, &search->paths, &search->paths_size) != 0)) {
+    printf("invalid checkpoint: %s\n", path);
+    return -1;
+  }
+  search->resolved = calloc(search->paths_size + 1, sizeof(*search->resolved));
+  search->matches = malloc((matches_size + 1) * sizeof(*search->matches));
+  search->dists = malloc((sets_size(scan) * BIRCH_MATCH_DIST_SIZE + 1) *
+                         sizeof(*search->dists));
+  if ((search->resolved == 0) || (search->matches == 0) ||
+      (search->dists == 0)) {
+    return -1;
+  }
+  size_t i = 0;
+  while (i < sets_size(scan)) {
+    struct birch_ptn_groups *set = set_get(scan, i);
+    unsigned int j = 0;
+    while (j < BIRCH_MATCH_DIST_SIZE) {
+      unsigned long long int v;
+      if (bin_get_varint(fp, &v) != 0) {
+        printf("invalid checkpoint: %s\n", path);
+        return -1;
+      }
+      search->dists[(i * BIRCH_MATCH_DIST_SIZE) + j] = v;
+      ++j;
+    }
+    size_t k = 0;
+    while (k < groups_size) {
+      struct saved_match *match = &search->matches[(i * groups_size) + k];
+      unsigned long long int offs = 0;
+      match->path = 0;
+      if ((bin_get_size(fp, &match->ptn, set->groups[k].size + 1) != 0) ||
+          ((match->ptn != 0) &&
+           ((bin_get_size(fp, &match->path, search->paths_size) != 0) ||
+            (bin_get_varint(fp, &offs) != 0)))) {
+        printf("invalid checkpoint: %s\n", path);
+        return -1;
+      }
+      match->offs = offs;
+      ++k;
+    }
+    ++i;
+  }
+  return 0;
+}
+
+static int checkpoint_read(struct checkpoint_search *search, char *path) {
+  FILE *fp = fopen(path, "rb");
+  if (fp == 0) {
+    printf("failed to open checkpoint: %s\n", path);
+    return -1;
+  }
+  int rc = checkpoint_get(search, fp, path);
+  fclose(fp);
+  return rc;
+}
+
+/* restores the scan state and results once every file before the checkpoint
+ * has been walked */
+static int checkpoint_restore(struct checkpoint_search *search) {
+  struct birch_scan *scan = search->scan;
+  if ((search->skip != 0) && ((search->last == 0) ||
+                              (strcmp(search->last, search->skip_last) != 0))) {
+    return -1;
+  }
+  size_t groups_size = scan->state.size;
+  size_t i = 0;
+  while (i < sets_size(scan)) {
+    struct birch_ptn_groups *set = set_get(scan, i);
+    memcpy(set->match_dist, &search->dists[i * BIRCH_MATCH_DIST_SIZE],
+           sizeof(set->match_dist));
+    size_t k = 0;
+    while (k < groups_size) {
+      struct saved_match *saved = &search->matches[(i * groups_size) + k];
+      struct birch_ptn_group *group = &set->groups[k];
+      if (saved->ptn == 0) {
+        group->match.ptn = 0;
+        group->match.path = 0;
+        group->match.offs = 0;
+      } else {
+        if (search->resolved[saved->path] == 0) {
+          return -1;
+        }
+        group->match.ptn = &group->ptns[saved->ptn - 1];
+        group->match.path = search->resolved[saved->path];
+        group->match.offs = saved->offs;
+      }
+      ++k;
+    }
+    ++i;
+  }
+  return 0;
+}
+
+static unsigned long int now_secs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+}
+
+static int search_file(struct dir_tree_file *file, void *usr) {
+  struct checkpoint_search *search = usr;
+  if (search->done < search->skip) {
+    /* matches refer to the tree's paths, results are told apart by them */
+    size_t i = 0;
+    while (i < search->paths_size) {
+      if ((search->resolved[i] == 0) &&
+          (strcmp(search->paths[i], file->path) == 0)) {
+        search->resolved[i] = file->path;
+      }
+      ++i;
+    }
+    ++search->done;
+    search->last = file->path;
+    if ((search->done == search->skip) && (checkpoint_restore(search) != 0)) {
+      printf("checkpoint does not match the tree: %s\n",
+             search->checkpoint->resume_path);
+      return -1;
+    }
+    return 0;
+  }
+  if (checkpoint_stop != 0) {
+    if ((search->checkpoint->path != 0) && (checkpoint_write(search) == 0)) {
+      printf("search stopped, resume with --resume %s\n",
+             search->checkpoint->path);
+    }
+    return -1;
+  }
+  if (birch_shard_has(search->shard, file->path) != 0) {
+    int rc = birch_file(search->scan, file->path);
+    if (rc != 0) {
+      return rc;
+    }
+    if (search->scan->results->done != 0) {
+      return 1;
+    }
+  }
+  ++search->done;
+  search->last = file->path;
+  if (search->checkpoint->path != 0) {
+    unsigned long int now = now_secs();
+    if (now >= search->next) {
+      if (checkpoint_write(search) != 0) {
+        return -1;
+      }
+      search->next = now + search->checkpoint->interval;
+    }
+  }
+  return 0;
+}
+
+int birch_checkpoint_search(struct birch_checkpoint *checkpoint,
+                            struct birch_shard *shard, struct birch_scan *scan,
+                            struct dir_tree *tree) {
+  struct checkpoint_search search = {0};
+  search.checkpoint = checkpoint;
+  search.shard = shard;
+  search.scan = scan;
+  search.next = now_secs() + checkpoint->interval;
+  search.refs = malloc((sets_size(scan) * scan->state.size + 1) *
+                       sizeof(*search.refs));
+  if (search.refs == 0) {
+    return -1;
+  }
+
+  int rc = 0;
+  if (checkpoint->resume_path != 0) {
+    rc = checkpoint_read(&search, checkpoint->resume_path);
+    if ((rc == 0) && (search.skip == 0) && (checkpoint_restore(&search) != 0)) {
+      printf("invalid checkpoint: %s\n", checkpoint->resume_path);
+      rc = -1;
+    }
+  }
+
+  struct sigaction old_int;
+  struct sigaction old_term;
+  if ((rc == 0) && (checkpoint->path != 0)) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &stop_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    checkpoint_stop = 0;
+    sigaction(SIGINT, &sa, &old_int);
+    sigaction(SIGTERM, &sa, &old_term);
+  }
+  if (rc == 0) {
+    rc = birch_tree_each(tree, &search_file, &search);
+    /* stopped with the results done */
+    if (rc > 0) {
+      rc = 0;
+    }
+    if ((rc == 0) && (search.done < search.skip)) {
+      printf("checkpoint does not match the tree: %s\n",
+             checkpoint->resume_path);
+      rc = -1;
+    }
+    if (checkpoint->path != 0) {
+      sigaction(SIGINT, &old_int, 0);
+      sigaction(SIGTERM, &old_term, 0);
+    }
+  }
+
+  free(search.refs);
+  free(search.skip_last);
+  bin_strs_free(search.paths, search.paths_size);
+  free(search.resolved);
+  free(search.matches);
+  free(search.dists);
+  return rc;
+}
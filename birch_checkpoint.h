@@ -0,0 +1,39 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BIRCH_CHECKPOINT_H
+#define BIRCH_CHECKPOINT_H
+
+#include "birch.h"
+#include "birch_shard.h"
+#include "dir_tree.h"
+
+/* a search that periodically saves how many files of the tree have been
+ * searched along with the scan state and results, and can continue from that
+ * point */
+struct birch_checkpoint {
+  char *path;            /* written every interval seconds, may be 0 */
+  char *resume_path;     /* may be 0 */
+  unsigned long int interval;
+};
+
+void birch_checkpoint_init(struct birch_checkpoint *checkpoint);
+/* as birch_shard_search() without a dump. SIGINT and SIGTERM write the
+ * checkpoint and stop the search */
+int birch_checkpoint_search(struct birch_checkpoint *checkpoint,
+                            struct birch_shard *shard, struct birch_scan *scan,
+                            struct dir_tree *tree);
+
+#endif
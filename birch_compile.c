@@ -0,0 +1,1335 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "birch.h"
+#include "birch_engine.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+static const unsigned int ENDIAN_TEST = 1;
+
+enum compiler_state {
+  COMPILER_STATE_IDLE,
+  COMPILER_STATE_SIZE,
+  COMPILER_STATE_PTN
+};
+
+/* return 0 with the error set on failure */
+static void *malloc_safe(size_t num, size_t size) {
+  size_t alloc_size = num * size;
+  void *p = ((alloc_size / num) == size) ? malloc(alloc_size) : 0;
+  if (p == 0) {
+    birch_error_set("out of memory");
+  }
+  return p;
+}
+
+/* ptr is left as it was on failure */
+static void *realloc_safe(void *ptr, size_t num, size_t size) {
+  size_t alloc_size = num * size;
+  void *p = ((alloc_size / num) == size) ? realloc(ptr, alloc_size) : 0;
+  if (p == 0) {
+    birch_error_set("out of memory");
+  }
+  return p;
+}
+
+static enum endian endian_native(void) {
+  return (*((char *)&ENDIAN_TEST) == 1) ? ENDIAN_LITTLE : ENDIAN_BIG;
+}
+
+static unsigned char *ptn_mask_gen(bit_size_t size, size_t size_bytes) {
+  unsigned char *mask = malloc_safe(size_bytes, sizeof(*mask));
+  if (mask == 0) {
+    return 0;
+  }
+  size_t i = 0;
+  while (i < (size_bytes - 1)) {
+    mask[i] = -1;
+    ++i;
+  }
+
+  mask[i] = (1 << (size % 8)) - 1;
+  if (mask[i] == 0) {
+    mask[i] = -1;
+  }
+  return mask;
+}
+
+/* returns a copy of the bit array shifted left 1 bit, extending the length by 1
+  character if necessary */
+static unsigned char *lshift_copy(unsigned char *arr, size_t size_bytes,
+                                  size_t shifted_size_bytes) {
+  if (shifted_size_bytes == 0) {
+    return 0;
+  }
+  unsigned char *shifted = malloc_safe(shifted_size_bytes, sizeof(*shifted));
+  if (shifted == 0) {
+    return 0;
+  }
+  unsigned int rshift = CHAR_BIT - 1;
+  unsigned char prev = 0;
+  size_t i = 0;
+  while (i < size_bytes) {
+    shifted[i] = (arr[i] << 1) | (prev >> rshift);
+    prev = arr[i];
+    ++i;
+  }
+  if (i < shifted_size_bytes) {
+    shifted[i] = prev >> rshift;
+  }
+
+  return shifted;
+}
+
+/* takes a ptn, smears to CHAR_BIT ptns - the ptn shifted to all
+ * possible character alignments. Returns -1 if out of memory */
+static int ptn_unalign(struct birch_ptn unaligned[CHAR_BIT]) {
+  unsigned int shift = 1;
+  while (shift < CHAR_BIT) {
+    struct birch_ptn *prev = &unaligned[shift - 1];
+    struct birch_ptn *cur = &unaligned[shift];
+    unsigned int new_offs = prev->offs + 1;
+    bit_size_t new_size = prev->size + new_offs;
+    size_t new_size_bytes = ((new_size - 1) / CHAR_BIT) + 1;
+    cur->arg_str = prev->arg_str;
+    cur->type = prev->type;
+    cur->alignment = prev->alignment;
+    cur->endian = prev->endian;
+    cur->num_enc = prev->num_enc;
+    cur->ptn = lshift_copy(prev->ptn, prev->size_bytes, new_size_bytes);
+    cur->mask = lshift_copy(prev->mask, prev->size_bytes, new_size_bytes);
+    if ((cur->ptn == 0) || (cur->mask == 0)) {
+      return -1;
+    }
+    cur->offs = new_offs;
+    cur->size = prev->size;
+    cur->size_bytes = new_size_bytes;
+    ++shift;
+  }
+  return 0;
+}
+
+static void endian_reverse(unsigned char *arr, size_t size_bytes) {
+  size_t i = 0;
+  size_t j = size_bytes - 1;
+  while (i < j) {
+    unsigned char tmp = arr[j];
+    arr[j] = arr[i];
+    arr[i] = tmp;
+    ++i;
+    --j;
+  }
+}
+
+static unsigned char *endian_reverse_copy(unsigned char *arr,
+                                          size_t size_bytes) {
+  unsigned char *copy = malloc_safe(size_bytes, sizeof(*copy));
+  if (copy == 0) {
+    return 0;
+  }
+  memcpy(copy, arr, size_bytes);
+  endian_reverse(copy, size_bytes);
+  return copy;
+}
+
+/* group[0] holds the value in type_endian order. Bytes are reversed before
+ * the bit shifts of unaligned variants, so those are of the value as stored */
+static int ptn_group_modify(struct birch_ptn *group, enum alignment alignment,
+                            enum endian endian, enum endian type_endian) {
+  unsigned int esl = (alignment == ALIGNMENT_UNALIGNED) ? CHAR_BIT : 1;
+  if (endian == ENDIAN_BOTH) {
+    struct birch_ptn *reversed = &group[esl];
+    *reversed = group[0];
+    reversed->ptn = endian_reverse_copy(group[0].ptn, group[0].size_bytes);
+    reversed->mask = endian_reverse_copy(group[0].mask, group[0].size_bytes);
+    if ((reversed->ptn == 0) || (reversed->mask == 0)) {
+      return -1;
+    }
+    group[0].endian = type_endian;
+    reversed->endian =
+        (type_endian == ENDIAN_LITTLE) ? ENDIAN_BIG : ENDIAN_LITTLE;
+    if ((alignment == ALIGNMENT_UNALIGNED) && (ptn_unalign(reversed) != 0)) {
+      return -1;
+    }
+  } else if (endian != type_endian) {
+    endian_reverse(group[0].ptn, group[0].size_bytes);
+    endian_reverse(group[0].mask, group[0].size_bytes);
+  }
+  if (alignment == ALIGNMENT_UNALIGNED) {
+    return ptn_unalign(&group[0]);
+  }
+  return 0;
+}
+
+/* frees ptns from index from onwards, variants of one arg share arg_str.
+ * Variants not filled before a failure are zeroed */
+static void ptns_free(struct birch_ptn *ptns, size_t from, size_t to) {
+  char *arg_str = 0;
+  size_t i = from;
+  while (i < to) {
+    free(ptns[i].ptn);
+    free(ptns[i].mask);
+    if ((ptns[i].arg_str != 0) && (ptns[i].arg_str != arg_str)) {
+      arg_str = ptns[i].arg_str;
+      free(arg_str);
+    }
+    ++i;
+  }
+}
+
+static void ptn_group_free(struct birch_ptn_group *group) {
+  ptns_free(group->ptns, 0, group->size);
+  free(group->ptns);
+}
+
+void birch_ptn_groups_free(struct birch_ptn_groups *groups) {
+  if (groups->map != 0) {
+    /* the groups share one ptns array, their bytes are in the map */
+    free(groups->groups[0].ptns);
+    munmap(groups->map, groups->map_size);
+    groups->map = 0;
+    groups->map_size = 0;
+  } else {
+    size_t i = 0;
+    while (i < groups->size) {
+      ptn_group_free(&groups->groups[i]);
+      ++i;
+    }
+  }
+  free(groups->groups);
+  groups->groups = 0;
+  groups->size = 0;
+  birch_engines_free(groups->engines);
+  groups->engines = 0;
+}
+
+static int hex_nibble(char c) {
+  if ((c >= '0') && (c <= '9')) {
+    return c - '0';
+  } else if ((c >= 'a') && (c <= 'f')) {
+    return (c - 'a') + 10;
+  } else if ((c >= 'A') && (c <= 'F')) {
+    return (c - 'A') + 10;
+  }
+  return -1;
+}
+
+/* parses a hex pattern such as "4D5A ?? ?? 50 45 0?", two digits per byte in
+ * memory order, "?" matches any nibble and "HH/MM" only the bits set in MM.
+ * Fills ptn and mask if they are not 0, returns the number of bytes or -1 */
+static ssize_t hex_parse(char *spec, unsigned char *ptn, unsigned char *mask) {
+  ssize_t size = 0;
+  char *cur = spec;
+  while (*cur != '\0') {
+    if ((*cur == ' ') || (*cur == '\t')) {
+      ++cur;
+      continue;
+    }
+    unsigned char value = 0;
+    unsigned char value_mask = 0;
+    unsigned int i = 0;
+    while (i < 2) {
+      int nibble = hex_nibble(cur[i]);
+      value <<= 4;
+      value_mask <<= 4;
+      if (nibble >= 0) {
+        value |= nibble;
+        value_mask |= 0xf;
+      } else if (cur[i] != '?') {
+        return -1;
+      }
+      ++i;
+    }
+    cur += 2;
+    if (*cur == '/') {
+      int hi = hex_nibble(cur[1]);
+      int lo = (hi < 0) ? -1 : hex_nibble(cur[2]);
+      if (lo < 0) {
+        return -1;
+      }
+      value_mask &= (hi << 4) | lo;
+      cur += 3;
+    }
+    if (ptn != 0) {
+      ptn[size] = value & value_mask;
+      mask[size] = value_mask;
+    }
+    ++size;
+  }
+  return size;
+}
+
+/* decodes the UTF-8 sequence at str, returns its length. Bytes that do not
+ * start a valid sequence within size are taken as single code points */
+static size_t utf8_decode(unsigned char *str, size_t size,
+                          unsigned long int *cp) {
+  static const unsigned long int CP_MIN[] = {0, 0, 0x80, 0x800, 0x10000};
+  size_t len = 1;
+  if ((str[0] >= 0xc2) && (str[0] <= 0xdf)) {
+    len = 2;
+  } else if ((str[0] >= 0xe0) && (str[0] <= 0xef)) {
+    len = 3;
+  } else if ((str[0] >= 0xf0) && (str[0] <= 0xf4)) {
+    len = 4;
+  }
+  *cp = str[0];
+  if ((len == 1) || (len > size)) {
+    return 1;
+  }
+  unsigned long int value = str[0] & (0x7f >> len);
+  size_t i = 1;
+  while (i < len) {
+    if ((str[i] & 0xc0) != 0x80) {
+      return 1;
+    }
+    value = (value << 6) | (str[i] & 0x3f);
+    ++i;
+  }
+  if ((value < CP_MIN[len]) || (value > 0x10ffff) ||
+      ((value >= 0xd800) && (value <= 0xdfff))) {
+    return 1;
+  }
+  *cp = value;
+  return len;
+}
+
+/* returns the number of UTF-16 code units, filling units if it is not 0 */
+static size_t utf16_encode(unsigned char *str, size_t size,
+                           unsigned int *units) {
+  size_t units_size = 0;
+  size_t i = 0;
+  while (i < size) {
+    unsigned long int cp;
+    i += utf8_decode(&str[i], size - i, &cp);
+    if (cp >= 0x10000) {
+      cp -= 0x10000;
+      if (units != 0) {
+        units[units_size] = 0xd800 | (cp >> 10);
+        units[units_size + 1] = 0xdc00 | (cp & 0x3ff);
+      }
+      units_size += 2;
+    } else {
+      if (units != 0) {
+        units[units_size] = cp;
+      }
+      ++units_size;
+    }
+  }
+  return units_size;
+}
+
+static unsigned char ascii_is_alpha(unsigned int c) {
+  return (((c | 0x20) >= 'a') && ((c | 0x20) <= 'z')) ? 1 : 0;
+}
+
+/* fills a string variant, UTF-16 in ptn->endian if it is wide, letters masked
+ * to match either case if it is case-insensitive. Returns -1 if out of
+ * memory */
+static int str_fill(struct birch_ptn *ptn, char *arg_str) {
+  unsigned char *str = (unsigned char *)arg_str;
+  if ((ptn->str_flags & BIRCH_STR_WIDE) == 0) {
+    size_t arg_len = strlen(arg_str) + 1;
+    ptn->ptn = malloc_safe(arg_len, sizeof(*ptn->ptn));
+    if (ptn->ptn == 0) {
+      return -1;
+    }
+    memcpy(ptn->ptn, arg_str, arg_len);
+  } else {
+    size_t units_size = utf16_encode(str, ptn->size_bytes, 0);
+    unsigned int *units = malloc_safe(units_size, sizeof(*units));
+    if (units == 0) {
+      return -1;
+    }
+    utf16_encode(str, ptn->size_bytes, units);
+    ptn->size_bytes = units_size << 1;
+    ptn->size = ptn->size_bytes * CHAR_BIT;
+    ptn->ptn = malloc_safe(ptn->size_bytes, sizeof(*ptn->ptn));
+    free(ptn->mask);
+    ptn->mask = ptn_mask_gen(ptn->size, ptn->size_bytes);
+    if ((ptn->ptn == 0) || (ptn->mask == 0)) {
+      free(units);
+      return -1;
+    }
+    unsigned int lo = (ptn->endian == ENDIAN_LITTLE) ? 0 : 1;
+    size_t i = 0;
+    while (i < units_size) {
+      ptn->ptn[(i << 1) + lo] = units[i] & 0xff;
+      ptn->ptn[(i << 1) + (lo ^ 1)] = units[i] >> 8;
+      ++i;
+    }
+    free(units);
+  }
+  if ((ptn->str_flags & BIRCH_STR_NOCASE) != 0) {
+    /* 0xdf clears the ASCII case bit, the high byte of a wide letter is 0 */
+    unsigned int step = ((ptn->str_flags & BIRCH_STR_WIDE) != 0) ? 2 : 1;
+    size_t i = ((step == 2) && (ptn->endian != ENDIAN_LITTLE)) ? 1 : 0;
+    while (i < ptn->size_bytes) {
+      if ((ascii_is_alpha(ptn->ptn[i]) != 0) &&
+          ((step == 1) || (ptn->ptn[i ^ 1] == 0))) {
+        ptn->mask[i] &= 0xdf;
+        ptn->ptn[i] &= ptn->mask[i];
+      }
+      i += step;
+    }
+  }
+  return 0;
+}
+
+static int ptn_fill(struct birch_ptn *ptn, char *arg_str, enum data_type type,
+                    enum alignment alignment, enum endian endian,
+                    bit_size_t size);
+
+/* copies the masked bits of a compiled field to bit offs of ptn and mask,
+ * returns the number of bytes up to the last one set or -1 if a bit is already
+ * masked by an earlier field with a different value */
+static ssize_t field_copy(struct birch_ptn *field, bit_size_t offs,
+                          unsigned char *ptn, unsigned char *mask) {
+  ssize_t size_bytes = 0;
+  bit_size_t i = 0;
+  while (i < (field->size_bytes * CHAR_BIT)) {
+    unsigned int bit = 1 << (i % CHAR_BIT);
+    if ((field->mask[i / CHAR_BIT] & bit) != 0) {
+      bit_size_t dst = offs + i;
+      unsigned int dst_bit = 1 << (dst % CHAR_BIT);
+      if (ptn != 0) {
+        unsigned int set = ((field->ptn[i / CHAR_BIT] & bit) != 0) ? 1 : 0;
+        if (((mask[dst / CHAR_BIT] & dst_bit) != 0) &&
+            (((ptn[dst / CHAR_BIT] & dst_bit) != 0) != set)) {
+          return -1;
+        }
+        mask[dst / CHAR_BIT] |= dst_bit;
+        if (set != 0) {
+          ptn[dst / CHAR_BIT] |= dst_bit;
+        }
+      }
+      size_bytes = (dst / CHAR_BIT) + 1;
+    }
+    ++i;
+  }
+  return size_bytes;
+}
+
+/* compiles one "OFFS TYPE [SIZE] VALUE" field of a struct pattern */
+static ssize_t field_parse(char *field, unsigned char *ptn,
+                           unsigned char *mask) {
+  char *cur = field;
+  bit_size_t offs = strtoull(cur, &cur, 0);
+  if ((cur == field) || ((*cur != ' ') && (*cur != '\t'))) {
+    return -1;
+  }
+  while ((*cur == ' ') || (*cur == '\t')) {
+    ++cur;
+  }
+  struct birch_ptn f;
+  memset(&f, 0, sizeof(f));
+  f.type = DATA_TYPE_STRUCT;
+  f.endian = endian_native();
+  unsigned char endian_set = 0;
+  while ((*cur != '\0') && (*cur != ' ') && (*cur != '\t')) {
+    enum data_type type = f.type;
+    switch (*cur) {
+    case 'i':
+      type = DATA_TYPE_INTEGER;
+      break;
+    case 'f':
+      type = DATA_TYPE_FLOAT;
+      break;
+    case 's':
+      type = DATA_TYPE_STRING;
+      break;
+    case 'x':
+      type = DATA_TYPE_HEX;
+      break;
+    case 'l':
+    case 'b':
+    case 'n':
+      if (endian_set != 0) {
+        return -1;
+      }
+      f.endian = (*cur == 'l') ? ENDIAN_LITTLE
+                 : (*cur == 'b') ? ENDIAN_BIG
+                                 : endian_native();
+      endian_set = 1;
+      break;
+    case 'w':
+      f.str_flags |= BIRCH_STR_WIDE;
+      break;
+    case 'I':
+      f.str_flags |= BIRCH_STR_NOCASE;
+      break;
+    default:
+      return -1;
+    }
+    if ((type != f.type) && (f.type != DATA_TYPE_STRUCT)) {
+      return -1;
+    }
+    f.type = type;
+    ++cur;
+  }
+  if ((f.type == DATA_TYPE_STRUCT) ||
+      ((f.str_flags != 0) && (f.type != DATA_TYPE_STRING))) {
+    return -1;
+  }
+  while ((*cur == ' ') || (*cur == '\t')) {
+    ++cur;
+  }
+  if (f.type == DATA_TYPE_HEX) {
+    ssize_t hex_size = hex_parse(cur, 0, 0);
+    f.size = (hex_size > 0) ? hex_size * CHAR_BIT : 0;
+  } else {
+    char *size_str = cur;
+    f.size = strtoull(size_str, &cur, 0);
+    if ((cur == size_str) || ((*cur != ' ') && (*cur != '\t'))) {
+      return -1;
+    }
+    while ((*cur == ' ') || (*cur == '\t')) {
+      ++cur;
+    }
+  }
+  if ((f.size == 0) || (*cur == '\0')) {
+    return -1;
+  }
+  f.size_bytes = (f.size + (CHAR_BIT - 1)) / CHAR_BIT;
+  f.mask = ptn_mask_gen(f.size, f.size_bytes);
+  ssize_t rc = -1;
+  if ((f.mask != 0) &&
+      (ptn_fill(&f, cur, f.type, ALIGNMENT_ALIGNED, f.endian, f.size) == 0)) {
+    rc = field_copy(&f, offs, ptn, mask);
+  }
+  free(f.ptn);
+  free(f.mask);
+  return rc;
+}
+
+/* parses a struct pattern such as "0 il 32 7, 32 f 32 1.5, 96 s 16 ID", ","
+ * separated fields of "OFFS TYPE SIZE VALUE" with the offset and size in bits.
+ * TYPE is i, f, s or x with an optional l, b or n endian and w or I for
+ * strings, x fields take their size from the value. A w field is UTF-16 in the
+ * field's endian only. Bits not in a field match anything, fields may only
+ * overlap where they agree. Fills ptn and mask if they are not 0, they must be
+ * zeroed, returns the number of bytes or -1, conflicts are only found then */
+static ssize_t struct_parse(char *spec, unsigned char *ptn,
+                            unsigned char *mask) {
+  size_t spec_len = strlen(spec) + 1;
+  char *field = malloc_safe(spec_len, sizeof(*field));
+  if (field == 0) {
+    return -1;
+  }
+  memcpy(field, spec, spec_len);
+  ssize_t size = 0;
+  char *cur = field;
+  while (*cur != '\0') {
+    while ((*cur == ' ') || (*cur == '\t')) {
+      ++cur;
+    }
+    char *end = strchr(cur, ',');
+    char *next = (end == 0) ? cur + strlen(cur) : end + 1;
+    if (end == 0) {
+      end = next;
+    }
+    while ((end > cur) && ((end[-1] == ' ') || (end[-1] == '\t'))) {
+      --end;
+    }
+    *end = '\0';
+    ssize_t field_size = field_parse(cur, ptn, mask);
+    if (field_size < 0) {
+      size = -1;
+      break;
+    }
+    if (field_size > size) {
+      size = field_size;
+    }
+    cur = next;
+  }
+  free(field);
+  return size;
+}
+
+/* a number and the encodings it is exact in */
+struct num_value {
+  unsigned long long int mag; /* of an integral value */
+  unsigned char neg;
+  unsigned char integral; /* mag and neg are set */
+  double d;
+  unsigned char d_exact; /* d is the value */
+};
+
+#define NUM_VARIANTS_SIZE (24)
+#define NUM_BYTES_MAX (10) /* a 64 bit LEB128 */
+
+struct num_variant {
+  enum birch_num_enc enc;
+  enum endian endian;
+  size_t size_bytes;
+  unsigned char bytes[NUM_BYTES_MAX];
+};
+
+struct num_variants {
+  struct num_variant variants[NUM_VARIANTS_SIZE];
+  size_t size;
+};
+
+/* integers are exact, anything else is taken as the nearest double */
+static int num_parse(char *spec, struct num_value *v) {
+  char *s = spec;
+  v->neg = (*s == '-') ? 1 : 0;
+  if ((*s == '-') || (*s == '+')) {
+    ++s;
+  }
+  v->integral = 0;
+  v->d_exact = 1;
+  char *end;
+  if ((*s >= '0') && (*s <= '9')) {
+    errno = 0;
+    v->mag = strtoull(s, &end, 0);
+    if (*end == '\0') {
+      if ((errno != 0) || ((v->neg != 0) && (v->mag > (1ull << 63)))) {
+        return -1;
+      }
+      if (v->mag == 0) {
+        v->neg = 0;
+      }
+      v->integral = 1;
+      double m = (double)v->mag;
+      v->d = (v->neg != 0) ? -m : m;
+      v->d_exact = ((m < 18446744073709551616.0) &&
+                    ((unsigned long long int)m == v->mag))
+                       ? 1
+                       : 0;
+      return 0;
+    }
+  }
+  errno = 0;
+  v->d = strtod(spec, &end);
+  /* subnormals also set ERANGE */
+  if ((*spec == '\0') || (*end != '\0') || isnan(v->d) ||
+      ((errno != 0) && ((isinf(v->d) != 0) || (v->d == 0)))) {
+    return -1;
+  }
+  /* an integral double is also searched as an integer, -0 only as a float */
+  if ((isinf(v->d) == 0) && (signbit(v->d) == 0) &&
+      (v->d < 18446744073709551616.0) &&
+      (v->d == (double)(unsigned long long int)v->d)) {
+    v->mag = (unsigned long long int)v->d;
+    v->neg = 0;
+    v->integral = 1;
+  } else if ((isinf(v->d) == 0) && (v->d < 0) &&
+             (v->d >= -9223372036854775808.0) &&
+             (v->d == (double)(long long int)v->d)) {
+    v->mag = (unsigned long long int)-v->d;
+    v->neg = 1;
+    v->integral = 1;
+  }
+  return 0;
+}
+
+/* the IEEE 754 bits of d with exp_bits and man_bits, -1 if it is not exact */
+static int float_bits(double d, unsigned int exp_bits, unsigned int man_bits,
+                      uint64_t *bits) {
+  int bias = (1 << (exp_bits - 1)) - 1;
+  uint64_t sign = (signbit(d) != 0) ? 1 : 0;
+  uint64_t exp_field = 0;
+  uint64_t man = 0;
+  if (isinf(d) != 0) {
+    exp_field = (1u << exp_bits) - 1;
+  } else if (d != 0) {
+    int e;
+    double m = frexp(fabs(d), &e);
+    /* |d| is 1.f * 2^(e - 1) */
+    double f;
+    if ((e - 1) > bias) {
+      return -1;
+    } else if ((e - 1) >= (1 - bias)) {
+      exp_field = (e - 1) + bias;
+      f = ldexp((2 * m) - 1, man_bits);
+    } else {
+      /* subnormal */
+      f = ldexp(fabs(d), man_bits + bias - 1);
+    }
+    man = (uint64_t)f;
+    if ((double)man != f) {
+      return -1;
+    }
+  }
+  *bits = (sign << (exp_bits + man_bits)) | (exp_field << man_bits) | man;
+  return 0;
+}
+
+/* the first variant with the same bytes is kept */
+static struct num_variant *num_variant_add(struct num_variants *variants,
+                                           enum birch_num_enc enc,
+                                           enum endian endian,
+                                           unsigned char *bytes,
+                                           size_t size_bytes) {
+  size_t i = 0;
+  while (i < variants->size) {
+    struct num_variant *prev = &variants->variants[i];
+    if ((prev->size_bytes == size_bytes) &&
+        (memcmp(prev->bytes, bytes, size_bytes) == 0)) {
+      return 0;
+    }
+    ++i;
+  }
+  struct num_variant *variant = &variants->variants[variants->size];
+  variant->enc = enc;
+  variant->endian = endian;
+  variant->size_bytes = size_bytes;
+  memcpy(variant->bytes, bytes, size_bytes);
+  ++variants->size;
+  return variant;
+}
+
+/* the low size_bytes of bits, little then big endian */
+static void num_fixed_add(struct num_variants *variants, enum birch_num_enc enc,
+                          uint64_t bits, size_t size_bytes) {
+  unsigned char bytes[sizeof(bits)];
+  size_t i = 0;
+  while (i < size_bytes) {
+    bytes[i] = (bits >> (i * CHAR_BIT)) & 0xff;
+    ++i;
+  }
+  struct num_variant *le =
+      num_variant_add(variants, enc, ENDIAN_LITTLE, bytes, size_bytes);
+  endian_reverse(bytes, size_bytes);
+  if ((le != 0) && (memcmp(bytes, le->bytes, size_bytes) == 0)) {
+    /* single bytes and palindromes are either */
+    le->endian = ENDIAN_BOTH;
+  } else {
+    num_variant_add(variants, enc, ENDIAN_BIG, bytes, size_bytes);
+  }
+}
+
+static void num_leb128_add(struct num_variants *variants,
+                           enum birch_num_enc enc, uint64_t val) {
+  unsigned char bytes[NUM_BYTES_MAX];
+  size_t size_bytes = 0;
+  do {
+    bytes[size_bytes] = val & 0x7f;
+    val >>= 7;
+    if (val != 0) {
+      bytes[size_bytes] |= 0x80;
+    }
+    ++size_bytes;
+  } while (val != 0);
+  num_variant_add(variants, enc, ENDIAN_LITTLE, bytes, size_bytes);
+}
+
+/* ints of each width, floats then varints, narrowest first */
+static int num_variants_gen(struct num_variants *variants, char *spec) {
+  struct num_value v;
+  if (num_parse(spec, &v) != 0) {
+    return -1;
+  }
+  variants->size = 0;
+  if (v.integral != 0) {
+    uint64_t twos = (v.neg != 0) ? -(uint64_t)v.mag : v.mag;
+    unsigned int width = CHAR_BIT;
+    while (width <= 64) {
+      /* in range as signed or unsigned */
+      unsigned long long int max = (width == 64) ? ~0ull : (1ull << width) - 1;
+      if (((v.neg == 0) && (v.mag <= max)) ||
+          ((v.neg != 0) && (v.mag <= (1ull << (width - 1))))) {
+        num_fixed_add(variants, BIRCH_NUM_INT, twos, width / CHAR_BIT);
+      }
+      width <<= 1;
+    }
+  }
+  if (v.d_exact != 0) {
+    uint64_t bits;
+    if (float_bits(v.d, 5, 10, &bits) == 0) {
+      num_fixed_add(variants, BIRCH_NUM_FLOAT, bits, 2);
+    }
+    if (float_bits(v.d, 8, 7, &bits) == 0) {
+      num_fixed_add(variants, BIRCH_NUM_BFLOAT, bits, 2);
+    }
+    if (float_bits(v.d, 8, 23, &bits) == 0) {
+      num_fixed_add(variants, BIRCH_NUM_FLOAT, bits, 4);
+    }
+    if (float_bits(v.d, 11, 52, &bits) == 0) {
+      num_fixed_add(variants, BIRCH_NUM_FLOAT, bits, 8);
+    }
+  }
+  if (v.integral != 0) {
+    /* negative ints are 10 byte varints of their two's complement */
+    num_leb128_add(variants, BIRCH_NUM_VARINT,
+                   (v.neg != 0) ? -(uint64_t)v.mag : v.mag);
+    if ((v.neg != 0) || (v.mag < (1ull << 63))) {
+      num_leb128_add(variants, BIRCH_NUM_ZIGZAG,
+                     (v.neg != 0) ? (v.mag << 1) - 1 : v.mag << 1);
+    }
+  }
+  return (variants->size != 0) ? 0 : -1;
+}
+
+/* all variants in the group, each is an aligned literal so those of up to 64
+ * bits are matched by the sets, in the same pass */
+static int group_add_num(struct birch_ptn_group *group, char *arg,
+                         enum alignment alignment) {
+  struct num_variants variants;
+  if (num_variants_gen(&variants, arg) != 0) {
+    return -1;
+  }
+  size_t prev_group_size = group->size;
+  size_t esl = (alignment == ALIGNMENT_UNALIGNED) ? CHAR_BIT : 1;
+  size_t add_size = variants.size * esl;
+  struct birch_ptn *tmp =
+      realloc_safe(group->ptns, prev_group_size + add_size, sizeof(*tmp));
+  if (tmp == 0) {
+    return -1;
+  }
+  group->ptns = tmp;
+  memset(&tmp[prev_group_size], 0, add_size * sizeof(*tmp));
+
+  size_t arg_len = strlen(arg) + 1;
+  char *arg_str = malloc_safe(arg_len, sizeof(*arg_str));
+  if (arg_str == 0) {
+    return -1;
+  }
+  memcpy(arg_str, arg, arg_len);
+
+  size_t i = 0;
+  while (i < variants.size) {
+    struct num_variant *variant = &variants.variants[i];
+    struct birch_ptn *ptn = &tmp[prev_group_size + (i * esl)];
+    ptn->arg_str = arg_str;
+    ptn->type = DATA_TYPE_NUMERIC;
+    ptn->alignment = alignment;
+    ptn->endian = variant->endian;
+    ptn->num_enc = variant->enc;
+    ptn->size_bytes = variant->size_bytes;
+    ptn->size = variant->size_bytes * CHAR_BIT;
+    ptn->mask = ptn_mask_gen(ptn->size, ptn->size_bytes);
+    ptn->ptn = malloc_safe(ptn->size_bytes, sizeof(*ptn->ptn));
+    int rc = ((ptn->mask != 0) && (ptn->ptn != 0)) ? 0 : -1;
+    if (rc == 0) {
+      memcpy(ptn->ptn, variant->bytes, ptn->size_bytes);
+      if (alignment == ALIGNMENT_UNALIGNED) {
+        rc = ptn_unalign(ptn);
+      }
+    }
+    if (rc != 0) {
+      ptns_free(tmp, prev_group_size, prev_group_size + add_size);
+      return -1;
+    }
+    ++i;
+  }
+  group->size = prev_group_size + add_size;
+  return 0;
+}
+
+static int ptn_fill(struct birch_ptn *ptn, char *arg_str, enum data_type type,
+                    enum alignment alignment, enum endian endian,
+                    bit_size_t size) {
+  size_t size_bytes = ptn->size_bytes;
+  switch (type) {
+  case DATA_TYPE_INTEGER:
+    ptn->ptn = bit_arr_from_str(arg_str, size_bytes);
+    if (ptn->ptn == 0) {
+      return -1;
+    }
+    return ptn_group_modify(ptn, alignment, endian, ENDIAN_LITTLE);
+  case DATA_TYPE_FLOAT: {
+    char *end;
+    char *expected_end = arg_str + strlen(arg_str);
+    if (size == (sizeof(float) * CHAR_BIT)) {
+      float f = strtof(arg_str, &end);
+      ptn->ptn = malloc_safe(1, sizeof(f));
+      if (ptn->ptn == 0) {
+        return -1;
+      }
+      memcpy(ptn->ptn, &f, sizeof(f));
+    } else if (size == (sizeof(double) * CHAR_BIT)) {
+      double d = strtod(arg_str, &end);
+      ptn->ptn = malloc_safe(1, sizeof(d));
+      if (ptn->ptn == 0) {
+        return -1;
+      }
+      memcpy(ptn->ptn, &d, sizeof(d));
+    } else {
+      return -2;
+    }
+    if (end != expected_end) {
+      return -1;
+    }
+    return ptn_group_modify(ptn, alignment, endian, endian_native());
+  }
+  case DATA_TYPE_STRING:
+    if (strlen(arg_str) < size_bytes) {
+      return -1;
+    }
+    /* endian only applies to wide variants */
+    if (str_fill(ptn, arg_str) != 0) {
+      return -1;
+    }
+    break;
+  case DATA_TYPE_HEX:
+    /* memory order, endian is ignored as for strings */
+    ptn->ptn = malloc_safe(size_bytes, sizeof(*ptn->ptn));
+    if (ptn->ptn == 0) {
+      return -1;
+    }
+    hex_parse(arg_str, ptn->ptn, ptn->mask);
+    break;
+  case DATA_TYPE_STRUCT:
+    /* each field has its own endian */
+    ptn->ptn = calloc(size_bytes, sizeof(*ptn->ptn));
+    if (ptn->ptn == 0) {
+      birch_error_set("out of memory");
+      return -1;
+    }
+    memset(ptn->mask, 0, size_bytes);
+    if (struct_parse(arg_str, ptn->ptn, ptn->mask) < 0) {
+      return -1;
+    }
+    break;
+  case DATA_TYPE_NUMERIC:
+    /* filled by group_add_num() */
+    return -1;
+  }
+  return (alignment == ALIGNMENT_UNALIGNED) ? ptn_unalign(ptn) : 0;
+}
+
+static int group_add_ptn(struct birch_ptn_group *group, char *arg,
+                         enum data_type type, enum alignment alignment,
+                         enum endian endian, bit_size_t size,
+                         unsigned char str_flags) {
+  if (type == DATA_TYPE_NUMERIC) {
+    /* the variants and their sizes come from the value */
+    return group_add_num(group, arg, alignment);
+  } else if (type == DATA_TYPE_HEX) {
+    /* the size comes from the pattern */
+    ssize_t hex_size = hex_parse(arg, 0, 0);
+    size = (hex_size > 0) ? hex_size * CHAR_BIT : 0;
+  } else if (type == DATA_TYPE_STRUCT) {
+    /* whole bytes, so hits are at the start of the record */
+    ssize_t struct_size = struct_parse(arg, 0, 0);
+    size = (struct_size > 0) ? struct_size * CHAR_BIT : 0;
+  }
+  if (size == 0) {
+    return -1;
+  }
+  size_t prev_group_size = group->size;
+  /* strings: plain then UTF-16LE and UTF-16BE if wide, each unaligned */
+  size_t variants = 1;
+  size_t esl = (alignment == ALIGNMENT_UNALIGNED) ? CHAR_BIT : 1;
+  if (type != DATA_TYPE_STRING) {
+    str_flags = 0;
+  } else if ((str_flags & BIRCH_STR_WIDE) != 0) {
+    variants = 3;
+  }
+  size_t add_size = variants * esl;
+  if ((endian == ENDIAN_BOTH) && (type != DATA_TYPE_STRING) &&
+      (type != DATA_TYPE_HEX) && (type != DATA_TYPE_STRUCT)) {
+    add_size <<= 1;
+  }
+
+  struct birch_ptn *tmp =
+      realloc_safe(group->ptns, prev_group_size + add_size, sizeof(*tmp));
+  if (tmp == 0) {
+    return -1;
+  }
+  group->ptns = tmp;
+  memset(&tmp[prev_group_size], 0, add_size * sizeof(*tmp));
+
+  /* the pattern set owns a copy of the arg */
+  size_t arg_len = strlen(arg) + 1;
+  char *arg_str = malloc_safe(arg_len, sizeof(*arg_str));
+  if (arg_str == 0) {
+    return -1;
+  }
+  memcpy(arg_str, arg, arg_len);
+
+  size_t size_bytes = (size + (CHAR_BIT - 1)) / CHAR_BIT;
+  size_t variant = 0;
+  while (variant < variants) {
+    struct birch_ptn *ptn = &tmp[prev_group_size + (variant * esl)];
+    ptn->mask = ptn_mask_gen(size, size_bytes);
+    ptn->offs = 0;
+    ptn->size = size;
+    ptn->size_bytes = size_bytes;
+    ptn->arg_str = arg_str;
+    ptn->type = type;
+    ptn->alignment = alignment;
+    ptn->endian = endian;
+    ptn->str_flags = str_flags & ~BIRCH_STR_WIDE;
+    if (variant != 0) {
+      ptn->endian = (variant == 1) ? ENDIAN_LITTLE : ENDIAN_BIG;
+      ptn->str_flags |= BIRCH_STR_WIDE;
+    }
+
+    int rc = (ptn->mask != 0)
+                 ? ptn_fill(ptn, arg_str, type, alignment, endian, size)
+                 : -1;
+    if (rc != 0) {
+      ptns_free(tmp, prev_group_size, prev_group_size + add_size);
+      return rc;
+    }
+    ++variant;
+  }
+  group->size = prev_group_size + add_size;
+  return 0;
+}
+
+void birch_compiler_init(struct birch_compiler *compiler) {
+  compiler->state = COMPILER_STATE_IDLE;
+  compiler->alignment = ALIGNMENT_ALIGNED;
+  compiler->endian = endian_native();
+  compiler->data_type = DATA_TYPE_STRING;
+  compiler->data_size = CHAR_BIT;
+  compiler->str_flags = 0;
+  compiler->group_link = 0;
+  compiler->arg_cb = 0;
+  compiler->arg_usr = 0;
+}
+
+void birch_ptn_groups_init(struct birch_ptn_groups *groups) {
+  groups->groups = 0;
+  groups->size = 0;
+  unsigned int i = 0;
+  while (i < BIRCH_MATCH_DIST_SIZE) {
+    groups->match_dist[i] = 0;
+    ++i;
+  }
+  groups->engines = 0;
+  groups->map = 0;
+  groups->map_size = 0;
+}
+
+/* returns 1 if every character of the flags arg is a pattern modifier */
+static unsigned char ptn_flags_is(char *arg) {
+  static const char PTN_FLAGS[] = "ualbnisfxtNwIg";
+  size_t j = 1;
+  while (arg[j] != '\0') {
+    if (strchr(PTN_FLAGS, arg[j]) == 0) {
+      return 0;
+    }
+    ++j;
+  }
+  return (j > 1) ? 1 : 0;
+}
+
+static void ptn_flags_apply(struct birch_compiler *compiler, char *arg) {
+  const enum endian ENDIAN_NATIVE = endian_native();
+  unsigned char endian_set = 0;
+  /* string modifiers apply until the next "s" without them */
+  if (strchr(arg, 's') != 0) {
+    compiler->str_flags = 0;
+  }
+  size_t j = 1;
+  while (arg[j] != '\0') {
+    switch (arg[j]) {
+    case 'u':
+      compiler->alignment = ALIGNMENT_UNALIGNED;
+      compiler->state = COMPILER_STATE_SIZE;
+      break;
+    case 'a':
+      compiler->alignment = ALIGNMENT_ALIGNED;
+      compiler->state = COMPILER_STATE_SIZE;
+      break;
+    case 'l':
+      if (endian_set == 0) {
+        compiler->endian = ENDIAN_LITTLE;
+      } else if (compiler->endian != ENDIAN_LITTLE) {
+        compiler->endian = ENDIAN_BOTH;
+      }
+      endian_set = 1;
+      compiler->state = COMPILER_STATE_SIZE;
+      break;
+    case 'b':
+      if (endian_set == 0) {
+        compiler->endian = ENDIAN_BIG;
+      } else if (compiler->endian != ENDIAN_BIG) {
+        compiler->endian = ENDIAN_BOTH;
+      }
+      endian_set = 1;
+      compiler->state = COMPILER_STATE_SIZE;
+      break;
+    case 'n':
+      if (endian_set == 0) {
+        compiler->endian = ENDIAN_NATIVE;
+      } else if (compiler->endian != ENDIAN_NATIVE) {
+        compiler->endian = ENDIAN_BOTH;
+      }
+      endian_set = 1;
+      compiler->state = COMPILER_STATE_SIZE;
+      break;
+    case 'i':
+      compiler->data_type = DATA_TYPE_INTEGER;
+      compiler->state = COMPILER_STATE_SIZE;
+      break;
+    case 's':
+      compiler->data_type = DATA_TYPE_STRING;
+      compiler->state = COMPILER_STATE_SIZE;
+      break;
+    case 'f':
+      compiler->data_type = DATA_TYPE_FLOAT;
+      compiler->state = COMPILER_STATE_SIZE;
+      break;
+    case 'w':
+      compiler->data_type = DATA_TYPE_STRING;
+      compiler->str_flags |= BIRCH_STR_WIDE;
+      compiler->state = COMPILER_STATE_SIZE;
+      break;
+    case 'I':
+      compiler->data_type = DATA_TYPE_STRING;
+      compiler->str_flags |= BIRCH_STR_NOCASE;
+      compiler->state = COMPILER_STATE_SIZE;
+      break;
+    case 'x':
+      compiler->data_type = DATA_TYPE_HEX;
+      compiler->state = COMPILER_STATE_SIZE;
+      break;
+    case 't':
+      compiler->data_type = DATA_TYPE_STRUCT;
+      compiler->state = COMPILER_STATE_SIZE;
+      break;
+    case 'N':
+      compiler->data_type = DATA_TYPE_NUMERIC;
+      compiler->state = COMPILER_STATE_SIZE;
+      break;
+    case 'g':
+      compiler->group_link = 1;
+      break;
+    }
+    ++j;
+  }
+  /* hex, struct and numeric patterns have no size arg */
+  if ((compiler->state == COMPILER_STATE_SIZE) &&
+      ((compiler->data_type == DATA_TYPE_HEX) ||
+       (compiler->data_type == DATA_TYPE_STRUCT) ||
+       (compiler->data_type == DATA_TYPE_NUMERIC))) {
+    compiler->state = COMPILER_STATE_PTN;
+  }
+}
+
+static int groups_add_group(struct birch_ptn_groups *groups) {
+  struct birch_ptn_group *tmp =
+      realloc_safe(groups->groups, groups->size + 1, sizeof(*tmp));
+  if (tmp == 0) {
+    return -1;
+  }
+  groups->groups = tmp;
+  ++groups->size;
+  struct birch_ptn_group *new_group = &tmp[groups->size - 1];
+  new_group->ptns = 0;
+  new_group->size = 0;
+  new_group->match.ptn = 0;
+  new_group->match.path = 0;
+  new_group->match.offs = 0;
+  return 0;
+}
+
+static int compile_arg(struct birch_compiler *compiler,
+                       struct birch_ptn_groups *groups, char *arg) {
+  /* a negative number where a pattern is expected is not an option */
+  unsigned char negative = ((compiler->state == COMPILER_STATE_PTN) &&
+                            (arg[0] == '-') &&
+                            (((arg[1] >= '0') && (arg[1] <= '9')) ||
+                             (arg[1] == '.')))
+                               ? 1
+                               : 0;
+  if ((arg[0] == '-') && (negative == 0)) {
+    if (ptn_flags_is(arg) == 0) {
+      return 1;
+    }
+    if (compiler->state != COMPILER_STATE_IDLE) {
+      birch_error_set("unexpected \"-\" arg: %s", arg);
+      return -1;
+    }
+    ptn_flags_apply(compiler, arg);
+    return 0;
+  }
+  switch (compiler->state) {
+  case COMPILER_STATE_IDLE:
+    return 1;
+  case COMPILER_STATE_SIZE:
+    compiler->data_size = strtol(arg, 0, 0);
+    compiler->state = COMPILER_STATE_PTN;
+    return 0;
+  case COMPILER_STATE_PTN:
+    break;
+  }
+
+  /* search patterns */
+  unsigned char new_group = 0;
+  if ((compiler->group_link == 0) || (groups->size == 0)) {
+    if (groups_add_group(groups) != 0) {
+      return -1;
+    }
+    new_group = 1;
+  } else {
+    compiler->group_link = 0;
+  }
+  compiler->state = COMPILER_STATE_IDLE;
+
+  struct birch_ptn_group *group = &groups->groups[groups->size - 1];
+  /* out of memory is reported as such, anything else is an invalid arg */
+  birch_error_clear();
+  if (group_add_ptn(group, arg, compiler->data_type, compiler->alignment,
+                    compiler->endian, compiler->data_size,
+                    compiler->str_flags) != 0) {
+    if (birch_error()[0] == '\0') {
+      birch_error_set("invalid pattern: %s", arg);
+    }
+    if (new_group != 0) {
+      ptn_group_free(group);
+      --groups->size;
+    }
+    return -1;
+  }
+  return 0;
+}
+
+int birch_compile_arg(struct birch_compiler *compiler,
+                      struct birch_ptn_groups *groups, char *arg) {
+  int rc = compile_arg(compiler, groups, arg);
+  if ((rc == 0) && (compiler->arg_cb != 0)) {
+    compiler->arg_cb(arg, compiler->arg_usr);
+  }
+  return rc;
+}
+
+int birch_compile_end(struct birch_compiler *compiler,
+                      struct birch_ptn_groups *groups) {
+  if (compiler->state != COMPILER_STATE_IDLE) {
+    birch_error_set("incomplete pattern");
+    return -1;
+  }
+  groups->match_dist[MATCH_NEXIST] = birch_combinations2(groups);
+  groups->match_dist[MATCH_DIR_DIFF] = 0;
+  groups->match_dist[MATCH_FILE_DIFF] = 0;
+  groups->match_dist[MATCH_OFFS_DIFF] = 0;
+  return birch_ptn_groups_engines(groups, BIRCH_ENGINE_ALL);
+}
+
+int birch_ptn_groups_engines(struct birch_ptn_groups *groups,
+                             unsigned int flags) {
+  struct birch_engines *engines;
+  if (birch_engines_build(&engines, groups, flags) != 0) {
+    birch_error_set("out of memory building matchers");
+    return -1;
+  }
+  birch_engines_free(groups->engines);
+  groups->engines = engines;
+  return 0;
+}
+
+/* splits the next whitespace delimited token from *line in place, "..." quotes
+ * with \\ escapes and # comments to the end of the line. Returns 1 if a token
+ * was found, 0 at the end of the line and -1 on an unterminated quote */
+static int token_next(char **line, char **token) {
+  char *cur = *line;
+  while ((*cur == ' ') || (*cur == '\t') || (*cur == '\r') || (*cur == '\n')) {
+    ++cur;
+  }
+  if ((*cur == '\0') || (*cur == '#')) {
+    *line = cur;
+    return 0;
+  }
+  if (*cur == '"') {
+    ++cur;
+    *token = cur;
+    char *out = cur;
+    while (*cur != '"') {
+      if ((*cur == '\0') || (*cur == '\n')) {
+        return -1;
+      }
+      if ((*cur == '\\') && (cur[1] != '\0')) {
+        ++cur;
+      }
+      *out = *cur;
+      ++out;
+      ++cur;
+    }
+    *out = '\0';
+    *line = cur + 1;
+    return 1;
+  }
+  *token = cur;
+  while ((*cur != '\0') && (*cur != ' ') && (*cur != '\t') && (*cur != '\r') &&
+         (*cur != '\n')) {
+    ++cur;
+  }
+  if (*cur != '\0') {
+    *cur = '\0';
+    ++cur;
+  }
+  *line = cur;
+  return 1;
+}
+
+int birch_compile_file(struct birch_compiler *compiler,
+                       struct birch_ptn_groups *groups, char *path) {
+  FILE *fp = (strcmp(path, "-") == 0) ? stdin : fopen(path, "r");
+  if (fp == 0) {
+    birch_error_set("cannot open pattern file: %s", path);
+    return -1;
+  }
+  char *line = 0;
+  size_t line_cap = 0;
+  unsigned long int line_no = 0;
+  int rc = 0;
+  while ((rc == 0) && (getline(&line, &line_cap, fp) >= 0)) {
+    ++line_no;
+    char *cur = line;
+    char *token;
+    int token_rc;
+    while ((rc == 0) && ((token_rc = token_next(&cur, &token)) != 0)) {
+      if (token_rc < 0) {
+        birch_error_set("%s:%lu: unterminated quote", path, line_no);
+        rc = -1;
+      } else if ((rc = birch_compile_arg(compiler, groups, token)) > 0) {
+        birch_error_set("%s:%lu: not a pattern arg: %s", path, line_no,
+                        token);
+        rc = -1;
+      } else if (rc < 0) {
+        birch_error_set("%s:%lu: %s", path, line_no, birch_error());
+      }
+    }
+  }
+  free(line);
+  if (fp != stdin) {
+    fclose(fp);
+  }
+  return rc;
+}
+
+int birch_compile(struct birch_ptn_groups *groups, int argc, char *argv[]) {
+  struct birch_compiler compiler;
+  birch_compiler_init(&compiler);
+  birch_ptn_groups_init(groups);
+  int i = 0;
+  while (i < argc) {
+    int rc = birch_compile_arg(&compiler, groups, argv[i]);
+    if (rc != 0) {
+      if (rc > 0) {
+        birch_error_set("not a pattern arg: %s", argv[i]);
+      }
+      birch_ptn_groups_free(groups);
+      return -1;
+    }
+    ++i;
+  }
+  if (birch_compile_end(&compiler, groups) != 0) {
+    birch_ptn_groups_free(groups);
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,166 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "birch_count.h"
+#include "birch_tree.h"
+
+#include <string.h>
+
+struct count_search {
+  struct birch_scan *scan;
+  struct birch_shard *shard;
+  enum print_format format;
+  unsigned char by_dir;
+  size_t *bases; /* ordinal of the first ptn of each group */
+  unsigned long long int *counts; /* by ordinal */
+  size_t *touched; /* ordinals with a count */
+  size_t touched_size;
+  char *dir; /* being counted if by_dir, "." for paths without one */
+  size_t dir_cap;
+};
+
+static void count_hit_cb(size_t group_index, struct birch_match *match,
+                         void *usr) {
+  struct count_search *search = usr;
+  struct birch_ptn_group *group = &search->scan->state.groups[group_index];
+  size_t ordinal = search->bases[group_index] + (match->ptn - group->ptns);
+  if (search->counts[ordinal] == 0) {
+    search->touched[search->touched_size] = ordinal;
+    ++search->touched_size;
+  }
+  ++search->counts[ordinal];
+}
+
+static int ordinal_cmp(const void *a, const void *b) {
+  size_t oa = *(const size_t *)a;
+  size_t ob = *(const size_t *)b;
+  return (oa < ob) ? -1 : ((oa > ob) ? 1 : 0);
+}
+
+/* prints and resets the counts, in ptn order */
+static void counts_flush(struct count_search *search, char *path) {
+  struct birch_ptn_groups *groups = &search->scan->state;
+  qsort(search->touched, search->touched_size, sizeof(*search->touched),
+        &ordinal_cmp);
+  size_t group_index = 0;
+  size_t i = 0;
+  while (i < search->touched_size) {
+    size_t ordinal = search->touched[i];
+    while (((group_index + 1) < groups->size) &&
+           (search->bases[group_index + 1] <= ordinal)) {
+      ++group_index;
+    }
+    struct birch_ptn_group *group = &groups->groups[group_index];
+    count_print(stdout, search->format, path, group_index,
+                &group->ptns[ordinal - search->bases[group_index]],
+                search->counts[ordinal]);
+    search->counts[ordinal] = 0;
+    ++i;
+  }
+  search->touched_size = 0;
+}
+
+static size_t dir_len(char *path) {
+  char *delim = strrchr(path, '/');
+  return (delim != 0) ? (size_t)(delim - path) : 0;
+}
+
+/* when path is in another directory the counts so far are flushed and it
+ * becomes the directory being counted */
+static int dir_next(struct count_search *search, char *path) {
+  size_t len = dir_len(path);
+  char *dir = (len != 0) ? path : ".";
+  if (len == 0) {
+    len = 1;
+  }
+  if ((search->dir != 0) && (strlen(search->dir) == len) &&
+      (memcmp(search->dir, dir, len) == 0)) {
+    return 0;
+  }
+  if (search->dir != 0) {
+    counts_flush(search, search->dir);
+  }
+  if (len >= search->dir_cap) {
+    char *tmp = realloc(search->dir, len + 1);
+    if (tmp == 0) {
+      return -1;
+    }
+    search->dir = tmp;
+    search->dir_cap = len + 1;
+  }
+  memcpy(search->dir, dir, len);
+  search->dir[len] = '\0';
+  return 0;
+}
+
+static int count_file(struct dir_tree_file *file, void *usr) {
+  struct count_search *search = usr;
+  if ((search->shard != 0) &&
+      (birch_shard_has(search->shard, file->path) == 0)) {
+    return 0;
+  }
+  /* the files of a directory are searched one after the other */
+  if ((search->by_dir != 0) && (dir_next(search, file->path) != 0)) {
+    return -1;
+  }
+  int rc = birch_file(search->scan, file->path);
+  if (search->by_dir == 0) {
+    counts_flush(search, file->path);
+  }
+  return rc;
+}
+
+int birch_count_search(struct birch_scan *scan, struct birch_shard *shard,
+                       struct dir_tree *tree, enum print_format format,
+                       unsigned char by_dir) {
+  struct birch_ptn_groups *groups = &scan->state;
+  struct count_search search = {.scan = scan,
+                                .shard = shard,
+                                .format = format,
+                                .by_dir = by_dir,
+                                .touched_size = 0,
+                                .dir = 0,
+                                .dir_cap = 0};
+  size_t ptns_size = 0;
+  search.bases = malloc((groups->size + 1) * sizeof(*search.bases));
+  if (search.bases == 0) {
+    return -1;
+  }
+  size_t i = 0;
+  while (i < groups->size) {
+    search.bases[i] = ptns_size;
+    ptns_size += groups->groups[i].size;
+    ++i;
+  }
+  search.counts = calloc(ptns_size + 1, sizeof(*search.counts));
+  search.touched = malloc((ptns_size + 1) * sizeof(*search.touched));
+  int rc = -1;
+  if ((search.counts != 0) && (search.touched != 0)) {
+    scan->hit_cb = &count_hit_cb;
+    scan->hit_usr = &search;
+    rc = birch_tree_each(tree, &count_file, &search);
+    if ((rc == 0) && (search.dir != 0)) {
+      counts_flush(&search, search.dir);
+    }
+    scan->hit_cb = 0;
+    scan->hit_usr = 0;
+  }
+  fflush(stdout);
+  free(search.bases);
+  free(search.counts);
+  free(search.touched);
+  free(search.dir);
+  return rc;
+}
@@ -0,0 +1,31 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BIRCH_COUNT_H
+#define BIRCH_COUNT_H
+
+#include "birch.h"
+#include "birch_print.h"
+#include "birch_shard.h"
+#include "dir_tree.h"
+
+/* counts the hits of each ptn per file, or per directory if by_dir is set,
+ * without any distance or result tracking. Prints a line for each ptn with
+ * hits as each file or directory is done */
+int birch_count_search(struct birch_scan *scan, struct birch_shard *shard,
+                       struct dir_tree *tree, enum print_format format,
+                       unsigned char by_dir);
+
+#endif
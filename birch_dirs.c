@@ -0,0 +1,205 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "birch_dirs.h"
+#include "birch_tree.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/* a directory on the path from the root to the one being searched */
+struct dirs_level {
+  uint64_t *mask; /* groups matched below */
+  size_t set;     /* bits set in mask */
+  unsigned char child_full;
+  char *path; /* of a file below, 0 if there is none */
+  size_t rel; /* directories between it and the file, 1 if it is a child */
+};
+
+struct dirs_search {
+  struct birch_scan *scan;
+  enum print_format format;
+  size_t groups_size;
+  size_t words;
+  struct dirs_level *levels;
+  size_t levels_size;
+  size_t level; /* of the directory being searched */
+  char *dir;    /* the path being printed */
+  size_t dir_cap;
+};
+
+static void dirs_hit_cb(size_t group_index, struct birch_match *match,
+                        void *usr) {
+  (void)match;
+  struct dirs_search *search = usr;
+  struct dirs_level *level = &search->levels[search->level];
+  uint64_t bit = 1ull << (group_index % 64);
+  uint64_t *word = &level->mask[group_index / 64];
+  if ((*word & bit) == 0) {
+    *word |= bit;
+    ++level->set;
+    if (level->set == search->groups_size) {
+      /* the rest of the file can not add anything */
+      search->scan->stop = 1;
+    }
+  }
+}
+
+/* enters a directory at depth index, the levels are reused between
+ * siblings */
+static int level_push(struct dirs_search *search, size_t index) {
+  if (index == search->levels_size) {
+    struct dirs_level *tmp =
+        realloc(search->levels, (index + 1) * sizeof(*tmp));
+    if (tmp == 0) {
+      return -1;
+    }
+    search->levels = tmp;
+    tmp[index].mask = malloc(search->words * sizeof(*tmp[index].mask));
+    if (tmp[index].mask == 0) {
+      return -1;
+    }
+    ++search->levels_size;
+  }
+  struct dirs_level *level = &search->levels[index];
+  memset(level->mask, 0, search->words * sizeof(*level->mask));
+  level->set = 0;
+  level->child_full = 0;
+  level->path = 0;
+  level->rel = 0;
+  return 0;
+}
+
+/* the directory rel levels above path */
+static int dir_path(struct dirs_search *search, char *path, size_t rel) {
+  size_t len = strlen(path);
+  while ((rel > 0) && (len > 0)) {
+    --len;
+    if (path[len] == '/') {
+      --rel;
+    }
+  }
+  char *dir = path;
+  if (len == 0) {
+    dir = (path[0] == '/') ? "/" : ".";
+    len = 1;
+  }
+  if (len >= search->dir_cap) {
+    char *tmp = realloc(search->dir, len + 1);
+    if (tmp == 0) {
+      return -1;
+    }
+    search->dir = tmp;
+    search->dir_cap = len + 1;
+  }
+  memcpy(search->dir, dir, len);
+  search->dir[len] = '\0';
+  return 0;
+}
+
+static int dirs_file(struct dirs_search *search, struct dir_tree_file *file) {
+  struct dirs_level *level = &search->levels[search->level];
+  if (level->path == 0) {
+    level->path = file->path;
+    level->rel = 1;
+  }
+  if (level->set == search->groups_size) {
+    return 0;
+  }
+  return birch_file(search->scan, file->path);
+}
+
+/* files first then directories, in the order of birch_tree_each() */
+static int dirs_dir(struct dirs_search *search, struct dir_tree *el,
+                    size_t index) {
+  size_t i = 0;
+  while (i < el->size) {
+    struct dir_tree *child = el->contents[i];
+    if (birch_tree_is_file(child) != 0) {
+      search->level = index;
+      if (dirs_file(search, (struct dir_tree_file *)child) != 0) {
+        return -1;
+      }
+    }
+    ++i;
+  }
+  i = 0;
+  while (i < el->size) {
+    struct dir_tree *child = el->contents[i];
+    if (child->contents != 0) {
+      if ((level_push(search, index + 1) != 0) ||
+          (dirs_dir(search, child, index + 1) != 0)) {
+        return -1;
+      }
+      struct dirs_level *level = &search->levels[index];
+      struct dirs_level *sub = &search->levels[index + 1];
+      if (sub->set == search->groups_size) {
+        level->child_full = 1;
+      }
+      if ((level->path == 0) && (sub->path != 0)) {
+        level->path = sub->path;
+        level->rel = sub->rel + 1;
+      }
+      level->set = 0;
+      size_t w = 0;
+      while (w < search->words) {
+        level->mask[w] |= sub->mask[w];
+        level->set += __builtin_popcountll(level->mask[w]);
+        ++w;
+      }
+    }
+    ++i;
+  }
+  /* the top of the tree only holds the roots */
+  struct dirs_level *level = &search->levels[index];
+  if ((index != 0) && (level->set == search->groups_size) &&
+      (level->child_full == 0) && (level->path != 0)) {
+    if (dir_path(search, level->path, level->rel) != 0) {
+      return -1;
+    }
+    dir_print(stdout, search->format, search->dir);
+  }
+  return 0;
+}
+
+int birch_dirs_search(struct birch_scan *scan, struct dir_tree *tree,
+                      enum print_format format) {
+  struct dirs_search search = {.scan = scan,
+                               .format = format,
+                               .groups_size = scan->state.size,
+                               .words = (scan->state.size + 63) / 64,
+                               .levels = 0,
+                               .levels_size = 0,
+                               .level = 0,
+                               .dir = 0,
+                               .dir_cap = 0};
+  int rc = -1;
+  if ((search.groups_size != 0) && (level_push(&search, 0) == 0)) {
+    scan->hit_cb = &dirs_hit_cb;
+    scan->hit_usr = &search;
+    rc = dirs_dir(&search, tree, 0);
+    scan->hit_cb = 0;
+    scan->hit_usr = 0;
+  }
+  fflush(stdout);
+  size_t i = 0;
+  while (i < search.levels_size) {
+    free(search.levels[i].mask);
+    ++i;
+  }
+  free(search.levels);
+  free(search.dir);
+  return rc;
+}
@@ -0,0 +1,31 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BIRCH_DIRS_H
+#define BIRCH_DIRS_H
+
+#include "birch.h"
+#include "birch_print.h"
+#include "dir_tree.h"
+
+/* prints the deepest directories with a match of every group somewhere below
+ * them, as their subtrees finish. Each hit only sets its group's bit in the
+ * mask of the directory being searched, masks are ORed into the parent as
+ * each directory is done. No distances or results are tracked, and a file is
+ * not read past the point its directory has every group */
+int birch_dirs_search(struct birch_scan *scan, struct dir_tree *tree,
+                      enum print_format format);
+
+#endif
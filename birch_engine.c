@@ -0,0 +1,365 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "birch_engine.h"
+
+#include <string.h>
+
+struct set_key {
+  uint64_t key;
+  uint32_t ordinal;
+};
+
+static size_t set_hash(uint64_t key, unsigned int shift) {
+  return (size_t)((key * 0x9E3779B97F4A7C15ull) >> shift);
+}
+
+/* patterns with wildcards are only given to the bitap engine, the others keep
+ * the ptn_match() semantics */
+static unsigned char ptn_is_bitap(struct birch_ptn *ptn, unsigned int flags) {
+  if ((flags & BIRCH_ENGINE_BITAP) == 0) {
+    return 0;
+  }
+  return ((ptn->type == DATA_TYPE_HEX) || (ptn->type == DATA_TYPE_STRUCT) ||
+          ((ptn->type == DATA_TYPE_STRING) &&
+           ((ptn->str_flags & BIRCH_STR_NOCASE) != 0)))
+             ? 1
+             : 0;
+}
+
+static unsigned char ptn_is_literal(struct birch_ptn *ptn) {
+  if ((ptn->offs != 0) || (ptn->size_bytes == 0) ||
+      (ptn->size_bytes > BIRCH_SET_WIDTH_MAX) ||
+      (ptn->size != (ptn->size_bytes * CHAR_BIT))) {
+    return 0;
+  }
+  size_t i = 0;
+  while (i < ptn->size_bytes) {
+    if (ptn->mask[i] != 0xff) {
+      return 0;
+    }
+    ++i;
+  }
+  return 1;
+}
+
+static uint64_t ptn_key(struct birch_ptn *ptn) {
+  uint64_t key = 0;
+  size_t i = 0;
+  while (i < ptn->size_bytes) {
+    key = (key << CHAR_BIT) | ptn->ptn[i];
+    ++i;
+  }
+  return key;
+}
+
+enum ptn_engine { PTN_ENGINE_SM, PTN_ENGINE_SET, PTN_ENGINE_BITAP };
+
+/* sets take precedence, once they are built */
+static enum ptn_engine ptn_engine(struct birch_engines *engines,
+                                  struct birch_ptn *ptn, unsigned int flags) {
+  if ((ptn_is_literal(ptn) != 0) &&
+      ((engines->set_widths & (1u << (ptn->size_bytes - 1))) != 0)) {
+    return PTN_ENGINE_SET;
+  } else if (ptn_is_bitap(ptn, flags) != 0) {
+    return PTN_ENGINE_BITAP;
+  }
+  return PTN_ENGINE_SM;
+}
+
+static int set_key_cmp(const void *a, const void *b) {
+  const struct set_key *ka = a;
+  const struct set_key *kb = b;
+  if (ka->key != kb->key) {
+    return (ka->key > kb->key) ? 1 : -1;
+  }
+  return (ka->ordinal > kb->ordinal) ? 1 : ((ka->ordinal < kb->ordinal) ? -1 : 0);
+}
+
+/* keys must be sorted */
+static int set_build(struct birch_set *set, struct set_key *keys,
+                     size_t keys_size) {
+  size_t unique = 0;
+  size_t i = 0;
+  while (i < keys_size) {
+    if ((i == 0) || (keys[i].key != keys[i - 1].key)) {
+      ++unique;
+    }
+    ++i;
+  }
+  set->slots_cap = 1;
+  set->hash_shift = 64;
+  while (set->slots_cap < (unique << 1)) {
+    set->slots_cap <<= 1;
+    --set->hash_shift;
+  }
+  set->slots = calloc(set->slots_cap, sizeof(*set->slots));
+  set->refs = malloc(keys_size * sizeof(*set->refs));
+  if ((set->slots == 0) || (set->refs == 0)) {
+    return -1;
+  }
+  struct birch_set_slot *slot = 0;
+  i = 0;
+  while (i < keys_size) {
+    if ((i == 0) || (keys[i].key != keys[i - 1].key)) {
+      size_t s = set_hash(keys[i].key, set->hash_shift);
+      while (set->slots[s].refs_size != 0) {
+        s = (s + 1) & (set->slots_cap - 1);
+      }
+      slot = &set->slots[s];
+      slot->key = keys[i].key;
+      slot->refs = i;
+    }
+    set->refs[i] = keys[i].ordinal;
+    ++slot->refs_size;
+    ++i;
+  }
+  return 0;
+}
+
+/* bits is the total number of pattern bytes, one state bit each, packed in
+ * ordinal order */
+static int bitap_build(struct birch_bitap *bitap, struct birch_engines *engines,
+                       unsigned int flags, size_t bits) {
+  bitap->words = (bits + 63) / 64;
+  bitap->masks = calloc((UCHAR_MAX + 1) * bitap->words, sizeof(*bitap->masks));
+  bitap->starts = calloc(bitap->words, sizeof(*bitap->starts));
+  bitap->ends = calloc(bitap->words, sizeof(*bitap->ends));
+  bitap->ordinals = calloc(bitap->words * 64, sizeof(*bitap->ordinals));
+  if ((bitap->masks == 0) || (bitap->starts == 0) || (bitap->ends == 0) ||
+      (bitap->ordinals == 0)) {
+    return -1;
+  }
+  size_t bit = 0;
+  uint32_t ordinal = 0;
+  while (ordinal < engines->ptns_size) {
+    struct birch_ptn *ptn = engines->ptns[ordinal];
+    if (ptn_engine(engines, ptn, flags) == PTN_ENGINE_BITAP) {
+      bitap->starts[bit / 64] |= 1ull << (bit % 64);
+      size_t i = 0;
+      while (i < ptn->size_bytes) {
+        unsigned int c = 0;
+        while (c <= UCHAR_MAX) {
+          if ((c & ptn->mask[i]) == ptn->ptn[i]) {
+            bitap->masks[(c * bitap->words) + (bit / 64)] |= 1ull << (bit % 64);
+          }
+          ++c;
+        }
+        ++bit;
+        ++i;
+      }
+      bitap->ends[(bit - 1) / 64] |= 1ull << ((bit - 1) % 64);
+      bitap->ordinals[bit - 1] = ordinal;
+    }
+    ++ordinal;
+  }
+  return 0;
+}
+
+int birch_engines_build(struct birch_engines **engines,
+                        struct birch_ptn_groups *groups, unsigned int flags) {
+  struct birch_engines *e = calloc(1, sizeof(*e));
+  if (e == 0) {
+    return -1;
+  }
+  size_t i = 0;
+  while (i < groups->size) {
+    e->ptns_size += groups->groups[i].size;
+    ++i;
+  }
+  e->ptns = malloc((e->ptns_size + 1) * sizeof(*e->ptns));
+  e->ptn_groups = malloc((e->ptns_size + 1) * sizeof(*e->ptn_groups));
+  e->sm = malloc((e->ptns_size + 1) * sizeof(*e->sm));
+  struct set_key *keys = malloc((e->ptns_size + 1) * sizeof(*keys));
+  if ((e->ptns == 0) || (e->ptn_groups == 0) || (e->sm == 0) || (keys == 0)) {
+    free(keys);
+    birch_engines_free(e);
+    return -1;
+  }
+
+  size_t widths_size[BIRCH_SET_WIDTH_MAX] = {0};
+  size_t ordinal = 0;
+  i = 0;
+  while (i < groups->size) {
+    struct birch_ptn_group *group = &groups->groups[i];
+    size_t j = 0;
+    while (j < group->size) {
+      struct birch_ptn *ptn = &group->ptns[j];
+      e->ptns[ordinal] = ptn;
+      e->ptn_groups[ordinal] = i;
+      if (((flags & BIRCH_ENGINE_SET) != 0) && (ptn_is_literal(ptn) != 0)) {
+        ++widths_size[ptn->size_bytes - 1];
+      }
+      ++ordinal;
+      ++j;
+    }
+    ++i;
+  }
+
+  unsigned int width = 1;
+  while (width <= BIRCH_SET_WIDTH_MAX) {
+    if (widths_size[width - 1] >= BIRCH_SET_SIZE_MIN) {
+      size_t keys_size = 0;
+      ordinal = 0;
+      while (ordinal < e->ptns_size) {
+        struct birch_ptn *ptn = e->ptns[ordinal];
+        if ((ptn->size_bytes == width) && (ptn_is_literal(ptn) != 0)) {
+          keys[keys_size].key = ptn_key(ptn);
+          keys[keys_size].ordinal = ordinal;
+          ++keys_size;
+        }
+        ++ordinal;
+      }
+      qsort(keys, keys_size, sizeof(*keys), &set_key_cmp);
+      if (set_build(&e->sets[width - 1], keys, keys_size) != 0) {
+        free(keys);
+        birch_engines_free(e);
+        return -1;
+      }
+      e->set_widths |= 1u << (width - 1);
+    }
+    ++width;
+  }
+  free(keys);
+
+  /* everything else is left to ptn_match() */
+  size_t bitap_bits = 0;
+  ordinal = 0;
+  while (ordinal < e->ptns_size) {
+    struct birch_ptn *ptn = e->ptns[ordinal];
+    switch (ptn_engine(e, ptn, flags)) {
+    case PTN_ENGINE_SM:
+      e->sm[e->sm_size] = ordinal;
+      ++e->sm_size;
+      break;
+    case PTN_ENGINE_SET:
+      break;
+    case PTN_ENGINE_BITAP:
+      bitap_bits += ptn->size_bytes;
+      break;
+    }
+    ++ordinal;
+  }
+  if ((bitap_bits != 0) && (bitap_build(&e->bitap, e, flags, bitap_bits) != 0)) {
+    birch_engines_free(e);
+    return -1;
+  }
+  *engines = e;
+  return 0;
+}
+
+void birch_engines_free(struct birch_engines *engines) {
+  if (engines == 0) {
+    return;
+  }
+  free(engines->ptns);
+  if (engines->mapped != 0) {
+    free(engines);
+    return;
+  }
+  unsigned int i = 0;
+  while (i < BIRCH_SET_WIDTH_MAX) {
+    free(engines->sets[i].slots);
+    free(engines->sets[i].refs);
+    ++i;
+  }
+  free(engines->bitap.masks);
+  free(engines->bitap.starts);
+  free(engines->bitap.ends);
+  free(engines->bitap.ordinals);
+  free(engines->ptn_groups);
+  free(engines->sm);
+  free(engines);
+}
+
+static size_t sets_probe(struct birch_engines *engines, uint64_t window,
+                         unsigned int window_size, uint32_t *hits,
+                         size_t hits_size) {
+  unsigned int width = 1;
+  while (width <= window_size) {
+    struct birch_set *set = &engines->sets[width - 1];
+    if (set->slots_cap != 0) {
+      uint64_t key = (width == BIRCH_SET_WIDTH_MAX)
+                         ? window
+                         : window & ((1ull << (width * CHAR_BIT)) - 1);
+      size_t s = set_hash(key, set->hash_shift);
+      while (set->slots[s].refs_size != 0) {
+        struct birch_set_slot *slot = &set->slots[s];
+        if (slot->key == key) {
+          memcpy(&hits[hits_size], &set->refs[slot->refs],
+                 slot->refs_size * sizeof(*hits));
+          hits_size += slot->refs_size;
+          break;
+        }
+        s = (s + 1) & (set->slots_cap - 1);
+      }
+    }
+    ++width;
+  }
+  return hits_size;
+}
+
+static size_t bitap_step(struct birch_bitap *bitap, uint64_t *state,
+                         unsigned char c, uint32_t *hits, size_t hits_size) {
+  uint64_t *masks = &bitap->masks[c * bitap->words];
+  uint64_t carry = 0;
+  size_t w = 0;
+  while (w < bitap->words) {
+    uint64_t next = state[w] >> 63;
+    state[w] = ((state[w] << 1) | carry | bitap->starts[w]) & masks[w];
+    carry = next;
+    uint64_t ends = state[w] & bitap->ends[w];
+    while (ends != 0) {
+      hits[hits_size] = bitap->ordinals[(w * 64) + __builtin_ctzll(ends)];
+      ++hits_size;
+      ends &= ends - 1;
+    }
+    ++w;
+  }
+  return hits_size;
+}
+
+size_t birch_engines_step(struct birch_engines *engines, struct birch_scan *scan,
+                          unsigned char c) {
+  uint32_t *hits = scan->hits;
+  size_t hits_size = 0;
+  if (engines->set_widths != 0) {
+    scan->window = (scan->window << CHAR_BIT) | c;
+    if (scan->window_size < BIRCH_SET_WIDTH_MAX) {
+      ++scan->window_size;
+    }
+    hits_size =
+        sets_probe(engines, scan->window, scan->window_size, hits, hits_size);
+  }
+  if (engines->bitap.words != 0) {
+    hits_size = bitap_step(&engines->bitap, scan->bitap_state, c, hits,
+                           hits_size);
+  }
+  /* hits of different widths and engines are reported in ordinal order */
+  if (hits_size > 1) {
+    size_t i = 1;
+    while (i < hits_size) {
+      uint32_t v = hits[i];
+      size_t j = i;
+      while ((j > 0) && (hits[j - 1] > v)) {
+        hits[j] = hits[j - 1];
+        --j;
+      }
+      hits[j] = v;
+      ++i;
+    }
+  }
+  return hits_size;
+}
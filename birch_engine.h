@@ -0,0 +1,85 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BIRCH_ENGINE_H
+#define BIRCH_ENGINE_H
+
+#include "birch.h"
+
+#include <stdint.h>
+
+/* widths in bytes matched by literal sets */
+#define BIRCH_SET_WIDTH_MAX (8)
+/* fewer literals of a width than this are left to ptn_match() */
+#define BIRCH_SET_SIZE_MIN (4)
+
+struct birch_set_slot {
+  uint64_t key;
+  uint32_t refs;      /* first index into birch_set.refs */
+  uint32_t refs_size; /* 0 if the slot is empty */
+};
+
+/* open addressing hash set of byte aligned, fully masked patterns of one
+ * width, keyed by their bytes with the first byte most significant */
+struct birch_set {
+  struct birch_set_slot *slots;
+  size_t slots_cap; /* power of 2, 0 if the set is unused */
+  unsigned int hash_shift;
+  uint32_t *refs; /* ptn ordinals, ascending for each slot */
+};
+
+/* shift-and over masked bytes, the patterns are packed one after another into
+ * a single bit vector. Bit i of a pattern's part of the state is set while its
+ * first i + 1 bytes match the data ending at the current byte. Unlike the
+ * replay in ptn_match() it cannot miss overlapping matches of wildcards */
+struct birch_bitap {
+  size_t words;       /* 64 bit words of state */
+  uint64_t *masks;    /* words per byte value, bits of the bytes it matches */
+  uint64_t *starts;   /* the first bit of each pattern */
+  uint64_t *ends;     /* the last bit of each pattern */
+  uint32_t *ordinals; /* by last bit */
+};
+
+/* the matchers a pattern set is split between. Ordinals number ptns group by
+ * group, the order hits at the same offset are reported in */
+struct birch_engines {
+  size_t ptns_size;
+  struct birch_ptn **ptns; /* by ordinal */
+  uint32_t *ptn_groups;    /* group index by ordinal */
+  uint32_t *sm;            /* ordinals matched by ptn_match(), ascending */
+  size_t sm_size;
+  struct birch_set sets[BIRCH_SET_WIDTH_MAX]; /* by width - 1 */
+  unsigned int set_widths;                    /* bit width - 1 set if used */
+  struct birch_bitap bitap; /* words is 0 if unused */
+  /* the tables point into a pattern set file, only ptns is allocated */
+  unsigned char mapped;
+};
+
+int birch_engines_build(struct birch_engines **engines,
+                        struct birch_ptn_groups *groups, unsigned int flags);
+void birch_engines_free(struct birch_engines *engines);
+
+/* advances the set and bitap matchers of scan by c, filling scan->hits with
+ * the ascending ordinals of the patterns ending at c. Returns their number */
+size_t birch_engines_step(struct birch_engines *engines, struct birch_scan *scan,
+                          unsigned char c);
+
+/* sets the message birch_error() returns to this thread, printf style. The
+ * library reports failures this way rather than printing */
+void birch_error_set(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2)));
+void birch_error_clear(void);
+
+#endif
@@ -19,6 +19,16 @@
 #include <string.h>
 
 #include "birch.h"
+#include "birch_bps.h"
+#include "birch_checkpoint.h"
+#include "birch_count.h"
+#include "birch_dirs.h"
+#include "birch_order.h"
+#include "birch_print.h"
+#include "birch_serve.h"
+#include "birch_shard.h"
+#include "birch_tree.h"
+#include "birch_watch.h"
 #include "dir_tree.h"
 
 static const char HELP_STR[] =
@@ -30,12 +40,22 @@ static const char HELP_STR[] =
     "Usage: birch ROOTS... PATTERNS... [OPTIONS...]\n"
     "ROOTS: Pathnames at which to start the search, can be files or "
     "directories, "
-    "if directories, a resursive search will be performed within.\n"
+    "if directories, a resursive search will be performed within. \"-\", "
+    "pipes and devices are searched as a single stream.\n"
     "PATTENRS: Of the form: \"type size pattern\".\n"
     "type:\n"
     "\tf: float\n"
     "\ti: int\n"
     "\ts: string\n"
+    "\tx: hex, bytes in memory order with no size arg, \"?\" matches any "
+    "nibble and \"HH/MM\" the bits set in MM, e.g. -x \"4D5A ?? ?? 50\"\n"
+    "\tt: struct, no size arg, \",\" separated \"OFFS TYPE SIZE VALUE\" "
+    "fields matched as one record, TYPE is i, f, s or x with optional l, b or n "
+    "and w or I, e.g. -t \"0 il 32 7, 32 fl 32 1.5, 96 s 16 ID\"\n"
+    "\tN: number, no size arg, as every int width, half, bfloat16, float, "
+    "double and varint encoding it is exact in, e.g. -N -7\n"
+    "\tw: string, also as UTF-16LE and UTF-16BE\n"
+    "\tI: string, ASCII letters of either case\n"
     "\ta: aligned\n"
     "\tu: unaligned\n"
     "\tl: little endian\n"
@@ -48,25 +68,96 @@ static const char HELP_STR[] =
     "Example: \"-ial 32 42 -gf 32 42\"\n"
     "a pattern group containing a 32 bit aligned little endian integer and a "
     "32 bit aligned little endian float.\n"
-    "OPTIONS: \"-r\": number of results to print, default 1.\n";
-static const unsigned int ENDIAN_TEST = 1;
+    "\"-F FILE\": read patterns from FILE (\"-\" for stdin), whitespace "
+    "separated as on the command line, one pattern per line, \"...\" quotes "
+    "and # comments.\n"
+    "\"-P FILE\": use the pattern set FILE written by birch compile PATTERNS... "
+    "-o FILE, without compiling the patterns again.\n"
+    "OPTIONS: \"-r\": number of results to print, default 1.\n"
+    "\"-c\": only count the hits of each pattern variant per file, printed "
+    "as \"COUNT PATTERN TYPE PATH\" lines, \"--count-dirs\" per directory "
+    "instead.\n"
+    "\"--dirs\": only print the deepest directories with a match of every "
+    "group somewhere below them, as each directory is finished.\n"
+    "\"--follow-symlinks\": follow symlinks below the roots, each file or "
+    "directory is still only searched once.\n"
+    "\"--one-file-system\": do not descend into other filesystems below the "
+    "roots.\n"
+    "\"--include GLOB\", \"--exclude GLOB\": only search files whose name "
+    "matches one of the includes and none of the excludes.\n"
+    "\"--exclude-dir GLOB\": do not descend into directories whose name "
+    "matches.\n"
+    "\"--min-size N\", \"--max-size N\": bounds on the file size in bytes, "
+    "with an optional k, M, G or T suffix.\n"
+    "\"--max-depth N\": do not walk below N levels under the roots.\n"
+    "\"--walk-threads N\": read directories on N threads ahead of the walk, "
+    "the search and its results are the same.\n"
+    "\"--newer TIME\", \"--older TIME\": bounds on the file mtime, \"@SECS\" "
+    "since the epoch or an age with an optional s, m, h, d or w suffix.\n"
+    "The walk options filter what is found below the roots, never the roots "
+    "themselves.\n"
+    "\"--stream\": print each result as soon as it is added or improved, "
+    "prefixed with \"+\", then the final results.\n"
+    "\"--ndjson\": print results as newline delimited JSON.\n"
+    "\"--watch\": after the search keep watching the roots, rescan the files "
+    "and directories that change and print the results again whenever they "
+    "change.\n"
+    "\"--shard i/N\": only search the files whose path relative to its root "
+    "hashes to shard i of N.\n"
+    "\"--dump FILE\": write the hits and results of the search to FILE, "
+    "birch merge DUMPS... [--stream] [--ndjson] combines the dumps of every "
+    "shard into the output of a single search.\n"
+    "\"--checkpoint FILE\": save the progress of the search to FILE every "
+    "minute and when interrupted, \"--checkpoint-every SECS\" sets the "
+    "interval.\n"
+    "\"--resume FILE\": continue the search saved to FILE, the roots and "
+    "patterns must be the same.\n"
+    "\"--stop-when NEXIST:DIR:FILE:OFFS\": stop the search once each of the "
+    "top results is within these match distances, numbers or \"*\" for any, "
+    "e.g. 0:0:0:64 for every group found in one file within 64 bits.\n"
+    "\"--range START:END\": only scan bytes START to END of each file, "
+    "negative from the end of the file, empty for the start or end, e.g. "
+    "--range :4096 --range -4096: for the first and last 4k. May be given "
+    "more than once, offsets are still from the start of the file.\n"
+    "\"--max-dist DIR:FILE:OFFS\": no two matches of a result are further "
+    "apart than these, numbers or \"*\" for any, e.g. 0:0:32768 for matches "
+    "in the same file within 4 KiB.\n"
+    "\"--order name|inode|extent\": read files in name (the default), inode "
+    "or first physical extent order, the results are those of name order.\n"
+    "Daemon: birch serve ROOTS... --socket PATH [--rewalk SECONDS] walks "
+    "the roots, again every SECONDS if given, and answers queries on a unix "
+    "socket, scans run concurrently.\n"
+    "birch client --socket PATH PATTERNS... [-r N] [--stream] [--ndjson] "
+    "sends a query and prints the reply.\n";
 
 struct roots {
   char **roots;
   size_t size;
 };
 
-static void *malloc_safe(size_t num, size_t size) {
-  size_t alloc_size = num * size;
-  if ((alloc_size / num) != size) {
-    exit(-1);
-  }
-  void *p = malloc(alloc_size);
-  if (p == 0) {
-    exit(-1);
-  }
-  return p;
-}
+/* the args patterns were compiled from */
+struct args {
+  char **args;
+  size_t size;
+};
+
+struct cli_opts {
+  struct dir_tree_opts walk;
+  unsigned char stream; /* print results as they improve */
+  unsigned char watch;  /* keep searching changed files */
+  enum print_format format;
+  struct birch_shard shard;
+  struct birch_checkpoint checkpoint;
+  enum birch_order order;
+  unsigned char count; /* 1 per file, 2 per directory */
+  unsigned char dirs;  /* print the directories containing every group */
+  unsigned char stop;  /* when the results are all within stop_dist */
+  unsigned long int stop_dist[BIRCH_MATCH_DIST_SIZE];
+  unsigned char max; /* no pair of matches further apart than max_dist */
+  unsigned long int max_dist[BIRCH_MATCH_DIST_SIZE];
+  struct birch_range *ranges; /* of each file to scan */
+  size_t ranges_size;
+};
 
 static void *realloc_safe(void *ptr, size_t num, size_t size) {
   size_t alloc_size = num * size;
@@ -80,409 +171,238 @@ static void *realloc_safe(void *ptr, size_t num, size_t size) {
   return p;
 }
 
-static void *calloc_safe(size_t num, size_t size) {
-  void *p = calloc(num, size);
-  if (p == 0) {
-    exit(-1);
-  }
-  return p;
-}
-
-static unsigned char *ptn_mask_gen(bit_size_t size, size_t size_bytes) {
-  unsigned char *mask = malloc_safe(size_bytes, sizeof(*mask));
-  size_t i = 0;
-  while (i < (size_bytes - 1)) {
-    mask[i] = -1;
-    ++i;
-  }
-
-  mask[i] = (1 << (size % 8)) - 1;
-  if (mask[i] == 0) {
-    mask[i] = -1;
-  }
-  return mask;
-}
-
-/* returns a copy of the bit array shifted left 1 bit, extending the length by 1
-  character if necessary */
-static unsigned char *lshift_copy(unsigned char *arr, size_t size_bytes,
-                                  size_t shifted_size_bytes) {
-  if (shifted_size_bytes == 0) {
-    return 0;
-  }
-  unsigned char *shifted = malloc_safe(shifted_size_bytes, sizeof(*shifted));
-  unsigned int rshift = CHAR_BIT - 1;
-  unsigned char prev = 0;
-  size_t i = 0;
-  while (i < size_bytes) {
-    shifted[i] = (arr[i] << 1) | (prev >> rshift);
-    prev = arr[i];
-    ++i;
-  }
-  if (i < shifted_size_bytes) {
-    shifted[i] = prev >> rshift;
-  }
-
-  return shifted;
-}
-
-/* takes a ptn, smears to CHAR_BIT ptns - the ptn shifted to all
- * possible character alignments */
-static void ptn_unalign(struct birch_ptn unaligned[CHAR_BIT]) {
-  unsigned int shift = 1;
-  while (shift < CHAR_BIT) {
-    struct birch_ptn *prev = &unaligned[shift - 1];
-    struct birch_ptn *cur = &unaligned[shift];
-    unsigned int new_offs = prev->offs + 1;
-    bit_size_t new_size = prev->size + new_offs;
-    size_t new_size_bytes = ((new_size - 1) / CHAR_BIT) + 1;
-    cur->arg_str = prev->arg_str;
-    cur->type = prev->type;
-    cur->alignment = prev->alignment;
-    cur->endian = prev->endian;
-    cur->ptn = lshift_copy(prev->ptn, prev->size_bytes, new_size_bytes);
-    cur->mask = lshift_copy(prev->mask, prev->size_bytes, new_size_bytes);
-    cur->offs = new_offs;
-    cur->size = prev->size;
-    cur->size_bytes = new_size_bytes;
-    ++shift;
-  }
-}
-
-static void endian_reverse_common(unsigned char *arr, size_t size_bytes) {
-  size_t i = 0;
-  size_t j = size_bytes - 1;
-  while (i < j) {
-    unsigned char tmp = arr[j];
-    arr[j] = arr[i];
-    arr[i] = tmp;
-    ++i;
-    --j;
-  }
-}
-
-static void endian_reverse(unsigned char *arr, bit_size_t size) {
-  endian_reverse_common(arr, ((size - 1) / CHAR_BIT) + 1);
-}
-
-static unsigned char *endian_reverse_copy(unsigned char *arr, bit_size_t size) {
-  size_t size_bytes = ((size - 1) / CHAR_BIT) + 1;
-  unsigned char *copy = malloc_safe(size_bytes, sizeof(*copy));
-  memcpy(copy, arr, size_bytes);
-  endian_reverse_common(copy, size_bytes);
-  return copy;
-}
-
-static int ptn_group_modify(struct birch_ptn *group, enum alignment alignment,
-                            enum endian endian, enum endian type_endian) {
-  unsigned int esl = 1;
-  if (alignment == ALIGNMENT_UNALIGNED) {
-    ptn_unalign(&group[0]);
-    esl = CHAR_BIT;
-  }
-  if (endian == ENDIAN_BOTH) {
-    unsigned int from = 0;
-    while (from < esl) {
-      unsigned int to = from + esl;
-      group[to].ptn =
-          endian_reverse_copy(group[from].ptn, group[from].size_bytes);
-      group[to].mask =
-          endian_reverse_copy(group[from].mask, group[from].size_bytes);
-      group[to].offs = group[from].offs;
-      group[to].size = group[from].size;
-      group[to].size_bytes = group[from].size_bytes;
-      ++from;
+/* ":" separated match_dist components from first on, each a number or "*" for
+ * any, e.g. NEXIST:DIR:FILE:OFFS */
+static int dist_parse(unsigned long int dist[BIRCH_MATCH_DIST_SIZE],
+                      unsigned int first, char *str, const char *opt,
+                      const char *fmt) {
+  char *pos = str;
+  unsigned int i = first;
+  while (i < BIRCH_MATCH_DIST_SIZE) {
+    char *end = pos;
+    if (*pos == '*') {
+      dist[i] = ULONG_MAX;
+      ++end;
+    } else if ((*pos >= '0') && (*pos <= '9')) {
+      dist[i] = strtoul(pos, &end, 0);
     }
-  } else if (endian != type_endian) {
-    unsigned int i = 0;
-    while (i < esl) {
-      endian_reverse(group[i].ptn, group[i].size_bytes);
-      endian_reverse(group[i].mask, group[i].size_bytes);
-      ++i;
+    ++i;
+    if ((end == pos) ||
+        (*end != ((i < BIRCH_MATCH_DIST_SIZE) ? ':' : '\0'))) {
+      printf("invalid %s, expected %s: %s\n", opt, fmt, str);
+      return -1;
     }
+    pos = end + 1;
   }
   return 0;
 }
 
-static void ptn_group_free(struct birch_ptn_group *group) {
-  size_t i = 0;
-  while (i < group->size) {
-    free(group->ptns[i].ptn);
-    free(group->ptns[i].mask);
-    ++i;
-  }
-  free(group->ptns);
-}
-
-static void ptn_groups_free(struct birch_ptn_groups *groups) {
-  size_t i = 0;
-  while (i < groups->size) {
-    ptn_group_free(&groups->groups[i]);
-    ++i;
-  }
-  free(groups->groups);
-}
-
-static int group_add_ptn(struct birch_ptn_group *group, char *arg_str,
-                         enum data_type type, enum alignment alignment,
-                         enum endian endian, bit_size_t size) {
-  const enum endian ENDIAN_NATIVE =
-      (*((char *)&ENDIAN_TEST) == 1) ? ENDIAN_LITTLE : ENDIAN_BIG;
-  size_t prev_group_size = group->size;
-
-  if ((endian == ENDIAN_BOTH) && (type != DATA_TYPE_STRING)) {
-    if (alignment == ALIGNMENT_UNALIGNED) {
-      group->size += CHAR_BIT << 1;
-    } else {
-      group->size += 2;
+/* START:END in bytes, negative from the end of the file, either may be empty
+ * for the start or end of the file */
+static int range_parse(struct cli_opts *opts, char *str) {
+  struct birch_range range = {0, BIRCH_RANGE_END};
+  char *end = str;
+  if (*str != ':') {
+    range.start = strtoll(str, &end, 0);
+  }
+  if ((*end == ':') && (end[1] != '\0')) {
+    char *pos = end + 1;
+    range.end = strtoll(pos, &end, 0);
+    if (end == pos) {
+      end = str;
     }
-  } else if (alignment == ALIGNMENT_UNALIGNED) {
-    group->size += CHAR_BIT;
-  } else {
-    ++group->size;
+  } else if (*end == ':') {
+    ++end;
   }
-
-  struct birch_ptn *tmp = realloc_safe(group->ptns, group->size, sizeof(*tmp));
-  group->ptns = tmp;
-
-  struct birch_ptn *ptn = &tmp[prev_group_size];
-  size_t size_bytes = (size + (CHAR_BIT - 1)) / CHAR_BIT;
-
-  ptn->mask = ptn_mask_gen(size, size_bytes);
-  if (ptn->mask == 0) {
-    free(ptn->ptn);
-    free(tmp);
+  if ((end == str) || (*end != '\0') || (range.start == LLONG_MIN) ||
+      (range.end == LLONG_MIN)) {
+    printf("invalid --range, expected START:END: %s\n", str);
     return -1;
   }
-  ptn->offs = 0;
-  ptn->size = size;
-  ptn->size_bytes = size_bytes;
-  ptn->arg_str = arg_str;
-  ptn->type = type;
-  ptn->alignment = alignment;
-  ptn->endian = endian;
-
-  switch (type) {
-  case DATA_TYPE_INTEGER:
-    ptn->ptn = bit_arr_from_str(arg_str, size_bytes);
-    if (ptn->ptn == 0) {
+  opts->ranges = realloc_safe(opts->ranges, opts->ranges_size + 1,
+                              sizeof(*opts->ranges));
+  opts->ranges[opts->ranges_size] = range;
+  ++opts->ranges_size;
+  return 0;
+}
+
+/* i is left at the last arg consumed */
+static int parse_long_opt(struct cli_opts *opts, int argc, char *argv[],
+                          int *i) {
+  char *arg = argv[*i];
+  /* options with a value */
+  if ((strcmp(arg, "--shard") == 0) || (strcmp(arg, "--dump") == 0) ||
+      (strcmp(arg, "--checkpoint") == 0) ||
+      (strcmp(arg, "--checkpoint-every") == 0) ||
+      (strcmp(arg, "--resume") == 0) || (strcmp(arg, "--order") == 0) ||
+      (strcmp(arg, "--stop-when") == 0) || (strcmp(arg, "--range") == 0) ||
+      (strcmp(arg, "--max-dist") == 0)) {
+    if ((*i + 1) >= argc) {
+      printf("%s requires a value\n", arg);
       return -1;
     }
-    ptn_group_modify(ptn, alignment, endian, ENDIAN_LITTLE);
-    break;
-  case DATA_TYPE_FLOAT: {
-    char *end;
-    char *expected_end = arg_str + strlen(arg_str);
-    if (size == (sizeof(float) * CHAR_BIT)) {
-      float f = strtof(arg_str, &end);
-      ptn->ptn = malloc_safe(1, sizeof(f));
-      memcpy(ptn->ptn, &f, sizeof(f));
-    } else if (size == (sizeof(double) * CHAR_BIT)) {
-      double d = strtod(arg_str, &end);
-      ptn->ptn = malloc_safe(1, sizeof(d));
-      memcpy(ptn->ptn, &d, sizeof(d));
+    ++*i;
+    if (strcmp(arg, "--dump") == 0) {
+      opts->shard.dump_path = argv[*i];
+    } else if (strcmp(arg, "--checkpoint") == 0) {
+      opts->checkpoint.path = argv[*i];
+    } else if (strcmp(arg, "--checkpoint-every") == 0) {
+      char *end;
+      opts->checkpoint.interval = strtoul(argv[*i], &end, 0);
+      if ((end == argv[*i]) || (*end != '\0')) {
+        printf("invalid interval: %s\n", argv[*i]);
+        return -1;
+      }
+    } else if (strcmp(arg, "--resume") == 0) {
+      opts->checkpoint.resume_path = argv[*i];
+    } else if (strcmp(arg, "--order") == 0) {
+      return birch_order_parse(&opts->order, argv[*i]);
+    } else if (strcmp(arg, "--stop-when") == 0) {
+      opts->stop = 1;
+      return dist_parse(opts->stop_dist, MATCH_NEXIST, argv[*i], arg,
+                        "NEXIST:DIR:FILE:OFFS");
+    } else if (strcmp(arg, "--max-dist") == 0) {
+      opts->max = 1;
+      return dist_parse(opts->max_dist, MATCH_DIR_DIFF, argv[*i], arg,
+                        "DIR:FILE:OFFS");
+    } else if (strcmp(arg, "--range") == 0) {
+      return range_parse(opts, argv[*i]);
     } else {
-      return -2;
-    }
-    if (end != expected_end) {
-      return -1;
+      return birch_shard_parse(&opts->shard, argv[*i]);
     }
-    ptn_group_modify(ptn, alignment, endian, ENDIAN_NATIVE);
-    break;
+    return 0;
   }
-  case DATA_TYPE_STRING:
-    if (strlen(arg_str) < ptn->size_bytes) {
-      return -1;
-    }
-    /* ignore endian for strings */
-    size_t arg_len = strlen(arg_str) + 1;
-    ptn->ptn = malloc_safe(arg_len, sizeof(*ptn->ptn));
-    strncpy((char *)ptn->ptn, arg_str, arg_len);
-    if (alignment == ALIGNMENT_UNALIGNED) {
-      ptn_unalign(ptn);
-    }
-    break;
+  int rc = dir_tree_opts_parse(&opts->walk, argc, argv, i);
+  if (rc <= 0) {
+    return rc;
+  }
+  if (strcmp(arg, "--stream") == 0) {
+    opts->stream = 1;
+  } else if (strcmp(arg, "--ndjson") == 0) {
+    opts->format = PRINT_FORMAT_NDJSON;
+  } else if (strcmp(arg, "--watch") == 0) {
+    opts->watch = 1;
+  } else if (strcmp(arg, "--count-dirs") == 0) {
+    opts->count = 2;
+  } else if (strcmp(arg, "--dirs") == 0) {
+    opts->dirs = 1;
+  } else {
+    printf("unrecognised arg: %s\n", arg);
+    return -1;
   }
-
   return 0;
 }
 
-/* coppies just enough to be useful as a result */
-static void result_from_groups(struct birch_ptn_groups *to,
-                               struct birch_ptn_groups *from) {
-  to->groups = calloc_safe(from->size, sizeof(*to->groups));
-  to->size = from->size;
-  memcpy(to->match_dist, from->match_dist, sizeof(from->match_dist));
-
-  ++to->match_dist[0];
-
-  size_t i = 0;
-  while (i < from->size) {
-    struct birch_ptn_group *group_to = &to->groups[i];
-    struct birch_ptn_group *group_from = &from->groups[i];
-    group_to->ptns = group_from->ptns;
-    group_to->size = group_from->size;
-    group_to->match.ptn = 0;
-    group_to->match.path = 0;
-    group_to->match.offs = 0;
-    ++i;
-  }
-}
-
-static size_t factorial(size_t n) {
-  size_t r = 1;
-  while (n > 0) {
-    r *= n;
-    --n;
-  }
-  return r;
-}
-
-static size_t combinations2(struct birch_ptn_groups *groups) {
-  size_t size = groups->size;
-  return (size < 2) ? 1 : factorial(size) / (factorial(size - 2) << 1);
-}
-
 static ssize_t parse_args(struct roots *roots, struct birch_ptn_groups *groups,
-                          int argc, char *argv[]) {
+                          struct cli_opts *opts, int argc, char *argv[]) {
+  roots->roots = 0;
+  roots->size = 0;
+  dir_tree_opts_init(&opts->walk);
+  opts->stream = 0;
+  opts->watch = 0;
+  opts->format = PRINT_FORMAT_TEXT;
+  birch_shard_init(&opts->shard);
+  birch_checkpoint_init(&opts->checkpoint);
+  opts->order = BIRCH_ORDER_NAME;
+  opts->count = 0;
+  opts->dirs = 0;
+  opts->stop = 0;
+  opts->max = 0;
+  opts->ranges = 0;
+  opts->ranges_size = 0;
+  birch_ptn_groups_init(groups);
+
   if (argc < 3) {
     printf("requires 2+ args\n");
     return -1;
   }
 
-  const enum endian ENDIAN_NATIVE =
-      (*((char *)&ENDIAN_TEST) == 1) ? ENDIAN_LITTLE : ENDIAN_BIG;
-
-  roots->roots = 0;
-  roots->size = 0;
-  groups->groups = 0;
-  groups->size = 0;
-  unsigned char state = 0;
-  enum alignment alignment = ALIGNMENT_ALIGNED;
-  enum endian endian = ENDIAN_NATIVE;
-  enum data_type data_type = DATA_TYPE_STRING;
-  bit_size_t data_size = CHAR_BIT;
-  unsigned char group_link = 0;
+  struct birch_compiler compiler;
+  birch_compiler_init(&compiler);
+  /* kept for dumps */
+  compiler.arg_cb = &birch_shard_arg_cb;
+  compiler.arg_usr = &opts->shard;
+  /* the option expecting the next arg */
+  char next = '\0';
   size_t results_size = 1;
+  char *set_path = 0;
 
   int i = 1;
   while (i < argc) {
     char *arg = argv[i];
-    if (arg[0] == '-') {
-      if (state != 0) {
-        printf("unexpected \"-\" arg %d/n", i);
+    if (next == 'r') {
+      results_size = strtol(arg, 0, 0);
+      next = '\0';
+    } else if (next == 'F') {
+      if (birch_compile_file(&compiler, groups, arg) != 0) {
+        printf("%s\n", birch_error());
+        return -1;
       }
-      unsigned char endian_set = 0;
-      size_t j = 1;
-      while (arg[j] != '\0') {
-        switch (arg[j]) {
-        case 'h':
-          printf("%s", HELP_STR);
-          break;
-        case 'u':
-          alignment = ALIGNMENT_UNALIGNED;
-          state = 1;
-          break;
-        case 'a':
-          alignment = ALIGNMENT_ALIGNED;
-          state = 1;
-          break;
-        case 'l':
-          if (endian_set == 0) {
-            endian = ENDIAN_LITTLE;
-          } else if (endian != ENDIAN_LITTLE) {
-            endian = ENDIAN_BOTH;
-          }
-          endian_set = 1;
-          state = 1;
-          break;
-        case 'b':
-          if (endian_set == 0) {
-            endian = ENDIAN_BIG;
-          } else if (endian != ENDIAN_BIG) {
-            endian = ENDIAN_BOTH;
-          }
-          endian_set = 1;
-          state = 1;
-          break;
-        case 'n':
-          if (endian_set == 0) {
-            endian = ENDIAN_NATIVE;
-          } else if (endian != ENDIAN_NATIVE) {
-            endian = ENDIAN_BOTH;
-          }
-          endian_set = 1;
-          state = 1;
-          break;
-        case 'i':
-          data_type = DATA_TYPE_INTEGER;
-          state = 1;
-          break;
-        case 's':
-          data_type = DATA_TYPE_STRING;
-          state = 1;
-          break;
-        case 'f':
-          data_type = DATA_TYPE_FLOAT;
-          state = 1;
-          break;
-        case 'g':
-          group_link = 1;
-          break;
-        case 'r':
-          state = 3;
-          break;
-        default:
-          printf("unrecognised arg: %c/n", arg[j]);
-          return -1;
-        }
-        ++j;
+      next = '\0';
+    } else if (next == 'P') {
+      set_path = arg;
+      next = '\0';
+    } else if ((arg[0] == '-') && (arg[1] == '-')) {
+      if (parse_long_opt(opts, argc, argv, &i) != 0) {
+        return -1;
       }
-    } else if (state == 0) {
-      /* search root */
-      int new_roots_size = roots->size + 1;
-      char **tmp = realloc_safe(roots->roots, new_roots_size, sizeof(*tmp));
-      roots->roots = tmp;
-      roots->roots[roots->size] = arg;
-      roots->size = new_roots_size;
-    } else if (state == 1) {
-      data_size = strtol(arg, 0, 0);
-      state = 2;
-    } else if (state == 3) {
-      results_size = strtol(arg, 0, 0);
-      state = 0;
     } else {
-      /* search patterns */
-      if ((group_link == 0) || (groups->size == 0)) {
-        /* new_group */
-        ++groups->size;
-        struct birch_ptn_group *tmp =
-            realloc_safe(groups->groups, groups->size, sizeof(*tmp));
-        groups->groups = tmp;
-        struct birch_ptn_group *new_group = &tmp[groups->size - 1];
-        new_group->ptns = 0;
-        new_group->size = 0;
-        new_group->match.ptn = 0;
-        new_group->match.path = 0;
-        new_group->match.offs = 0;
-      } else {
-        group_link = 0;
-      }
-
-      if (group_add_ptn(&groups->groups[groups->size - 1], arg, data_type,
-                        alignment, endian, data_size) != 0) {
+      int rc = birch_compile_arg(&compiler, groups, arg);
+      if (rc < 0) {
+        printf("%s\n", birch_error());
         return -1;
+      } else if ((rc > 0) && (arg[0] == '-') &&
+                 (strcmp(arg, DIR_TREE_STDIN) != 0)) {
+        size_t j = 1;
+        while (arg[j] != '\0') {
+          switch (arg[j]) {
+          case 'h':
+            printf("%s", HELP_STR);
+            break;
+          case 'c':
+            if (opts->count == 0) {
+              opts->count = 1;
+            }
+            break;
+          case 'r':
+          case 'F':
+          case 'P':
+            next = arg[j];
+            break;
+          default:
+            printf("unrecognised arg: %c\n", arg[j]);
+            return -1;
+          }
+          ++j;
+        }
+      } else if (rc > 0) {
+        /* search root */
+        int new_roots_size = roots->size + 1;
+        char **tmp = realloc_safe(roots->roots, new_roots_size, sizeof(*tmp));
+        roots->roots = tmp;
+        roots->roots[roots->size] = arg;
+        roots->size = new_roots_size;
       }
-      state = 0;
     }
     ++i;
   }
 
-  groups->match_dist[MATCH_NEXIST] = combinations2(groups);
-  groups->match_dist[MATCH_DIR_DIFF] = 0;
-  groups->match_dist[MATCH_FILE_DIFF] = 0;
-  groups->match_dist[MATCH_OFFS_DIFF] = 0;
-
+  if (set_path != 0) {
+    if (groups->size != 0) {
+      printf("-P can not be combined with other patterns\n");
+      return -1;
+    }
+    if (birch_bps_load(groups, set_path, compiler.arg_cb, compiler.arg_usr) !=
+        0) {
+      printf("%s\n", birch_error());
+      return -1;
+    }
+  } else if (birch_compile_end(&compiler, groups) != 0) {
+    printf("%s\n", birch_error());
+    return -1;
+  }
+  opts->shard.roots = roots->roots;
+  opts->shard.roots_size = roots->size;
   return results_size;
 }
 
@@ -521,146 +441,187 @@ static void groups_print(struct birch_ptn_groups *groups) {
 }
 */
 
-static const char *type_to_str(enum data_type type) {
-  static const char ti[] = "i";
-  static const char tf[] = "f";
-  static const char ts[] = "s";
-  static const char u[] = "";
-
-  switch (type) {
-  case DATA_TYPE_INTEGER:
-    return ti;
-  case DATA_TYPE_FLOAT:
-    return tf;
-  case DATA_TYPE_STRING:
-    return ts;
-  }
-  return u;
-}
-
-static const char *alignment_to_str(enum alignment alignment) {
-  static const char ua[] = "u";
-  static const char al[] = "a";
-  static const char u[] = "";
-
-  switch (alignment) {
-  case ALIGNMENT_UNALIGNED:
-    return ua;
-  case ALIGNMENT_ALIGNED:
-    return al;
-  }
-  return u;
-}
-
-static const char *endian_to_str(enum endian endian) {
-  static const char le[] = "l";
-  static const char be[] = "b";
-  static const char me[] = "lb";
-  static const char u[] = "";
-
-  switch (endian) {
-  case ENDIAN_LITTLE:
-    return le;
-  case ENDIAN_BIG:
-    return be;
-  case ENDIAN_BOTH:
-    return me;
-  }
-  return u;
-}
-
-static void match_print(struct birch_ptn_group *result) {
-  if (result->match.ptn != 0) {
-    struct birch_match *match = &result->match;
-    struct birch_ptn *ptn = match->ptn;
-    printf("\t%s %s%s%s %s 0x%llX\n", ptn->arg_str, type_to_str(ptn->type),
-           alignment_to_str(ptn->alignment), endian_to_str(ptn->endian),
-           match->path, match->offs);
-  }
-}
-
-static void result_print(struct birch_ptn_groups *result) {
-  size_t i = 0;
-  while (i < result->size) {
-    match_print(&result->groups[i]);
-    ++i;
-  }
-}
-
-static void results_print(struct birch_ptn_groups *results,
-                          size_t results_size) {
-  size_t nexist_max = combinations2(results);
-  size_t i = 0;
-  while (i < results_size) {
-    struct birch_ptn_groups *result = &results[i];
-    if (result->match_dist[MATCH_NEXIST] > nexist_max) {
-      break;
-    }
-
-    printf("%lu: %lx %lx %lx %lx\n", i + 1, result->match_dist[MATCH_NEXIST],
-           result->match_dist[MATCH_DIR_DIFF],
-           result->match_dist[MATCH_FILE_DIFF],
-           result->match_dist[MATCH_OFFS_DIFF]);
-    result_print(result);
-    ++i;
+static void args_cb(char *arg, void *usr) {
+  struct args *args = usr;
+  args->args = realloc_safe(args->args, args->size + 1, sizeof(*args->args));
+  args->args[args->size] = strdup(arg);
+  if (args->args[args->size] == 0) {
+    exit(-1);
   }
+  ++args->size;
 }
 
-static int dir_tree_search_file(struct birch_ptn_groups *results,
-                                size_t results_size, struct dir_tree *el,
-                                struct birch_ptn_groups *groups) {
-  return ((el->contents == 0) && (el->size == 1))
-             ? birch_file(results, results_size,
-                          ((struct dir_tree_file *)el)->path, groups)
-             : 0;
-}
-
-static int dir_tree_search_dir(struct birch_ptn_groups *results,
-                               size_t results_size, struct dir_tree *el,
-                               struct birch_ptn_groups *groups) {
+/* birch compile PATTERNS... -o FILE */
+static int compile_main(int argc, char *argv[]) {
+  struct birch_ptn_groups groups;
+  birch_ptn_groups_init(&groups);
+  struct args args = {0, 0};
+  struct birch_compiler compiler;
+  birch_compiler_init(&compiler);
+  compiler.arg_cb = &args_cb;
+  compiler.arg_usr = &args;
+  char *path = 0;
+  char next = '\0';
   int rc = 0;
-  if (el->contents != 0) {
-    /* is dir */
-    size_t i = 0;
-    while (i < el->size) {
-      rc = dir_tree_search_file(results, results_size, el->contents[i], groups);
+  int i = 1;
+  while ((i < argc) && (rc == 0)) {
+    char *arg = argv[i];
+    if (next == 'o') {
+      path = arg;
+      next = '\0';
+    } else if (next == 'F') {
+      rc = birch_compile_file(&compiler, &groups, arg);
       if (rc != 0) {
-        return rc;
+        printf("%s\n", birch_error());
       }
-      ++i;
-    }
-
-    i = 0;
-    while (i < el->size) {
-      rc = dir_tree_search_dir(results, results_size, el->contents[i], groups);
-      if (rc != 0) {
-        return rc;
+      next = '\0';
+    } else {
+      rc = birch_compile_arg(&compiler, &groups, arg);
+      if ((rc > 0) &&
+          ((strcmp(arg, "-o") == 0) || (strcmp(arg, "-F") == 0))) {
+        next = arg[1];
+        rc = 0;
+      } else if (rc > 0) {
+        printf("unrecognised arg: %s\n", arg);
+      } else if (rc < 0) {
+        printf("%s\n", birch_error());
       }
-      ++i;
     }
+    ++i;
+  }
+  if ((rc == 0) && ((path == 0) || (next != '\0'))) {
+    printf("Usage: birch compile PATTERNS... -o FILE\n");
+    rc = -1;
+  }
+  if ((rc == 0) && (birch_compile_end(&compiler, &groups) != 0)) {
+    printf("%s\n", birch_error());
+    rc = -1;
   }
-  return rc;
+  if ((rc == 0) && (groups.size == 0)) {
+    printf("no patterns\n");
+    rc = -1;
+  }
+  if ((rc == 0) &&
+      (birch_bps_write(&groups, args.args, args.size, path) != 0)) {
+    printf("%s\n", birch_error());
+    rc = -1;
+  }
+  size_t j = 0;
+  while (j < args.size) {
+    free(args.args[j]);
+    ++j;
+  }
+  free(args.args);
+  birch_ptn_groups_free(&groups);
+  return (rc == 0) ? 0 : -1;
+}
+
+static void stream_results_cb(struct birch_ptn_groups *results,
+                              size_t results_size, size_t index, void *usr) {
+  (void)results_size;
+  struct cli_opts *opts = usr;
+  result_update_print(stdout, opts->format, results, index);
 }
 
 int main(int argc, char *argv[]) {
+  if ((argc > 1) && (strcmp(argv[1], "serve") == 0)) {
+    return birch_serve(argc - 1, &argv[1]);
+  } else if ((argc > 1) && (strcmp(argv[1], "client") == 0)) {
+    return birch_client(argc - 1, &argv[1]);
+  } else if ((argc > 1) && (strcmp(argv[1], "merge") == 0)) {
+    return birch_merge(argc - 1, &argv[1]);
+  } else if ((argc > 1) && (strcmp(argv[1], "compile") == 0)) {
+    return compile_main(argc - 1, &argv[1]);
+  }
+
   struct roots roots;
   struct birch_ptn_groups groups;
-  ssize_t results_size = parse_args(&roots, &groups, argc, argv);
+  struct cli_opts opts;
+  ssize_t results_size = parse_args(&roots, &groups, &opts, argc, argv);
   if (results_size <= 0) {
     free(roots.roots);
-    ptn_groups_free(&groups);
+    birch_shard_free(&opts.shard);
+    dir_tree_opts_free(&opts.walk);
+    free(opts.ranges);
+    birch_ptn_groups_free(&groups);
     return -1;
   }
 
   if (roots.size == 0) {
     printf("At least one root path required\n");
     free(roots.roots);
-    ptn_groups_free(&groups);
+    birch_shard_free(&opts.shard);
+    dir_tree_opts_free(&opts.walk);
+    free(opts.ranges);
+    birch_ptn_groups_free(&groups);
+    return -1;
+  }
+
+  unsigned char checkpoint = ((opts.checkpoint.path != 0) ||
+                               (opts.checkpoint.resume_path != 0))
+                                  ? 1
+                                  : 0;
+  const char *unsupported = 0;
+  if ((checkpoint != 0) && (opts.shard.dump_path != 0)) {
+    unsupported = "--dump does not support --checkpoint or --resume";
+  } else if ((opts.order != BIRCH_ORDER_NAME) &&
+             ((checkpoint != 0) || (opts.shard.size != 0) ||
+              (opts.shard.dump_path != 0) || (opts.watch != 0))) {
+    unsupported = "--order does not support --shard, --dump, --checkpoint or "
+                  "--watch";
+  } else if ((opts.count != 0) &&
+             ((checkpoint != 0) || (opts.shard.dump_path != 0) ||
+              (opts.order != BIRCH_ORDER_NAME) || (opts.stream != 0) ||
+              (opts.watch != 0))) {
+    unsupported = "-c does not support --dump, --checkpoint, --order, "
+                  "--stream or --watch";
+  } else if ((opts.stop != 0) &&
+             ((opts.shard.dump_path != 0) || (opts.order != BIRCH_ORDER_NAME) ||
+              (opts.count != 0) || (opts.watch != 0))) {
+    unsupported = "--stop-when does not support --dump, --order, -c or "
+                  "--watch";
+  } else if ((opts.max != 0) &&
+             ((opts.shard.dump_path != 0) || (opts.count != 0) ||
+              (opts.watch != 0))) {
+    unsupported = "--max-dist does not support --dump, -c or --watch";
+  } else if ((opts.ranges_size != 0) && (opts.watch != 0)) {
+    unsupported = "--range does not support --watch";
+  } else if ((opts.dirs != 0) &&
+             ((checkpoint != 0) || (opts.shard.size != 0) ||
+              (opts.shard.dump_path != 0) || (opts.order != BIRCH_ORDER_NAME) ||
+              (opts.stream != 0) || (opts.watch != 0) || (opts.stop != 0) ||
+              (opts.max != 0) || (opts.count != 0))) {
+    unsupported = "--dirs does not support --shard, --dump, --checkpoint, "
+                  "--order, --stream, --watch, --stop-when, --max-dist or -c";
+  }
+  if (unsupported != 0) {
+    printf("%s\n", unsupported);
+    free(roots.roots);
+    birch_shard_free(&opts.shard);
+    dir_tree_opts_free(&opts.walk);
+    free(opts.ranges);
+    birch_ptn_groups_free(&groups);
+    return -1;
+  }
+
+  if (opts.watch != 0) {
+    if ((opts.shard.size != 0) || (opts.shard.dump_path != 0) ||
+        (checkpoint != 0)) {
+      printf("--watch does not support --shard, --dump or --checkpoint\n");
+    } else {
+      birch_watch(roots.roots, roots.size, &opts.walk, &groups, results_size,
+                  opts.format);
+    }
+    free(roots.roots);
+    birch_shard_free(&opts.shard);
+    dir_tree_opts_free(&opts.walk);
+    free(opts.ranges);
+    birch_ptn_groups_free(&groups);
     return -1;
   }
 
   struct dir_tree *tree;
-  if (dir_tree_multi(&tree, roots.roots, roots.size) != 0) {
+  if (dir_tree_multi(&tree, roots.roots, roots.size, &opts.walk) != 0) {
     printf("File tree walk failed, roots:\n");
     size_t i = 0;
     while (i < roots.size) {
@@ -668,39 +629,85 @@ int main(int argc, char *argv[]) {
       ++i;
     }
     free(roots.roots);
-    ptn_groups_free(&groups);
+    birch_shard_free(&opts.shard);
+    dir_tree_opts_free(&opts.walk);
+    free(opts.ranges);
+    birch_ptn_groups_free(&groups);
     return -1;
   }
 
-  free(roots.roots);
-
   /*
   dir_tree_print(tree);
   groups_print(&groups);
   */
 
-  /* allocate and initialise results */
-  struct birch_ptn_groups *results =
-      malloc_safe(results_size, sizeof(*results));
-  ssize_t i = 0;
-  while (i < results_size) {
-    result_from_groups(&results[i], &groups);
-    ++i;
+  struct birch_results results;
+  if (birch_results_init(&results, &groups, results_size) != 0) {
+    free(roots.roots);
+    birch_shard_free(&opts.shard);
+    dir_tree_opts_free(&opts.walk);
+    free(opts.ranges);
+    birch_ptn_groups_free(&groups);
+    dir_tree_free(tree);
+    return -1;
+  }
+  if (opts.stream != 0) {
+    results.cb = &stream_results_cb;
+    results.usr = &opts;
+  }
+  if (opts.stop != 0) {
+    results.stop = 1;
+    memcpy(results.stop_dist, opts.stop_dist, sizeof(results.stop_dist));
+  }
+  if (opts.max != 0) {
+    results.max = 1;
+    memcpy(results.max_dist, opts.max_dist, sizeof(results.max_dist));
+  }
+  struct birch_scan scan;
+  if (birch_scan_init(&scan, &groups, &results) != 0) {
+    birch_results_free(&results);
+    free(roots.roots);
+    birch_shard_free(&opts.shard);
+    dir_tree_opts_free(&opts.walk);
+    free(opts.ranges);
+    birch_ptn_groups_free(&groups);
+    dir_tree_free(tree);
+    return -1;
+  }
+  scan.ranges = opts.ranges;
+  scan.ranges_size = opts.ranges_size;
+
+  int rc;
+  if (opts.count != 0) {
+    rc = birch_count_search(&scan, &opts.shard, tree, opts.format,
+                            (opts.count == 2) ? 1 : 0);
+  } else if (opts.dirs != 0) {
+    rc = birch_dirs_search(&scan, tree, opts.format);
+  } else if (opts.order != BIRCH_ORDER_NAME) {
+    rc = birch_order_search(opts.order, &scan, tree);
+  } else if (checkpoint != 0) {
+    rc = birch_checkpoint_search(&opts.checkpoint, &opts.shard, &scan, tree);
+  } else if ((opts.shard.size != 0) || (opts.shard.dump_path != 0)) {
+    /* the shard keeps the roots to name the files in its dump */
+    rc = birch_shard_search(&opts.shard, &scan, tree);
+  } else {
+    rc = birch_tree_search(&scan, tree);
   }
-
   int r = -1;
-  if (dir_tree_search_dir(results, results_size, tree, &groups) == 0) {
-    results_print(results, results_size);
+  if ((rc == 0) && ((opts.count != 0) || (opts.dirs != 0))) {
+    r = 0;
+  } else if (rc == 0) {
+    results_print(stdout, opts.format, results.results, results.size);
     r = 0;
   }
 
-  i = 0;
-  while (i < results_size) {
-    free(results[i].groups);
-    ++i;
-  }
-  ptn_groups_free(&groups);
-  free(results);
+  birch_scan_free(&scan);
+  birch_results_free(&results);
+  free(roots.roots);
+  birch_shard_free(&opts.shard);
+  dir_tree_opts_free(&opts.walk);
+  free(opts.ranges);
+  birch_ptn_groups_free(&groups);
   dir_tree_free(tree);
 
   return r;
@@ -0,0 +1,192 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "birch_order.h"
+#include "birch_tree.h"
+
+#include <fcntl.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* files are reordered within windows of this many in name order */
+#define ORDER_WINDOW_FILES (4096)
+
+struct order_file {
+  char *path;
+  size_t index; /* in name order */
+  unsigned long long int key;
+  struct birch_hits hits;
+};
+
+struct order_files {
+  struct order_file *files;
+  size_t size;
+  size_t cap;
+};
+
+int birch_order_parse(enum birch_order *order, char *str) {
+  if (strcmp(str, "name") == 0) {
+    *order = BIRCH_ORDER_NAME;
+  } else if (strcmp(str, "inode") == 0) {
+    *order = BIRCH_ORDER_INODE;
+  } else if (strcmp(str, "extent") == 0) {
+    *order = BIRCH_ORDER_EXTENT;
+  } else {
+    printf("invalid order, expected name, inode or extent: %s\n", str);
+    return -1;
+  }
+  return 0;
+}
+
+static int files_add_cb(struct dir_tree_file *file, void *usr) {
+  struct order_files *files = usr;
+  if (files->size == files->cap) {
+    size_t new_cap = (files->cap == 0) ? 256 : files->cap << 1;
+    struct order_file *tmp = realloc(files->files, new_cap * sizeof(*tmp));
+    if (tmp == 0) {
+      return -1;
+    }
+    files->files = tmp;
+    files->cap = new_cap;
+  }
+  struct order_file *f = &files->files[files->size];
+  f->path = file->path;
+  f->index = files->size;
+  f->key = 0;
+  birch_hits_init(&f->hits);
+  ++files->size;
+  return 0;
+}
+
+/* the physical byte offset of the start of the file, 0 if it has none */
+static int extent_key(int fd, unsigned long long int *key) {
+  struct {
+    struct fiemap map;
+    struct fiemap_extent extent;
+  } fm;
+  memset(&fm, 0, sizeof(fm));
+  fm.map.fm_start = 0;
+  fm.map.fm_length = FIEMAP_MAX_OFFSET;
+  fm.map.fm_extent_count = 1;
+  if (ioctl(fd, FS_IOC_FIEMAP, &fm.map) != 0) {
+    return -1;
+  }
+  *key = (fm.map.fm_mapped_extents != 0) ? fm.extent.fe_physical : 0;
+  return 0;
+}
+
+/* streams, which must only be opened once, and files that cannot be stat()ed
+ * keep key 0 and are read first, the scan reports the errors */
+static void file_key(struct order_file *file, enum birch_order order) {
+  struct stat s;
+  if ((strcmp(file->path, DIR_TREE_STDIN) == 0) ||
+      (stat(file->path, &s) != 0) || (S_ISREG(s.st_mode) == 0)) {
+    return;
+  }
+  file->key = s.st_ino;
+  if (order == BIRCH_ORDER_EXTENT) {
+    int fd = open(file->path, O_RDONLY);
+    if (fd >= 0) {
+      unsigned long long int key;
+      if (extent_key(fd, &key) == 0) {
+        file->key = key;
+      }
+      close(fd);
+    }
+  }
+}
+
+static int key_cmp(const void *a, const void *b) {
+  const struct order_file *fa = a;
+  const struct order_file *fb = b;
+  if (fa->key != fb->key) {
+    return (fa->key < fb->key) ? -1 : 1;
+  }
+  return (fa->index < fb->index) ? -1 : ((fa->index > fb->index) ? 1 : 0);
+}
+
+static int index_cmp(const void *a, const void *b) {
+  const struct order_file *fa = a;
+  const struct order_file *fb = b;
+  return (fa->index < fb->index) ? -1 : ((fa->index > fb->index) ? 1 : 0);
+}
+
+/* reads the files of a window in order, then applies their hits in name order
+ */
+static int window_search(enum birch_order order, struct birch_scan *scan,
+                         struct order_file *files, size_t size) {
+  size_t i = 0;
+  while (i < size) {
+    file_key(&files[i], order);
+    ++i;
+  }
+  qsort(files, size, sizeof(*files), &key_cmp);
+
+  int rc = 0;
+  i = 0;
+  while ((rc == 0) && (i < size)) {
+    struct order_file *file = &files[i];
+    scan->hit_cb = &birch_hits_cb;
+    scan->hit_usr = &file->hits;
+    rc = birch_file(scan, file->path);
+    if (file->hits.err != 0) {
+      rc = -1;
+    }
+    ++i;
+  }
+  scan->hit_cb = 0;
+  scan->hit_usr = 0;
+
+  if (rc == 0) {
+    qsort(files, size, sizeof(*files), &index_cmp);
+    i = 0;
+    while (i < size) {
+      birch_hits_replay(scan, &files[i].hits);
+      ++i;
+    }
+  }
+  i = 0;
+  while (i < size) {
+    birch_hits_free(&files[i].hits);
+    ++i;
+  }
+  return rc;
+}
+
+int birch_order_search(enum birch_order order, struct birch_scan *scan,
+                       struct dir_tree *tree) {
+  if (order == BIRCH_ORDER_NAME) {
+    return birch_tree_search(scan, tree);
+  }
+  struct order_files files = {.files = 0, .size = 0, .cap = 0};
+  int rc = birch_tree_each(tree, &files_add_cb, &files);
+  /* only the hits of one window are held at a time */
+  size_t start = 0;
+  while ((rc == 0) && (start < files.size) && (scan->results->done == 0)) {
+    size_t size = files.size - start;
+    if (size > ORDER_WINDOW_FILES) {
+      size = ORDER_WINDOW_FILES;
+    }
+    rc = window_search(order, scan, &files.files[start], size);
+    start += size;
+  }
+  free(files.files);
+  return rc;
+}
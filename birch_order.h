@@ -0,0 +1,37 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BIRCH_ORDER_H
+#define BIRCH_ORDER_H
+
+#include "birch.h"
+#include "dir_tree.h"
+
+/* the order files are read in, the results are always those of name order */
+enum birch_order {
+  BIRCH_ORDER_NAME,
+  BIRCH_ORDER_INODE,
+  BIRCH_ORDER_EXTENT /* first physical extent, by inode where unknown */
+};
+
+/* parses "name", "inode" or "extent" */
+int birch_order_parse(enum birch_order *order, char *str);
+/* as birch_tree_search(), reading the files in the given order within
+ * windows of consecutive files in name order. The hits of each file of a
+ * window are kept and applied in name order once all have been read */
+int birch_order_search(enum birch_order order, struct birch_scan *scan,
+                       struct dir_tree *tree);
+
+#endif
@@ -0,0 +1,251 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "birch_print.h"
+
+/* "N" and the encoding of a numeric variant, e.g. "Ni32" or "Nbf16" */
+static const char *num_to_str(struct birch_ptn *ptn) {
+  static const char *ints[] = {"Ni8", "Ni16", "Ni32", "Ni64"};
+  static const char *floats[] = {"Nf16", "Nf32", "Nf64"};
+  static const char u[] = "N";
+
+  switch (ptn->num_enc) {
+  case BIRCH_NUM_INT:
+    return (ptn->size == 8)    ? ints[0]
+           : (ptn->size == 16) ? ints[1]
+           : (ptn->size == 32) ? ints[2]
+                               : ints[3];
+  case BIRCH_NUM_FLOAT:
+    return (ptn->size == 16)   ? floats[0]
+           : (ptn->size == 32) ? floats[1]
+                               : floats[2];
+  case BIRCH_NUM_BFLOAT:
+    return "Nbf16";
+  case BIRCH_NUM_VARINT:
+    return "Nv";
+  case BIRCH_NUM_ZIGZAG:
+    return "Nz";
+  }
+  return u;
+}
+
+static const char *type_to_str(struct birch_ptn *ptn) {
+  static const char ti[] = "i";
+  static const char tf[] = "f";
+  static const char ts[] = "s";
+  static const char tx[] = "x";
+  static const char tt[] = "t";
+  static const char u[] = "";
+
+  switch (ptn->type) {
+  case DATA_TYPE_INTEGER:
+    return ti;
+  case DATA_TYPE_FLOAT:
+    return tf;
+  case DATA_TYPE_STRING:
+    return ts;
+  case DATA_TYPE_HEX:
+    return tx;
+  case DATA_TYPE_STRUCT:
+    return tt;
+  case DATA_TYPE_NUMERIC:
+    return num_to_str(ptn);
+  }
+  return u;
+}
+
+static const char *str_flags_to_str(unsigned char str_flags) {
+  static const char *strs[] = {"", "w", "I", "wI"};
+  return strs[str_flags & (BIRCH_STR_WIDE | BIRCH_STR_NOCASE)];
+}
+
+static const char *alignment_to_str(enum alignment alignment) {
+  static const char ua[] = "u";
+  static const char al[] = "a";
+  static const char u[] = "";
+
+  switch (alignment) {
+  case ALIGNMENT_UNALIGNED:
+    return ua;
+  case ALIGNMENT_ALIGNED:
+    return al;
+  }
+  return u;
+}
+
+static const char *endian_to_str(enum endian endian) {
+  static const char le[] = "l";
+  static const char be[] = "b";
+  static const char me[] = "lb";
+  static const char u[] = "";
+
+  switch (endian) {
+  case ENDIAN_LITTLE:
+    return le;
+  case ENDIAN_BIG:
+    return be;
+  case ENDIAN_BOTH:
+    return me;
+  }
+  return u;
+}
+
+static void json_str_print(FILE *fp, const char *str) {
+  fputc('"', fp);
+  while (*str != '\0') {
+    unsigned char c = *str;
+    if ((c == '"') || (c == '\\')) {
+      fprintf(fp, "\\%c", c);
+    } else if (c < 0x20) {
+      fprintf(fp, "\\u%04x", c);
+    } else {
+      fputc(c, fp);
+    }
+    ++str;
+  }
+  fputc('"', fp);
+}
+
+static void match_print(FILE *fp, struct birch_ptn_group *result) {
+  if (result->match.ptn != 0) {
+    struct birch_match *match = &result->match;
+    struct birch_ptn *ptn = match->ptn;
+    fprintf(fp, "\t%s %s%s%s%s %s 0x%llX\n", ptn->arg_str,
+            type_to_str(ptn), str_flags_to_str(ptn->str_flags),
+            alignment_to_str(ptn->alignment), endian_to_str(ptn->endian),
+            match->path, match->offs);
+  }
+}
+
+static void result_print(FILE *fp, struct birch_ptn_groups *result) {
+  size_t i = 0;
+  while (i < result->size) {
+    match_print(fp, &result->groups[i]);
+    ++i;
+  }
+}
+
+static void result_dist_print(FILE *fp, struct birch_ptn_groups *result,
+                              size_t index) {
+  fprintf(fp, "%lu: %lx %lx %lx %lx\n", index + 1,
+          result->match_dist[MATCH_NEXIST], result->match_dist[MATCH_DIR_DIFF],
+          result->match_dist[MATCH_FILE_DIFF],
+          result->match_dist[MATCH_OFFS_DIFF]);
+}
+
+/* {"rank":1,"match_dist":[0,0,0,40],"matches":[{...},...]} */
+static void result_json_print(FILE *fp, struct birch_ptn_groups *result,
+                              size_t index) {
+  fprintf(fp, "{\"rank\":%lu,\"match_dist\":[%lu,%lu,%lu,%lu],\"matches\":[",
+          index + 1, result->match_dist[MATCH_NEXIST],
+          result->match_dist[MATCH_DIR_DIFF],
+          result->match_dist[MATCH_FILE_DIFF],
+          result->match_dist[MATCH_OFFS_DIFF]);
+  unsigned char first = 1;
+  size_t i = 0;
+  while (i < result->size) {
+    struct birch_match *match = &result->groups[i].match;
+    struct birch_ptn *ptn = match->ptn;
+    if (ptn != 0) {
+      if (first == 0) {
+        fputc(',', fp);
+      }
+      first = 0;
+      fprintf(fp, "{\"group\":%lu,\"ptn\":", i);
+      json_str_print(fp, ptn->arg_str);
+      fprintf(fp, ",\"type\":\"%s%s%s%s\",\"path\":",
+              type_to_str(ptn), str_flags_to_str(ptn->str_flags),
+              alignment_to_str(ptn->alignment), endian_to_str(ptn->endian));
+      json_str_print(fp, match->path);
+      fprintf(fp, ",\"offs\":%llu}", match->offs);
+    }
+    ++i;
+  }
+  fprintf(fp, "]}");
+}
+
+void results_print(FILE *fp, enum print_format format,
+                   struct birch_ptn_groups *results, size_t results_size) {
+  size_t nexist_max = birch_combinations2(results);
+  if (format == PRINT_FORMAT_NDJSON) {
+    fprintf(fp, "{\"event\":\"final\",\"results\":[");
+  }
+  size_t i = 0;
+  while (i < results_size) {
+    struct birch_ptn_groups *result = &results[i];
+    if (result->match_dist[MATCH_NEXIST] > nexist_max) {
+      break;
+    }
+
+    if (format == PRINT_FORMAT_NDJSON) {
+      if (i != 0) {
+        fputc(',', fp);
+      }
+      result_json_print(fp, result, i);
+    } else {
+      result_dist_print(fp, result, i);
+      result_print(fp, result);
+    }
+    ++i;
+  }
+  if (format == PRINT_FORMAT_NDJSON) {
+    fprintf(fp, "]}\n");
+  }
+  fflush(fp);
+}
+
+void result_update_print(FILE *fp, enum print_format format,
+                         struct birch_ptn_groups *results, size_t index) {
+  if (format == PRINT_FORMAT_NDJSON) {
+    fprintf(fp, "{\"event\":\"update\",\"result\":");
+    result_json_print(fp, &results[index], index);
+    fprintf(fp, "}\n");
+  } else {
+    fputc('+', fp);
+    result_dist_print(fp, &results[index], index);
+    result_print(fp, &results[index]);
+  }
+  /* consumers read updates as they arrive */
+  fflush(fp);
+}
+
+void count_print(FILE *fp, enum print_format format, char *path,
+                 size_t group_index, struct birch_ptn *ptn,
+                 unsigned long long int count) {
+  if (format == PRINT_FORMAT_NDJSON) {
+    fprintf(fp, "{\"event\":\"count\",\"path\":");
+    json_str_print(fp, path);
+    fprintf(fp, ",\"group\":%lu,\"ptn\":", group_index);
+    json_str_print(fp, ptn->arg_str);
+    fprintf(fp, ",\"type\":\"%s%s%s%s\",\"count\":%llu}\n",
+            type_to_str(ptn), str_flags_to_str(ptn->str_flags),
+            alignment_to_str(ptn->alignment), endian_to_str(ptn->endian),
+            count);
+  } else {
+    fprintf(fp, "%llu\t%s %s%s%s%s %s\n", count, ptn->arg_str,
+            type_to_str(ptn), str_flags_to_str(ptn->str_flags),
+            alignment_to_str(ptn->alignment), endian_to_str(ptn->endian), path);
+  }
+}
+
+void dir_print(FILE *fp, enum print_format format, char *path) {
+  if (format == PRINT_FORMAT_NDJSON) {
+    fprintf(fp, "{\"event\":\"dir\",\"path\":");
+    json_str_print(fp, path);
+    fprintf(fp, "}\n");
+  } else {
+    fprintf(fp, "%s\n", path);
+  }
+}
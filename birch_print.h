@@ -0,0 +1,38 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BIRCH_PRINT_H
+#define BIRCH_PRINT_H
+
+#include "birch.h"
+
+#include <stdio.h>
+
+enum print_format { PRINT_FORMAT_TEXT, PRINT_FORMAT_NDJSON };
+
+/* the final results */
+void results_print(FILE *fp, enum print_format format,
+                   struct birch_ptn_groups *results, size_t results_size);
+/* a single changed result while the search is still running */
+void result_update_print(FILE *fp, enum print_format format,
+                         struct birch_ptn_groups *results, size_t index);
+/* the hits of a ptn in a file or directory */
+void count_print(FILE *fp, enum print_format format, char *path,
+                 size_t group_index, struct birch_ptn *ptn,
+                 unsigned long long int count);
+/* a directory with a match of every group below it */
+void dir_print(FILE *fp, enum print_format format, char *path);
+
+#endif
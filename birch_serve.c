@@ -0,0 +1,749 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include "birch_serve.h"
+
+#include "birch.h"
+#include "birch_print.h"
+#include "birch_tree.h"
+#include "dir_tree.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/* a query is its args, each terminated by '\0', then an empty arg */
+#define QUERY_SIZE_MAX (1024 * 1024)
+#define PTN_CACHE_SIZE (16)
+#define QUERY_RESULTS_MAX (1024)
+/* connections served at once, more wait in the listen backlog */
+#define SERVE_CONNS_MAX (64)
+/* a connection idle for this long is dropped */
+#define SERVE_CONN_TIMEOUT_S (30)
+/* the wait after accept() runs out of descriptors or memory */
+#define SERVE_BACKOFF_MS (100)
+
+static const char KEY_DELIM = '\x1f';
+
+struct ptn_cache_entry {
+  char *key; /* pattern args joined by KEY_DELIM */
+  struct birch_ptn_groups groups;
+  unsigned int refs; /* queries using groups, entries in use are not evicted */
+  unsigned long long int used;
+};
+
+/* a walk of the roots, read only once serving */
+struct serve_tree {
+  struct dir_tree *tree;
+  unsigned int refs; /* queries using it, freed by the last once replaced */
+};
+
+struct serve {
+  struct serve_tree *tree;
+  pthread_mutex_t lock; /* guards the cache and the tree */
+  struct ptn_cache_entry cache[PTN_CACHE_SIZE];
+  size_t cache_size;
+  unsigned long long int clock;
+  char **roots;
+  size_t roots_size;
+  struct dir_tree_opts *walk;
+  unsigned int rewalk; /* seconds between walks of the roots, 0 for never */
+  unsigned int conns;  /* connections being served, guarded by lock */
+  int done_fds[2];     /* a byte is written as each connection ends */
+};
+
+struct serve_conn {
+  struct serve *serve;
+  int fd;
+};
+
+struct query {
+  FILE *fp;
+  enum print_format format;
+  unsigned char stream;
+  size_t results_size;
+};
+
+static char *key_append(char *key, size_t *key_size, char *arg) {
+  size_t arg_len = strlen(arg);
+  char *tmp = realloc(key, *key_size + arg_len + 2);
+  if (tmp == 0) {
+    free(key);
+    return 0;
+  }
+  memcpy(tmp + *key_size, arg, arg_len);
+  *key_size += arg_len;
+  tmp[*key_size] = KEY_DELIM;
+  ++*key_size;
+  tmp[*key_size] = '\0';
+  return tmp;
+}
+
+/* the entry for key or 0, the lock must be held */
+static struct ptn_cache_entry *ptn_cache_find(struct serve *serve, char *key) {
+  size_t i = 0;
+  while (i < serve->cache_size) {
+    if (strcmp(serve->cache[i].key, key) == 0) {
+      return &serve->cache[i];
+    }
+    ++i;
+  }
+  return 0;
+}
+
+/* adds groups as the entry for key, evicting the least recently used entry
+ * not in use if the cache is full. Returns 0 if every entry is in use, the
+ * lock must be held */
+static struct ptn_cache_entry *ptn_cache_add(struct serve *serve, char *key,
+                                             struct birch_ptn_groups *groups) {
+  struct ptn_cache_entry *entry = 0;
+  if (serve->cache_size < PTN_CACHE_SIZE) {
+    entry = &serve->cache[serve->cache_size];
+    ++serve->cache_size;
+  } else {
+    size_t i = 0;
+    while (i < serve->cache_size) {
+      struct ptn_cache_entry *e = &serve->cache[i];
+      if ((e->refs == 0) && ((entry == 0) || (e->used < entry->used))) {
+        entry = e;
+      }
+      ++i;
+    }
+    if (entry == 0) {
+      return 0;
+    }
+    free(entry->key);
+    birch_ptn_groups_free(&entry->groups);
+  }
+  entry->key = strdup(key);
+  if (entry->key == 0) {
+    --serve->cache_size;
+    if (entry != &serve->cache[serve->cache_size]) {
+      *entry = serve->cache[serve->cache_size];
+    }
+    return 0;
+  }
+  entry->groups = *groups;
+  entry->refs = 0;
+  return entry;
+}
+
+/* returns a cache entry holding a reference, or 0 if the patterns are invalid.
+ * A miss is compiled without the lock so other queries are not held up, if
+ * another query added the same patterns meanwhile its entry is used */
+static struct ptn_cache_entry *ptn_cache_get(struct serve *serve, char *key,
+                                             int argc, char *argv[]) {
+  pthread_mutex_lock(&serve->lock);
+  struct ptn_cache_entry *entry = ptn_cache_find(serve, key);
+  if (entry == 0) {
+    pthread_mutex_unlock(&serve->lock);
+    struct birch_ptn_groups groups;
+    if (birch_compile(&groups, argc, argv) != 0) {
+      return 0;
+    }
+    pthread_mutex_lock(&serve->lock);
+    entry = ptn_cache_find(serve, key);
+    if (entry != 0) {
+      birch_ptn_groups_free(&groups);
+    } else {
+      entry = ptn_cache_add(serve, key, &groups);
+      if (entry == 0) {
+        birch_ptn_groups_free(&groups);
+        pthread_mutex_unlock(&serve->lock);
+        return 0;
+      }
+    }
+  }
+  ++serve->clock;
+  ++entry->refs;
+  entry->used = serve->clock;
+  pthread_mutex_unlock(&serve->lock);
+  return entry;
+}
+
+static void ptn_cache_put(struct serve *serve, struct ptn_cache_entry *entry) {
+  pthread_mutex_lock(&serve->lock);
+  --entry->refs;
+  pthread_mutex_unlock(&serve->lock);
+}
+
+static void query_results_cb(struct birch_ptn_groups *results,
+                             size_t results_size, size_t index, void *usr) {
+  (void)results_size;
+  struct query *query = usr;
+  result_update_print(query->fp, query->format, results, index);
+}
+
+static void serve_tree_free(struct serve_tree *tree) {
+  dir_tree_free(tree->tree);
+  free(tree);
+}
+
+static struct serve_tree *serve_tree_get(struct serve *serve) {
+  pthread_mutex_lock(&serve->lock);
+  struct serve_tree *tree = serve->tree;
+  ++tree->refs;
+  pthread_mutex_unlock(&serve->lock);
+  return tree;
+}
+
+static void serve_tree_put(struct serve *serve, struct serve_tree *tree) {
+  pthread_mutex_lock(&serve->lock);
+  --tree->refs;
+  unsigned char replaced =
+      ((tree->refs == 0) && (tree != serve->tree)) ? 1 : 0;
+  pthread_mutex_unlock(&serve->lock);
+  if (replaced != 0) {
+    serve_tree_free(tree);
+  }
+}
+
+/* walks the roots again, queries already running finish on the old tree */
+static void serve_rewalk(struct serve *serve) {
+  struct serve_tree *tree = malloc(sizeof(*tree));
+  if (tree == 0) {
+    return;
+  }
+  if (dir_tree_multi(&tree->tree, serve->roots, serve->roots_size,
+                     serve->walk) != 0) {
+    printf("File tree walk failed, serving the previous walk\n");
+    fflush(stdout);
+    free(tree);
+    return;
+  }
+  tree->refs = 0;
+  pthread_mutex_lock(&serve->lock);
+  struct serve_tree *old = serve->tree;
+  serve->tree = tree;
+  unsigned char unused = (old->refs == 0) ? 1 : 0;
+  pthread_mutex_unlock(&serve->lock);
+  if (unused != 0) {
+    serve_tree_free(old);
+  }
+}
+
+/* 1 stops the walk once the results are done */
+static int query_file(struct dir_tree_file *file, void *usr) {
+  struct birch_scan *scan = usr;
+  int fd = open(file->path, O_RDONLY);
+  if (fd < 0) {
+    /* removed since the roots were walked */
+    return 0;
+  }
+  int rc = birch_fd(scan, file->path, fd);
+  close(fd);
+  return ((rc == 0) && (scan->results->done != 0)) ? 1 : rc;
+}
+
+static int query_search(struct serve *serve, struct query *query,
+                        struct birch_ptn_groups *groups) {
+  struct birch_results results;
+  if (birch_results_init(&results, groups, query->results_size) != 0) {
+    return -1;
+  }
+  if (query->stream != 0) {
+    results.cb = &query_results_cb;
+    results.usr = query;
+  }
+  struct birch_scan scan;
+  if (birch_scan_init(&scan, groups, &results) != 0) {
+    birch_results_free(&results);
+    return -1;
+  }
+  struct serve_tree *tree = serve_tree_get(serve);
+  int rc = birch_tree_each(tree->tree, &query_file, &scan);
+  serve_tree_put(serve, tree);
+  if (rc > 0) {
+    rc = 0;
+  }
+  if (rc == 0) {
+    results_print(query->fp, query->format, results.results, results.size);
+  }
+  birch_scan_free(&scan);
+  birch_results_free(&results);
+  return rc;
+}
+
+/* the query args are the client's: PATTERNS... [-r N] [--stream] [--ndjson] */
+static int query_run(struct serve *serve, FILE *fp, int argc, char *argv[]) {
+  struct query query = {.fp = fp,
+                        .format = PRINT_FORMAT_TEXT,
+                        .stream = 0,
+                        .results_size = 1};
+  char **ptn_args = malloc((argc + 1) * sizeof(*ptn_args));
+  if (ptn_args == 0) {
+    return -1;
+  }
+  int ptn_argc = 0;
+  char *key = 0;
+  size_t key_size = 0;
+  int rc = 0;
+  int i = 0;
+  while ((i < argc) && (rc == 0)) {
+    char *arg = argv[i];
+    if ((strcmp(arg, "-r") == 0) && ((i + 1) < argc)) {
+      ++i;
+      char *end;
+      long int results_size = strtol(argv[i], &end, 0);
+      /* each result holds a copy of the groups, the server is shared */
+      if ((end == argv[i]) || (*end != '\0') || (results_size < 1) ||
+          (results_size > QUERY_RESULTS_MAX)) {
+        fprintf(fp, "error: -r must be 1 to %d\n", QUERY_RESULTS_MAX);
+        rc = -1;
+      } else {
+        query.results_size = results_size;
+      }
+    } else if (strcmp(arg, "--stream") == 0) {
+      query.stream = 1;
+    } else if (strcmp(arg, "--ndjson") == 0) {
+      query.format = PRINT_FORMAT_NDJSON;
+    } else {
+      /* compiled only on a cache miss */
+      ptn_args[ptn_argc] = arg;
+      ++ptn_argc;
+      key = key_append(key, &key_size, arg);
+      if (key == 0) {
+        rc = -1;
+      }
+    }
+    ++i;
+  }
+
+  if (rc == 0) {
+    struct ptn_cache_entry *entry =
+        ptn_cache_get(serve, (key == 0) ? "" : key, ptn_argc, ptn_args);
+    if (entry == 0) {
+      fprintf(fp, "error: invalid patterns\n");
+      rc = -1;
+    } else {
+      rc = query_search(serve, &query, &entry->groups);
+      if (rc != 0) {
+        fprintf(fp, "error: search failed\n");
+      }
+      ptn_cache_put(serve, entry);
+    }
+  }
+  free(key);
+  free(ptn_args);
+  return rc;
+}
+
+/* splits the '\0' delimited query in place, returns the arg count */
+static int query_split(char *buf, size_t size, char **argv, int argv_size) {
+  int argc = 0;
+  size_t i = 0;
+  while ((i < size) && (buf[i] != '\0') && (argc < argv_size)) {
+    argv[argc] = &buf[i];
+    ++argc;
+    while ((i < size) && (buf[i] != '\0')) {
+      ++i;
+    }
+    ++i;
+  }
+  return argc;
+}
+
+/* wakes the accept loop, which may be waiting for a free connection */
+static void serve_conn_end(struct serve_conn *conn) {
+  struct serve *serve = conn->serve;
+  free(conn);
+  pthread_mutex_lock(&serve->lock);
+  --serve->conns;
+  pthread_mutex_unlock(&serve->lock);
+  char done = 0;
+  ssize_t rc = write(serve->done_fds[1], &done, sizeof(done));
+  (void)rc;
+}
+
+static void *serve_conn(void *arg) {
+  struct serve_conn *conn = arg;
+  char *buf = malloc(QUERY_SIZE_MAX);
+  FILE *fp = fdopen(conn->fd, "w");
+  if ((buf == 0) || (fp == 0)) {
+    free(buf);
+    close(conn->fd);
+    serve_conn_end(conn);
+    return 0;
+  }
+  /* read until the terminating empty arg */
+  size_t size = 0;
+  unsigned char timed_out = 0;
+  while (size < QUERY_SIZE_MAX) {
+    ssize_t rc = read(conn->fd, buf + size, QUERY_SIZE_MAX - size);
+    if (rc <= 0) {
+      timed_out = (rc < 0) ? 1 : 0;
+      break;
+    }
+    size += rc;
+    if ((size >= 2) && (buf[size - 1] == '\0') && (buf[size - 2] == '\0')) {
+      break;
+    }
+  }
+  int argv_size = size / 2 + 1;
+  char **argv = (timed_out == 0) ? malloc(argv_size * sizeof(*argv)) : 0;
+  if (argv != 0) {
+    int argc = query_split(buf, size, argv, argv_size);
+    query_run(conn->serve, fp, argc, argv);
+  }
+  free(argv);
+  free(buf);
+  fclose(fp);
+  serve_conn_end(conn);
+  return 0;
+}
+
+static void serve_conn_start(struct serve *serve, int conn_fd) {
+  /* a client that stops sending or reading does not hold its slot forever */
+  struct timeval timeout = {.tv_sec = SERVE_CONN_TIMEOUT_S, .tv_usec = 0};
+  setsockopt(conn_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(conn_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  struct serve_conn *conn = malloc(sizeof(*conn));
+  if (conn == 0) {
+    close(conn_fd);
+    return;
+  }
+  conn->serve = serve;
+  conn->fd = conn_fd;
+  pthread_mutex_lock(&serve->lock);
+  ++serve->conns;
+  pthread_mutex_unlock(&serve->lock);
+  pthread_t thread;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  if (pthread_create(&thread, &attr, &serve_conn, conn) != 0) {
+    close(conn_fd);
+    serve_conn_end(conn);
+  }
+  pthread_attr_destroy(&attr);
+}
+
+static void serve_drain(struct serve *serve) {
+  char buf[64];
+  while (read(serve->done_fds[0], buf, sizeof(buf)) > 0) {
+  }
+}
+
+static unsigned int serve_conns(struct serve *serve) {
+  pthread_mutex_lock(&serve->lock);
+  unsigned int conns = serve->conns;
+  pthread_mutex_unlock(&serve->lock);
+  return conns;
+}
+
+static int socket_addr(struct sockaddr_un *addr, char *path) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    printf("socket path too long: %s\n", path);
+    return -1;
+  }
+  strcpy(addr->sun_path, path);
+  return 0;
+}
+
+static long long int now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((long long int)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+static volatile sig_atomic_t serve_stop = 0;
+
+static void serve_signal(int sig) {
+  (void)sig;
+  serve_stop = 1;
+}
+
+/* accepts connections until SIGINT or SIGTERM, then waits for the queries
+ * running to finish */
+static int serve_listen(struct serve *serve, char *socket_path) {
+  struct sockaddr_un addr;
+  if (socket_addr(&addr, socket_path) != 0) {
+    return -1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  unlink(socket_path);
+  if ((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+      (listen(fd, SOMAXCONN) != 0)) {
+    printf("failed to listen on: %s\n", socket_path);
+    close(fd);
+    return -1;
+  }
+  printf("serving on: %s\n", socket_path);
+  fflush(stdout);
+
+  /* the signals are only taken in ppoll(), so none is missed between the
+   * check of serve_stop and the wait. Connection threads inherit the mask */
+  sigset_t stop_set;
+  sigset_t orig_set;
+  sigemptyset(&stop_set);
+  sigaddset(&stop_set, SIGINT);
+  sigaddset(&stop_set, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stop_set, &orig_set);
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = &serve_signal;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, 0);
+  sigaction(SIGTERM, &sa, 0);
+
+  long long int rewalk_ms = (long long int)serve->rewalk * 1000;
+  long long int next_walk = now_ms() + rewalk_ms;
+  int rc = 0;
+  while (serve_stop == 0) {
+    struct timespec timeout;
+    struct timespec *timeout_p = 0;
+    if (serve->rewalk != 0) {
+      long long int wait = next_walk - now_ms();
+      if (wait <= 0) {
+        serve_rewalk(serve);
+        next_walk = now_ms() + rewalk_ms;
+        wait = rewalk_ms;
+      }
+      timeout.tv_sec = wait / 1000;
+      timeout.tv_nsec = (wait % 1000) * 1000000;
+      timeout_p = &timeout;
+    }
+    /* at the limit, new connections wait in the backlog until one ends */
+    nfds_t nfds = (serve_conns(serve) < SERVE_CONNS_MAX) ? 2 : 1;
+    struct pollfd pfds[2] = {{.fd = serve->done_fds[0], .events = POLLIN},
+                             {.fd = fd, .events = POLLIN}};
+    int n = ppoll(pfds, nfds, timeout_p, &orig_set);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      rc = -1;
+      break;
+    }
+    if ((pfds[0].revents & POLLIN) != 0) {
+      serve_drain(serve);
+    }
+    if ((nfds < 2) || ((pfds[1].revents & POLLIN) == 0)) {
+      continue;
+    }
+    int conn_fd = accept4(fd, 0, 0, SOCK_CLOEXEC);
+    if (conn_fd < 0) {
+      if ((errno == EMFILE) || (errno == ENFILE) || (errno == ENOBUFS) ||
+          (errno == ENOMEM)) {
+        /* the connection stays queued, the listen socket would stay ready */
+        struct timespec backoff = {.tv_sec = 0,
+                                   .tv_nsec = SERVE_BACKOFF_MS * 1000000L};
+        nanosleep(&backoff, 0);
+      }
+      continue;
+    }
+    serve_conn_start(serve, conn_fd);
+  }
+  close(fd);
+  unlink(socket_path);
+  /* the queries running use the cache and the tree */
+  while (serve_conns(serve) != 0) {
+    struct pollfd pfd = {.fd = serve->done_fds[0], .events = POLLIN};
+    poll(&pfd, 1, -1);
+    serve_drain(serve);
+  }
+  pthread_sigmask(SIG_SETMASK, &orig_set, 0);
+  return rc;
+}
+
+int birch_serve(int argc, char *argv[]) {
+  char **roots = malloc(argc * sizeof(*roots));
+  if (roots == 0) {
+    return -1;
+  }
+  size_t roots_size = 0;
+  char *socket_path = 0;
+  struct serve serve;
+  serve.cache_size = 0;
+  serve.clock = 0;
+  serve.rewalk = 0;
+  serve.conns = 0;
+  struct dir_tree_opts walk;
+  dir_tree_opts_init(&walk);
+  int i = 1;
+  while (i < argc) {
+    char *arg = argv[i];
+    if ((strcmp(arg, "--socket") == 0) && ((i + 1) < argc)) {
+      ++i;
+      socket_path = argv[i];
+    } else if ((strcmp(arg, "--rewalk") == 0) && ((i + 1) < argc)) {
+      ++i;
+      char *end;
+      unsigned long int rewalk = strtoul(argv[i], &end, 0);
+      if ((end == argv[i]) || (*end != '\0') || (rewalk == 0) ||
+          (rewalk > UINT_MAX)) {
+        printf("invalid --rewalk, expected seconds: %s\n", argv[i]);
+        dir_tree_opts_free(&walk);
+        free(roots);
+        return -1;
+      }
+      serve.rewalk = rewalk;
+    } else if ((arg[0] == '-') && (strcmp(arg, DIR_TREE_STDIN) != 0)) {
+      int rc = dir_tree_opts_parse(&walk, argc, argv, &i);
+      if (rc != 0) {
+        if (rc > 0) {
+          printf("unrecognised arg: %s\n", arg);
+        }
+        dir_tree_opts_free(&walk);
+        free(roots);
+        return -1;
+      }
+    } else {
+      roots[roots_size] = arg;
+      ++roots_size;
+    }
+    ++i;
+  }
+  if ((socket_path == 0) || (roots_size == 0)) {
+    printf("usage: birch serve ROOTS... --socket PATH [--rewalk SECONDS]\n");
+    dir_tree_opts_free(&walk);
+    free(roots);
+    return -1;
+  }
+
+  i = 0;
+  while ((size_t)i < roots_size) {
+    /* a stream can only be read once, by the first query */
+    struct stat info;
+    if ((strcmp(roots[i], DIR_TREE_STDIN) == 0) ||
+        ((stat(roots[i], &info) == 0) && (S_ISDIR(info.st_mode) == 0) &&
+         (S_ISREG(info.st_mode) == 0))) {
+      printf("streams cannot be served: %s\n", roots[i]);
+      dir_tree_opts_free(&walk);
+      free(roots);
+      return -1;
+    }
+    ++i;
+  }
+  serve.roots = roots;
+  serve.roots_size = roots_size;
+  serve.walk = &walk;
+  serve.tree = malloc(sizeof(*serve.tree));
+  if ((serve.tree == 0) ||
+      (dir_tree_multi(&serve.tree->tree, roots, roots_size, &walk) != 0)) {
+    printf("File tree walk failed\n");
+    free(serve.tree);
+    dir_tree_opts_free(&walk);
+    free(roots);
+    return -1;
+  }
+  serve.tree->refs = 0;
+  if (pipe2(serve.done_fds, O_CLOEXEC | O_NONBLOCK) != 0) {
+    serve_tree_free(serve.tree);
+    dir_tree_opts_free(&walk);
+    free(roots);
+    return -1;
+  }
+  pthread_mutex_init(&serve.lock, 0);
+  /* clients that hang up must not kill the server */
+  signal(SIGPIPE, SIG_IGN);
+
+  int rc = serve_listen(&serve, socket_path);
+  close(serve.done_fds[0]);
+  close(serve.done_fds[1]);
+
+  pthread_mutex_destroy(&serve.lock);
+  i = 0;
+  while ((size_t)i < serve.cache_size) {
+    free(serve.cache[i].key);
+    birch_ptn_groups_free(&serve.cache[i].groups);
+    ++i;
+  }
+  serve_tree_free(serve.tree);
+  dir_tree_opts_free(&walk);
+  free(roots);
+  return rc;
+}
+
+static int write_all(int fd, char *buf, size_t size) {
+  while (size > 0) {
+    ssize_t rc = write(fd, buf, size);
+    if (rc <= 0) {
+      return -1;
+    }
+    buf += rc;
+    size -= rc;
+  }
+  return 0;
+}
+
+int birch_client(int argc, char *argv[]) {
+  char *socket_path = 0;
+  int i = 1;
+  while (i < argc) {
+    if ((strcmp(argv[i], "--socket") == 0) && ((i + 1) < argc)) {
+      socket_path = argv[i + 1];
+      break;
+    }
+    ++i;
+  }
+  struct sockaddr_un addr;
+  if ((socket_path == 0) || (socket_addr(&addr, socket_path) != 0)) {
+    printf("usage: birch client --socket PATH PATTERNS...\n");
+    return -1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    printf("failed to connect to: %s\n", socket_path);
+    close(fd);
+    return -1;
+  }
+
+  int rc = 0;
+  i = 1;
+  while ((i < argc) && (rc == 0)) {
+    if (strcmp(argv[i], "--socket") == 0) {
+      i += 2;
+      continue;
+    }
+    rc = write_all(fd, argv[i], strlen(argv[i]) + 1);
+    ++i;
+  }
+  char end = '\0';
+  if ((rc == 0) && (write_all(fd, &end, sizeof(end)) == 0)) {
+    shutdown(fd, SHUT_WR);
+    char buf[4096];
+    ssize_t size_read;
+    while ((size_read = read(fd, buf, sizeof(buf))) > 0) {
+      fwrite(buf, 1, size_read, stdout);
+      fflush(stdout);
+    }
+  } else {
+    rc = -1;
+  }
+  close(fd);
+  return rc;
+}
@@ -0,0 +1,27 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BIRCH_SERVE_H
+#define BIRCH_SERVE_H
+
+/* birch serve ROOTS... --socket PATH [--rewalk SECONDS] [OPTIONS...]
+ * walks the roots, again every SECONDS if given, and answers queries on a unix
+ * socket until SIGINT or SIGTERM */
+int birch_serve(int argc, char *argv[]);
+/* birch client --socket PATH PATTERNS... [OPTIONS...]
+ * sends one query to a server and prints the reply */
+int birch_client(int argc, char *argv[]);
+
+#endif
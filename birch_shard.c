@@ -0,0 +1,527 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "birch_shard.h"
+#include "bin_io.h"
+#include "birch_print.h"
+#include "birch_tree.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char DUMP_MAGIC[BIN_IO_MAGIC_SIZE] = "BIRCHDMP";
+static const unsigned int DUMP_VERSION = 2;
+
+enum dump_tag { DUMP_TAG_END, DUMP_TAG_FILE };
+
+void birch_shard_init(struct birch_shard *shard) {
+  shard->index = 0;
+  shard->size = 0;
+  shard->dump_path = 0;
+  shard->roots = 0;
+  shard->roots_size = 0;
+  shard->args = 0;
+  shard->args_size = 0;
+}
+
+void birch_shard_free(struct birch_shard *shard) {
+  bin_strs_free(shard->args, shard->args_size);
+  shard->args = 0;
+  shard->args_size = 0;
+}
+
+int birch_shard_parse(struct birch_shard *shard, char *str) {
+  char *end;
+  shard->index = strtoul(str, &end, 10);
+  if ((end == str) || (*end != '/')) {
+    printf("invalid shard, expected i/N: %s\n", str);
+    return -1;
+  }
+  char *size_str = end + 1;
+  shard->size = strtoul(size_str, &end, 10);
+  if ((end == size_str) || (*end != '\0') || (shard->size == 0) ||
+      (shard->index >= shard->size)) {
+    printf("invalid shard, expected i/N: %s\n", str);
+    return -1;
+  }
+  return 0;
+}
+
+void birch_shard_arg_cb(char *arg, void *usr) {
+  struct birch_shard *shard = usr;
+  char **tmp = realloc(shard->args, (shard->args_size + 1) * sizeof(*tmp));
+  char *copy = strdup(arg);
+  if ((tmp == 0) || (copy == 0)) {
+    exit(-1);
+  }
+  shard->args = tmp;
+  shard->args[shard->args_size] = copy;
+  ++shard->args_size;
+}
+
+/* the index of the root path was found under, and the path relative to it.
+ * Trailing slashes of roots are not part of the paths walked */
+size_t birch_path_root(char **roots, size_t roots_size, char *path,
+                       char **rel) {
+  size_t i = 0;
+  while (i < roots_size) {
+    size_t len = strlen(roots[i]);
+    while ((len >= 1) && (roots[i][len - 1] == '/')) {
+      --len;
+    }
+    if ((strncmp(path, roots[i], len) == 0) &&
+        ((path[len] == '/') || (path[len] == '\0'))) {
+      *rel = &path[len];
+      if (**rel == '/') {
+        ++*rel;
+      }
+      return i;
+    }
+    ++i;
+  }
+  *rel = path;
+  return 0;
+}
+
+/* FNV-1a */
+static unsigned long long int str_hash(const char *str) {
+  unsigned long long int hash = 0xcbf29ce484222325ull;
+  while (*str != '\0') {
+    hash ^= (unsigned char)*str;
+    hash *= 0x100000001b3ull;
+    ++str;
+  }
+  return hash;
+}
+
+unsigned char birch_shard_has(struct birch_shard *shard, char *path) {
+  if (shard->size == 0) {
+    return 1;
+  }
+  char *rel;
+  birch_path_root(shard->roots, shard->roots_size, path, &rel);
+  /* root files and streams by their root */
+  return ((str_hash((*rel == '\0') ? path : rel) % shard->size) ==
+          shard->index)
+             ? 1
+             : 0;
+}
+
+struct shard_search {
+  struct birch_shard *shard;
+  struct birch_scan *scan;
+  FILE *fp; /* the dump, may be 0 */
+  struct birch_hits hits;
+};
+
+static int dump_header(FILE *fp, struct birch_shard *shard,
+                       size_t results_size) {
+  int rc = bin_put_header(fp, DUMP_MAGIC, DUMP_VERSION);
+  rc |= bin_put_varint(fp, shard->index);
+  rc |= bin_put_varint(fp, shard->size);
+  rc |= bin_put_varint(fp, results_size);
+  rc |= bin_put_strs(fp, shard->roots, shard->roots_size);
+  rc |= bin_put_strs(fp, shard->args, shard->args_size);
+  return rc;
+}
+
+static int dump_file(struct shard_search *search, char *path) {
+  FILE *fp = search->fp;
+  struct birch_ptn_groups *groups = &search->scan->state;
+  char *rel;
+  size_t root = birch_path_root(search->shard->roots,
+                                search->shard->roots_size, path, &rel);
+  int rc = bin_put_varint(fp, DUMP_TAG_FILE);
+  rc |= bin_put_varint(fp, root);
+  rc |= bin_put_str(fp, path);
+  rc |= bin_put_varint(fp, search->hits.size);
+  size_t i = 0;
+  while (i < search->hits.size) {
+    struct birch_hit *hit = &search->hits.hits[i];
+    struct birch_ptn_group *group = &groups->groups[hit->group_index];
+    rc |= bin_put_varint(fp, hit->group_index);
+    rc |= bin_put_varint(fp, hit->match.ptn - group->ptns);
+    rc |= bin_put_varint(fp, hit->match.offs);
+    ++i;
+  }
+  return rc;
+}
+
+static int search_file(struct dir_tree_file *file, void *usr) {
+  struct shard_search *search = usr;
+  if (birch_shard_has(search->shard, file->path) == 0) {
+    return 0;
+  }
+  if (search->fp == 0) {
+    int rc = birch_file(search->scan, file->path);
+    return ((rc == 0) && (search->scan->results->done != 0)) ? 1 : rc;
+  }
+  /* record the hits for the dump, then apply them. Hits are stored by group
+   * and index of the ptn in the group */
+  search->hits.size = 0;
+  search->scan->hit_cb = &birch_hits_cb;
+  search->scan->hit_usr = &search->hits;
+  int rc = birch_file(search->scan, file->path);
+  search->scan->hit_cb = 0;
+  if ((rc != 0) || (search->hits.err != 0)) {
+    return -1;
+  }
+  birch_hits_replay(search->scan, &search->hits);
+  if (dump_file(search, file->path) != 0) {
+    printf("failed to write dump: %s\n", search->shard->dump_path);
+    return -1;
+  }
+  return 0;
+}
+
+int birch_shard_search(struct birch_shard *shard, struct birch_scan *scan,
+                       struct dir_tree *tree) {
+  struct shard_search search = {.shard = shard,
+                                .scan = scan,
+                                .fp = 0};
+  birch_hits_init(&search.hits);
+  if (shard->dump_path != 0) {
+    search.fp = fopen(shard->dump_path, "wb");
+    if (search.fp == 0) {
+      printf("failed to open dump: %s\n", shard->dump_path);
+      return -1;
+    }
+  }
+  int rc = 0;
+  if ((search.fp != 0) &&
+      (dump_header(search.fp, shard, scan->results->size) != 0)) {
+    rc = -1;
+  }
+  if (rc == 0) {
+    rc = birch_tree_each(tree, &search_file, &search);
+    /* stopped with the results done */
+    if (rc > 0) {
+      rc = 0;
+    }
+  }
+  if (search.fp != 0) {
+    /* no partial results, the merge needs every hit to be exact */
+    if ((rc == 0) && (bin_put_varint(search.fp, DUMP_TAG_END) != 0)) {
+      rc = -1;
+    }
+    if ((fclose(search.fp) != 0) && (rc == 0)) {
+      printf("failed to write dump: %s\n", shard->dump_path);
+      rc = -1;
+    }
+  }
+  birch_hits_free(&search.hits);
+  return rc;
+}
+
+struct merge_hit {
+  size_t group_index;
+  size_t ptn_index;
+  bit_size_t offs;
+};
+
+struct merge_file {
+  size_t root;
+  char *path;
+  char *rel;
+  struct merge_hit *hits;
+  size_t hits_size;
+};
+
+struct merge {
+  unsigned long int shards_size;
+  unsigned char *shards_seen;
+  size_t results_size;
+  char **roots;
+  size_t roots_size;
+  char **args;
+  size_t args_size;
+  struct merge_file *files;
+  size_t files_size;
+};
+
+static void merge_free(struct merge *merge) {
+  free(merge->shards_seen);
+  bin_strs_free(merge->roots, merge->roots_size);
+  bin_strs_free(merge->args, merge->args_size);
+  size_t i = 0;
+  while (i < merge->files_size) {
+    free(merge->files[i].path);
+    free(merge->files[i].hits);
+    ++i;
+  }
+  free(merge->files);
+}
+
+/* the first dump sets the roots and patterns, the others must agree */
+static int merge_header(struct merge *merge, FILE *fp, char *path) {
+  unsigned long long int index;
+  unsigned long long int shards_size;
+  size_t results_size;
+  char **roots = 0;
+  size_t roots_size = 0;
+  char **args = 0;
+  size_t args_size = 0;
+  if ((bin_get_header(fp, DUMP_MAGIC, DUMP_VERSION) != 0) ||
+      (bin_get_varint(fp, &index) != 0) ||
+      (bin_get_varint(fp, &shards_size) != 0) ||
+      (bin_get_size(fp, &results_size, (size_t)-1) != 0) ||
+      (bin_get_strs(fp, &roots, &roots_size) != 0) ||
+      (bin_get_strs(fp, &args, &args_size) != 0)) {
+    printf("invalid dump: %s\n", path);
+    bin_strs_free(roots, roots_size);
+    bin_strs_free(args, args_size);
+    return -1;
+  }
+  if (shards_size == 0) {
+    shards_size = 1;
+  }
+  if (merge->roots == 0) {
+    merge->shards_size = shards_size;
+    merge->shards_seen = calloc(shards_size, sizeof(*merge->shards_seen));
+    merge->results_size = results_size;
+    merge->roots = roots;
+    merge->roots_size = roots_size;
+    merge->args = args;
+    merge->args_size = args_size;
+    if (merge->shards_seen == 0) {
+      return -1;
+    }
+  } else {
+    unsigned char eq =
+        (shards_size == merge->shards_size) &&
+        (results_size == merge->results_size) &&
+        bin_strs_eq(roots, roots_size, merge->roots, merge->roots_size) &&
+        bin_strs_eq(args, args_size, merge->args, merge->args_size);
+    bin_strs_free(roots, roots_size);
+    bin_strs_free(args, args_size);
+    if (eq == 0) {
+      printf("dump of a different search: %s\n", path);
+      return -1;
+    }
+  }
+  if ((index >= merge->shards_size) || (merge->shards_seen[index] != 0)) {
+    printf("shard %llu repeated or out of range: %s\n", index, path);
+    return -1;
+  }
+  merge->shards_seen[index] = 1;
+  return 0;
+}
+
+static int merge_file_read(struct merge *merge, FILE *fp) {
+  struct merge_file *tmp = realloc(
+      merge->files, (merge->files_size + 1) * sizeof(*merge->files));
+  if (tmp == 0) {
+    return -1;
+  }
+  merge->files = tmp;
+  struct merge_file *file = &tmp[merge->files_size];
+  file->path = 0;
+  file->hits = 0;
+  file->hits_size = 0;
+  ++merge->files_size;
+  if ((bin_get_size(fp, &file->root, merge->roots_size + 1) != 0) ||
+      (bin_get_str(fp, &file->path) != 0) ||
+      (bin_get_size(fp, &file->hits_size, (size_t)-1 >> 5) != 0)) {
+    return -1;
+  }
+  birch_path_root(merge->roots, merge->roots_size, file->path, &file->rel);
+  file->hits = malloc((file->hits_size + 1) * sizeof(*file->hits));
+  if (file->hits == 0) {
+    return -1;
+  }
+  size_t i = 0;
+  while (i < file->hits_size) {
+    struct merge_hit *hit = &file->hits[i];
+    unsigned long long int offs;
+    if ((bin_get_size(fp, &hit->group_index, (size_t)-1) != 0) ||
+        (bin_get_size(fp, &hit->ptn_index, (size_t)-1) != 0) ||
+        (bin_get_varint(fp, &offs) != 0)) {
+      return -1;
+    }
+    hit->offs = offs;
+    ++i;
+  }
+  return 0;
+}
+
+static int merge_read(struct merge *merge, char *path,
+                      struct birch_ptn_groups *groups) {
+  FILE *fp = fopen(path, "rb");
+  if (fp == 0) {
+    printf("failed to open dump: %s\n", path);
+    return -1;
+  }
+  if (merge_header(merge, fp, path) != 0) {
+    fclose(fp);
+    return -1;
+  }
+  int rc = 0;
+  if ((groups->groups == 0) && (merge->args_size != 0)) {
+    rc = birch_compile(groups, merge->args_size, merge->args);
+    if (rc != 0) {
+      printf("%s: %s\n", path, birch_error());
+    }
+  }
+  while (rc == 0) {
+    unsigned long long int tag;
+    if (bin_get_varint(fp, &tag) != 0) {
+      rc = -1;
+    } else if (tag == DUMP_TAG_FILE) {
+      rc = merge_file_read(merge, fp);
+    } else if (tag == DUMP_TAG_END) {
+      break;
+    } else {
+      rc = -1;
+    }
+  }
+  if (rc != 0) {
+    printf("invalid dump: %s\n", path);
+  }
+  fclose(fp);
+  return rc;
+}
+
+int birch_search_order_cmp(size_t root_a, const char *rel_a, size_t root_b,
+                           const char *rel_b) {
+  unsigned char root_file_a = (*rel_a == '\0') ? 1 : 0;
+  unsigned char root_file_b = (*rel_b == '\0') ? 1 : 0;
+  if (root_file_a != root_file_b) {
+    return (root_file_a != 0) ? -1 : 1;
+  }
+  if (root_a != root_b) {
+    return (root_a < root_b) ? -1 : 1;
+  }
+  const char *pa = rel_a;
+  const char *pb = rel_b;
+  while (1) {
+    size_t la = strcspn(pa, "/");
+    size_t lb = strcspn(pb, "/");
+    unsigned char a_file = (pa[la] == '\0') ? 1 : 0;
+    unsigned char b_file = (pb[lb] == '\0') ? 1 : 0;
+    if ((la != lb) || (memcmp(pa, pb, la) != 0)) {
+      if (a_file != b_file) {
+        return (a_file != 0) ? -1 : 1;
+      }
+      int rc = memcmp(pa, pb, (la < lb) ? la : lb);
+      if (rc != 0) {
+        return rc;
+      }
+      return (la < lb) ? -1 : 1;
+    }
+    if ((a_file != 0) || (b_file != 0)) {
+      return (int)b_file - (int)a_file;
+    }
+    pa += la + 1;
+    pb += lb + 1;
+  }
+}
+
+static int merge_file_cmp(const void *a, const void *b) {
+  const struct merge_file *fa = a;
+  const struct merge_file *fb = b;
+  return birch_search_order_cmp(fa->root, fa->rel, fb->root, fb->rel);
+}
+
+static void merge_results_cb(struct birch_ptn_groups *results,
+                             size_t results_size, size_t index, void *usr) {
+  (void)results_size;
+  enum print_format *format = usr;
+  result_update_print(stdout, *format, results, index);
+}
+
+static int merge_replay(struct merge *merge, struct birch_ptn_groups *groups,
+                        unsigned char stream, enum print_format format) {
+  struct birch_results results;
+  if (birch_results_init(&results, groups, merge->results_size) != 0) {
+    return -1;
+  }
+  if (stream != 0) {
+    results.cb = &merge_results_cb;
+    results.usr = &format;
+  }
+  struct birch_scan scan;
+  if (birch_scan_init(&scan, groups, &results) != 0) {
+    birch_results_free(&results);
+    return -1;
+  }
+  qsort(merge->files, merge->files_size, sizeof(*merge->files),
+        &merge_file_cmp);
+  int rc = 0;
+  size_t i = 0;
+  while ((rc == 0) && (i < merge->files_size)) {
+    struct merge_file *file = &merge->files[i];
+    size_t j = 0;
+    while (j < file->hits_size) {
+      struct merge_hit *hit = &file->hits[j];
+      if ((hit->group_index >= groups->size) ||
+          (hit->ptn_index >= groups->groups[hit->group_index].size)) {
+        printf("invalid hit in %s\n", file->path);
+        rc = -1;
+        break;
+      }
+      struct birch_match match = {
+          .ptn = &groups->groups[hit->group_index].ptns[hit->ptn_index],
+          .path = file->path,
+          .offs = hit->offs};
+      birch_scan_match(&scan, hit->group_index, &match);
+      ++j;
+    }
+    ++i;
+  }
+  if (rc == 0) {
+    results_print(stdout, format, results.results, results.size);
+  }
+  birch_scan_free(&scan);
+  birch_results_free(&results);
+  return rc;
+}
+
+int birch_merge(int argc, char *argv[]) {
+  struct merge merge = {0};
+  struct birch_ptn_groups groups;
+  birch_ptn_groups_init(&groups);
+  unsigned char stream = 0;
+  enum print_format format = PRINT_FORMAT_TEXT;
+  int rc = 0;
+  int i = 1;
+  while ((rc == 0) && (i < argc)) {
+    if (strcmp(argv[i], "--stream") == 0) {
+      stream = 1;
+    } else if (strcmp(argv[i], "--ndjson") == 0) {
+      format = PRINT_FORMAT_NDJSON;
+    } else {
+      rc = merge_read(&merge, argv[i], &groups);
+    }
+    ++i;
+  }
+  if ((rc == 0) && (merge.roots == 0)) {
+    printf("birch merge DUMPS... [--stream] [--ndjson]\n");
+    rc = -1;
+  }
+  unsigned long int j = 0;
+  while ((rc == 0) && (j < merge.shards_size)) {
+    if (merge.shards_seen[j] == 0) {
+      printf("missing shard %lu/%lu\n", j, merge.shards_size);
+      rc = -1;
+    }
+    ++j;
+  }
+  if (rc == 0) {
+    rc = merge_replay(&merge, &groups, stream, format);
+  }
+  birch_ptn_groups_free(&groups);
+  merge_free(&merge);
+  return rc;
+}
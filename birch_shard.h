@@ -0,0 +1,60 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BIRCH_SHARD_H
+#define BIRCH_SHARD_H
+
+#include "birch.h"
+#include "dir_tree.h"
+
+/* a search split over processes, each scanning the files whose root relative
+ * path hashes to its index. The dumps of all the shards can be merged into the
+ * output of a single search */
+struct birch_shard {
+  unsigned long int index;
+  unsigned long int size; /* number of shards, 0 if not sharded */
+  char *dump_path;        /* may be 0 */
+  /* recorded in the dump, the merge needs the same roots and patterns */
+  char **roots;
+  size_t roots_size;
+  char **args;
+  size_t args_size;
+};
+
+void birch_shard_init(struct birch_shard *shard);
+void birch_shard_free(struct birch_shard *shard);
+/* parses "i/N" */
+int birch_shard_parse(struct birch_shard *shard, char *str);
+/* a birch_arg_cb recording the pattern args, usr is the struct birch_shard */
+void birch_shard_arg_cb(char *arg, void *usr);
+/* the index of the first root path is below, *rel is set to the part of path
+ * below it, "" for the root itself */
+size_t birch_path_root(char **roots, size_t roots_size, char *path,
+                       char **rel);
+/* orders files by their birch_path_root() as the search visits them: root
+ * files, then each root in turn. Within a directory files before
+ * subdirectories, each in alphasort order */
+int birch_search_order_cmp(size_t root_a, const char *rel_a, size_t root_b,
+                           const char *rel_b);
+/* 1 if the file at path is in the shard, always 1 if not sharded */
+unsigned char birch_shard_has(struct birch_shard *shard, char *path);
+/* as birch_tree_search() for the files of the shard, writing the dump if
+ * dump_path is set */
+int birch_shard_search(struct birch_shard *shard, struct birch_scan *scan,
+                       struct dir_tree *tree);
+/* birch merge DUMPS... [--stream] [--ndjson] */
+int birch_merge(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,70 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "birch_tree.h"
+
+unsigned char birch_tree_is_file(struct dir_tree *el) {
+  return ((el->contents == 0) && (el->size == 1)) ? 1 : 0;
+}
+
+static int dir_tree_each_file(struct dir_tree *el, birch_tree_file_cb file_cb,
+                              void *usr) {
+  return (birch_tree_is_file(el) != 0)
+             ? file_cb((struct dir_tree_file *)el, usr)
+             : 0;
+}
+
+static int dir_tree_each_dir(struct dir_tree *el, birch_tree_file_cb file_cb,
+                             void *usr) {
+  int rc = 0;
+  if (el->contents != 0) {
+    /* is dir */
+    size_t i = 0;
+    while (i < el->size) {
+      rc = dir_tree_each_file(el->contents[i], file_cb, usr);
+      if (rc != 0) {
+        return rc;
+      }
+      ++i;
+    }
+
+    i = 0;
+    while (i < el->size) {
+      rc = dir_tree_each_dir(el->contents[i], file_cb, usr);
+      if (rc != 0) {
+        return rc;
+      }
+      ++i;
+    }
+  }
+  return rc;
+}
+
+int birch_tree_each(struct dir_tree *tree, birch_tree_file_cb file_cb,
+                    void *usr) {
+  return dir_tree_each_dir(tree, file_cb, usr);
+}
+
+/* 1 stops the walk once the results are done */
+static int search_file(struct dir_tree_file *file, void *usr) {
+  struct birch_scan *scan = usr;
+  int rc = birch_file(scan, file->path);
+  return ((rc == 0) && (scan->results->done != 0)) ? 1 : rc;
+}
+
+int birch_tree_search(struct birch_scan *scan, struct dir_tree *tree) {
+  int rc = birch_tree_each(tree, &search_file, scan);
+  return (rc > 0) ? 0 : rc;
+}
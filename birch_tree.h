@@ -0,0 +1,35 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BIRCH_TREE_H
+#define BIRCH_TREE_H
+
+#include "birch.h"
+#include "dir_tree.h"
+
+typedef int (*birch_tree_file_cb)(struct dir_tree_file *file, void *usr);
+
+/* returns 1 if el is a file, which may then be cast to struct dir_tree_file */
+unsigned char birch_tree_is_file(struct dir_tree *el);
+
+/* calls file_cb for each file in search order, stops at the first non 0 return
+ */
+int birch_tree_each(struct dir_tree *tree, birch_tree_file_cb file_cb,
+                    void *usr);
+/* searches every file in the tree, in each directory files are searched
+ * before subdirectories. Stops early once the results are done */
+int birch_tree_search(struct birch_scan *scan, struct dir_tree *tree);
+
+#endif
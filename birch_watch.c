@@ -0,0 +1,902 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define _GNU_SOURCE
+
+#include "birch_watch.h"
+
+#include "birch_shard.h"
+#include "birch_tree.h"
+
+#include <limits.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* wait for this long without events before updating */
+#define WATCH_SETTLE_MS (200)
+#define WATCH_TABLE_INIT_CAP (256)
+/* but update at most this long after the first event, e.g. for a log that is
+ * appended to more often than WATCH_SETTLE_MS */
+#define WATCH_MAX_WAIT_MS (2000)
+/* a walk that failed is tried again after this long without events */
+#define WATCH_RETRY_MS (1000)
+/* more events than this between updates walk the roots again */
+#define WATCH_EVENTS_MAX (4096)
+/* the replay is saved every this many hits, a change replays the hits from the
+ * last save before it */
+#define WATCH_SNAP_HITS (65536)
+/* no change since the results were last printed */
+#define WATCH_UNCHANGED SIZE_MAX
+
+static const uint32_t WATCH_MASK =
+    IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_FROM |
+    IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF;
+
+/* a file and the hits found in it when it was last scanned */
+struct watch_file {
+  char *path;
+  size_t root; /* birch_path_root() of path */
+  char *rel;   /* in path */
+  struct stat info;
+  struct birch_hits hits;
+  unsigned char scanned; /* hits are up to date with info */
+  unsigned char seen;    /* found by the current walk */
+  struct watch_file *next;
+};
+
+/* a watched directory, indexed by watch descriptor */
+struct watch_dir {
+  char *path;         /* 0 if not watched */
+  unsigned char seen; /* found by the current walk */
+};
+
+/* a file or directory to bring up to date */
+struct watch_event {
+  char *path;
+  unsigned char is_dir;
+};
+
+/* the replay state after the hits of the first index files in order */
+struct watch_snap {
+  size_t index;
+  struct birch_match *matches; /* of the state then each result, per group */
+  unsigned long int *dists;
+};
+
+struct watch {
+  struct birch_ptn_groups *groups;
+  struct birch_scan scan; /* records hits */
+  struct birch_results scan_results;
+  struct watch_file **table; /* chained by path */
+  size_t table_cap;          /* power of 2 */
+  size_t size;
+  struct watch_file **order; /* files in search order */
+  size_t order_size;
+  size_t order_cap;
+  char **roots;
+  size_t roots_size;
+  struct dir_tree_opts *walk;
+  int inotify_fd;
+  struct watch_dir *dirs;
+  size_t dirs_size;
+  struct watch_event *events; /* since the last update, in arrival order */
+  size_t events_size;
+  /* the events cannot be followed file by file, the roots are walked again */
+  unsigned char full;
+  unsigned char walk_only; /* every update walks the roots */
+  unsigned char err;       /* set if a directory could not be recorded */
+  size_t changed; /* the first index of order changed since the last print */
+  struct birch_scan replay;
+  struct birch_results results;
+  struct watch_snap *snaps; /* by index, the first is before any file */
+  size_t snaps_size;
+  char *printed; /* the results printed last */
+};
+
+static size_t path_hash(char *path) {
+  /* FNV-1a */
+  size_t h = 14695981039346656037ull;
+  while (*path != '\0') {
+    h ^= (unsigned char)*path;
+    h *= 1099511628211ull;
+    ++path;
+  }
+  return h;
+}
+
+static int watch_table_grow(struct watch *watch) {
+  size_t new_cap =
+      (watch->table_cap == 0) ? WATCH_TABLE_INIT_CAP : watch->table_cap << 1;
+  struct watch_file **table = calloc(new_cap, sizeof(*table));
+  if (table == 0) {
+    return -1;
+  }
+  size_t i = 0;
+  while (i < watch->table_cap) {
+    struct watch_file *file = watch->table[i];
+    while (file != 0) {
+      struct watch_file *next = file->next;
+      size_t slot = path_hash(file->path) & (new_cap - 1);
+      file->next = table[slot];
+      table[slot] = file;
+      file = next;
+    }
+    ++i;
+  }
+  free(watch->table);
+  watch->table = table;
+  watch->table_cap = new_cap;
+  return 0;
+}
+
+static struct watch_file *watch_file_find(struct watch *watch, char *path) {
+  if (watch->table_cap == 0) {
+    return 0;
+  }
+  struct watch_file *file =
+      watch->table[path_hash(path) & (watch->table_cap - 1)];
+  while ((file != 0) && (strcmp(file->path, path) != 0)) {
+    file = file->next;
+  }
+  return file;
+}
+
+static struct watch_file *watch_file_get(struct watch *watch, char *path) {
+  struct watch_file *file = watch_file_find(watch, path);
+  if (file != 0) {
+    return file;
+  }
+  if (((watch->size + 1) << 1) > watch->table_cap) {
+    if (watch_table_grow(watch) != 0) {
+      return 0;
+    }
+  }
+  file = calloc(1, sizeof(*file));
+  if (file == 0) {
+    return 0;
+  }
+  file->path = strdup(path);
+  if (file->path == 0) {
+    free(file);
+    return 0;
+  }
+  file->root =
+      birch_path_root(watch->roots, watch->roots_size, file->path, &file->rel);
+  birch_hits_init(&file->hits);
+  size_t slot = path_hash(path) & (watch->table_cap - 1);
+  file->next = watch->table[slot];
+  watch->table[slot] = file;
+  ++watch->size;
+  return file;
+}
+
+static void watch_file_free(struct watch_file *file) {
+  birch_hits_free(&file->hits);
+  free(file->path);
+  free(file);
+}
+
+static void watch_file_remove(struct watch *watch, struct watch_file *file) {
+  struct watch_file **link =
+      &watch->table[path_hash(file->path) & (watch->table_cap - 1)];
+  while (*link != file) {
+    link = &(*link)->next;
+  }
+  *link = file->next;
+  --watch->size;
+  watch_file_free(file);
+}
+
+/* removes files not seen this round and clears seen for the next */
+static void watch_files_sweep(struct watch *watch) {
+  size_t i = 0;
+  while (i < watch->table_cap) {
+    struct watch_file **link = &watch->table[i];
+    while (*link != 0) {
+      struct watch_file *file = *link;
+      if (file->seen == 0) {
+        *link = file->next;
+        watch_file_free(file);
+        --watch->size;
+      } else {
+        file->seen = 0;
+        link = &file->next;
+      }
+    }
+    ++i;
+  }
+}
+
+static int watch_order_reserve(struct watch *watch, size_t size) {
+  if (size <= watch->order_cap) {
+    return 0;
+  }
+  size_t cap =
+      (watch->order_cap == 0) ? WATCH_TABLE_INIT_CAP : watch->order_cap;
+  while (cap < size) {
+    cap <<= 1;
+  }
+  struct watch_file **tmp = realloc(watch->order, cap * sizeof(*tmp));
+  if (tmp == 0) {
+    return -1;
+  }
+  watch->order = tmp;
+  watch->order_cap = cap;
+  return 0;
+}
+
+/* the index of file in order, or where it goes if it is not there */
+static size_t watch_order_find(struct watch *watch, struct watch_file *file) {
+  size_t lo = 0;
+  size_t hi = watch->order_size;
+  while (lo < hi) {
+    size_t mid = lo + ((hi - lo) >> 1);
+    struct watch_file *other = watch->order[mid];
+    if (birch_search_order_cmp(other->root, other->rel, file->root,
+                               file->rel) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static void watch_snap_free(struct watch_snap *snap) {
+  free(snap->matches);
+  free(snap->dists);
+}
+
+/* the replay state, then each result */
+static struct birch_ptn_groups *watch_set(struct watch *watch, size_t i) {
+  return (i == 0) ? &watch->replay.state : &watch->results.results[i - 1];
+}
+
+static int watch_snap_add(struct watch *watch, size_t index) {
+  size_t sets_size = watch->results.size + 1;
+  size_t groups_size = watch->groups->size;
+  struct watch_snap *tmp =
+      realloc(watch->snaps, (watch->snaps_size + 1) * sizeof(*tmp));
+  if (tmp == 0) {
+    return -1;
+  }
+  watch->snaps = tmp;
+  struct watch_snap *snap = &watch->snaps[watch->snaps_size];
+  snap->index = index;
+  snap->matches = malloc(sets_size * groups_size * sizeof(*snap->matches));
+  snap->dists =
+      malloc(sets_size * BIRCH_MATCH_DIST_SIZE * sizeof(*snap->dists));
+  if ((snap->matches == 0) || (snap->dists == 0)) {
+    watch_snap_free(snap);
+    return -1;
+  }
+  size_t i = 0;
+  while (i < sets_size) {
+    struct birch_ptn_groups *set = watch_set(watch, i);
+    memcpy(&snap->dists[i * BIRCH_MATCH_DIST_SIZE], set->match_dist,
+           sizeof(set->match_dist));
+    size_t k = 0;
+    while (k < groups_size) {
+      snap->matches[(i * groups_size) + k] = set->groups[k].match;
+      ++k;
+    }
+    ++i;
+  }
+  ++watch->snaps_size;
+  return 0;
+}
+
+static void watch_snap_restore(struct watch *watch, struct watch_snap *snap) {
+  size_t sets_size = watch->results.size + 1;
+  size_t groups_size = watch->groups->size;
+  size_t i = 0;
+  while (i < sets_size) {
+    struct birch_ptn_groups *set = watch_set(watch, i);
+    memcpy(set->match_dist, &snap->dists[i * BIRCH_MATCH_DIST_SIZE],
+           sizeof(set->match_dist));
+    size_t k = 0;
+    while (k < groups_size) {
+      set->groups[k].match = snap->matches[(i * groups_size) + k];
+      ++k;
+    }
+    ++i;
+  }
+}
+
+/* order is about to change at index. The snapshots after it are dropped
+ * before any file they point into is freed */
+static void watch_changed(struct watch *watch, size_t index) {
+  if (index < watch->changed) {
+    watch->changed = index;
+  }
+  while (watch->snaps[watch->snaps_size - 1].index > index) {
+    --watch->snaps_size;
+    watch_snap_free(&watch->snaps[watch->snaps_size]);
+  }
+}
+
+static unsigned char stat_changed(struct stat *a, struct stat *b) {
+  return ((a->st_dev != b->st_dev) || (a->st_ino != b->st_ino) ||
+          (a->st_size != b->st_size) ||
+          (a->st_mtim.tv_sec != b->st_mtim.tv_sec) ||
+          (a->st_mtim.tv_nsec != b->st_mtim.tv_nsec) ||
+          (a->st_ctim.tv_sec != b->st_ctim.tv_sec) ||
+          (a->st_ctim.tv_nsec != b->st_ctim.tv_nsec))
+             ? 1
+             : 0;
+}
+
+static void watch_file_scan(struct watch *watch, struct watch_file *file,
+                            struct stat *info) {
+  file->hits.size = 0;
+  file->hits.err = 0;
+  file->info = *info;
+  watch->scan.hit_usr = &file->hits;
+  file->scanned =
+      ((birch_file(&watch->scan, file->path) == 0) && (file->hits.err == 0))
+          ? 1
+          : 0;
+  if (file->scanned == 0) {
+    /* tried again when it next changes */
+    birch_hits_free(&file->hits);
+  }
+}
+
+/* 1 if path is dir or below it */
+static unsigned char path_below(char *path, char *dir, size_t dir_len) {
+  return ((strncmp(path, dir, dir_len) == 0) &&
+          ((path[dir_len] == '/') || (path[dir_len] == '\0')))
+             ? 1
+             : 0;
+}
+
+/* stops watching the directories not seen, of those at or below dir if it is
+ * not 0, and clears seen for the next walk */
+static void watch_dirs_sweep(struct watch *watch, char *dir) {
+  size_t dir_len = (dir != 0) ? strlen(dir) : 0;
+  size_t i = 0;
+  while (i < watch->dirs_size) {
+    struct watch_dir *wd = &watch->dirs[i];
+    if ((wd->path != 0) && (wd->seen == 0) &&
+        ((dir == 0) || (path_below(wd->path, dir, dir_len) != 0))) {
+      inotify_rm_watch(watch->inotify_fd, (int)i);
+      free(wd->path);
+      wd->path = 0;
+    }
+    wd->seen = 0;
+    ++i;
+  }
+}
+
+static void watch_dir_cb(char *path, void *usr) {
+  struct watch *watch = usr;
+  /* adding a watch again just returns the existing one */
+  int wd = inotify_add_watch(watch->inotify_fd, path, WATCH_MASK);
+  if (wd < 0) {
+    return;
+  }
+  if ((size_t)wd >= watch->dirs_size) {
+    size_t size = (watch->dirs_size == 0) ? WATCH_TABLE_INIT_CAP
+                                          : watch->dirs_size;
+    while (size <= (size_t)wd) {
+      size <<= 1;
+    }
+    struct watch_dir *tmp = realloc(watch->dirs, size * sizeof(*tmp));
+    if (tmp == 0) {
+      watch->err = 1;
+      return;
+    }
+    memset(&tmp[watch->dirs_size], 0,
+           (size - watch->dirs_size) * sizeof(*tmp));
+    watch->dirs = tmp;
+    watch->dirs_size = size;
+  }
+  struct watch_dir *dir = &watch->dirs[wd];
+  if ((dir->path == 0) || (strcmp(dir->path, path) != 0)) {
+    char *copy = strdup(path);
+    if (copy == 0) {
+      watch->err = 1;
+      return;
+    }
+    free(dir->path);
+    dir->path = copy;
+  }
+  dir->seen = 1;
+}
+
+static int watch_file_cb(struct dir_tree_file *el, void *usr) {
+  struct watch *watch = usr;
+  struct stat info;
+  if (stat(el->path, &info) != 0) {
+    /* removed since the walk */
+    return 0;
+  }
+  struct watch_file *file = watch_file_get(watch, el->path);
+  if (file == 0) {
+    return -1;
+  }
+  if ((file->scanned == 0) || (stat_changed(&file->info, &info) != 0)) {
+    /* new or modified, the only files read again */
+    watch_file_scan(watch, file, &info);
+  }
+  file->seen = 1;
+  watch->order[watch->order_size] = file;
+  ++watch->order_size;
+  return 0;
+}
+
+static int count_file_cb(struct dir_tree_file *el, void *usr) {
+  (void)el;
+  ++*(size_t *)usr;
+  return 0;
+}
+
+/* walks the roots again, reading only new or modified files. Returns 1 if
+ * the walk failed, e.g. for a file removed during it, leaving full set */
+static int watch_round(struct watch *watch) {
+  watch->full = 0;
+  watch_changed(watch, 0);
+  struct dir_tree *tree;
+  if (dir_tree_multi(&tree, watch->roots, watch->roots_size, watch->walk) !=
+      0) {
+    watch->full = 1;
+    return 1;
+  }
+  size_t i = 0;
+  while (i < watch->roots_size) {
+    /* roots that are files are not covered by the directory watches */
+    inotify_add_watch(watch->inotify_fd, watch->roots[i], WATCH_MASK);
+    ++i;
+  }
+  size_t files_size = 0;
+  birch_tree_each(tree, &count_file_cb, &files_size);
+  watch->order_size = 0;
+  int rc = -1;
+  if ((watch_order_reserve(watch, files_size) == 0) &&
+      (birch_tree_each(tree, &watch_file_cb, watch) == 0) &&
+      (watch->err == 0)) {
+    watch_files_sweep(watch);
+    watch_dirs_sweep(watch, 0);
+    rc = 0;
+  }
+  dir_tree_free(tree);
+  return rc;
+}
+
+/* brings the file at path up to date with an event about it, setting full if
+ * only a walk can */
+static int watch_file_sync(struct watch *watch, char *path) {
+  struct stat info;
+  char *name = strrchr(path, '/') + 1;
+  unsigned char present =
+      ((lstat(path, &info) == 0) && S_ISREG(info.st_mode) &&
+       (dir_tree_pruned(watch->walk, name, &info) == 0))
+          ? 1
+          : 0;
+  struct watch_file *file = watch_file_find(watch, path);
+  /* the walk searches a hardlinked file under the first of its names */
+  if (((present != 0) && (info.st_nlink > 1)) ||
+      ((file != 0) && (file->info.st_nlink > 1))) {
+    watch->full = 1;
+    return 0;
+  }
+  size_t index;
+  if (present == 0) {
+    if (file != 0) {
+      index = watch_order_find(watch, file);
+      watch_changed(watch, index);
+      memmove(&watch->order[index], &watch->order[index + 1],
+              (watch->order_size - index - 1) * sizeof(*watch->order));
+      --watch->order_size;
+      watch_file_remove(watch, file);
+    }
+    return 0;
+  }
+  if (file != 0) {
+    if ((file->scanned != 0) && (stat_changed(&file->info, &info) == 0)) {
+      return 0;
+    }
+    watch_changed(watch, watch_order_find(watch, file));
+  } else {
+    if (watch_order_reserve(watch, watch->order_size + 1) != 0) {
+      return -1;
+    }
+    file = watch_file_get(watch, path);
+    if (file == 0) {
+      return -1;
+    }
+    index = watch_order_find(watch, file);
+    watch_changed(watch, index);
+    memmove(&watch->order[index + 1], &watch->order[index],
+            (watch->order_size - index) * sizeof(*watch->order));
+    watch->order[index] = file;
+    ++watch->order_size;
+  }
+  watch_file_scan(watch, file, &info);
+  return 0;
+}
+
+static int watch_dir_file_cb(struct dir_tree_file *el, void *usr) {
+  struct watch *watch = usr;
+  int rc = watch_file_sync(watch, el->path);
+  if (rc != 0) {
+    return rc;
+  }
+  struct watch_file *file = watch_file_find(watch, el->path);
+  if (file != 0) {
+    file->seen = 1;
+  }
+  /* 1 stops the walk, the roots are walked instead */
+  return (watch->full != 0) ? 1 : 0;
+}
+
+/* brings the directory at path and everything below it up to date with an
+ * event about it, setting full if only a walk of the roots can */
+static int watch_dir_sync(struct watch *watch, char *path) {
+  struct stat info;
+  char *name = strrchr(path, '/') + 1;
+  if ((lstat(path, &info) == 0) && S_ISDIR(info.st_mode) &&
+      (dir_tree_pruned(watch->walk, name, &info) == 0)) {
+    struct dir_tree *tree;
+    if (dir_tree(&tree, path, watch->walk) != 0) {
+      /* e.g. removed during the walk */
+      watch->full = 1;
+    } else {
+      int rc = birch_tree_each(tree, &watch_dir_file_cb, watch);
+      dir_tree_free(tree);
+      if (rc < 0) {
+        return -1;
+      }
+    }
+  }
+  if (watch->err != 0) {
+    return -1;
+  }
+  /* withdraw the files below path the walk did not find */
+  size_t path_len = strlen(path);
+  size_t kept = 0;
+  size_t i = 0;
+  while (i < watch->order_size) {
+    struct watch_file *file = watch->order[i];
+    if ((file->seen == 0) &&
+        (path_below(file->path, path, path_len) != 0)) {
+      if (file->info.st_nlink > 1) {
+        watch->full = 1;
+      }
+      watch_changed(watch, kept);
+      watch_file_remove(watch, file);
+    } else {
+      file->seen = 0;
+      watch->order[kept] = file;
+      ++kept;
+    }
+    ++i;
+  }
+  watch->order_size = kept;
+  watch_dirs_sweep(watch, path);
+  return 0;
+}
+
+static void watch_events_clear(struct watch *watch) {
+  size_t i = 0;
+  while (i < watch->events_size) {
+    free(watch->events[i].path);
+    ++i;
+  }
+  watch->events_size = 0;
+}
+
+static unsigned char watch_is_root(struct watch *watch, char *path) {
+  char *rel;
+  birch_path_root(watch->roots, watch->roots_size, path, &rel);
+  return (*rel == '\0') ? 1 : 0;
+}
+
+static int watch_event_add(struct watch *watch, struct inotify_event *ev) {
+  if ((ev->mask & IN_Q_OVERFLOW) != 0) {
+    watch->full = 1;
+    return 0;
+  }
+  struct watch_dir *dir = 0;
+  if ((ev->wd >= 0) && ((size_t)ev->wd < watch->dirs_size) &&
+      (watch->dirs[ev->wd].path != 0)) {
+    dir = &watch->dirs[ev->wd];
+  }
+  if ((ev->mask & IN_IGNORED) != 0) {
+    if (dir != 0) {
+      free(dir->path);
+      dir->path = 0;
+    }
+    return 0;
+  }
+  if (ev->len == 0) {
+    /* about a watched directory itself, which its parent also reports unless
+     * it is a root. Roots that are files are watched alone */
+    if ((dir == 0) || (watch_is_root(watch, dir->path) != 0)) {
+      watch->full = 1;
+    }
+    return 0;
+  }
+  if ((dir == 0) || (watch->full != 0)) {
+    /* no longer watched, or a walk follows anyway */
+    return 0;
+  }
+  size_t dir_len = strlen(dir->path);
+  size_t name_len = strlen(ev->name) + 1;
+  char *path = malloc(dir_len + 1 + name_len);
+  if (path == 0) {
+    return -1;
+  }
+  memcpy(path, dir->path, dir_len);
+  path[dir_len] = '/';
+  memcpy(&path[dir_len + 1], ev->name, name_len);
+  unsigned char is_dir = ((ev->mask & IN_ISDIR) != 0) ? 1 : 0;
+  if (watch->events_size != 0) {
+    struct watch_event *last = &watch->events[watch->events_size - 1];
+    if ((last->is_dir == is_dir) && (strcmp(last->path, path) == 0)) {
+      /* e.g. the writes to a file */
+      free(path);
+      return 0;
+    }
+  }
+  if (watch->events_size == WATCH_EVENTS_MAX) {
+    free(path);
+    watch_events_clear(watch);
+    watch->full = 1;
+    return 0;
+  }
+  watch->events[watch->events_size].path = path;
+  watch->events[watch->events_size].is_dir = is_dir;
+  ++watch->events_size;
+  return 0;
+}
+
+/* brings the files up to date with the events, or a walk of the roots if the
+ * events cannot be followed */
+static int watch_update(struct watch *watch) {
+  if (watch->walk_only != 0) {
+    watch->full = 1;
+  }
+  int rc = 0;
+  size_t i = 0;
+  while ((rc == 0) && (watch->full == 0) && (i < watch->events_size)) {
+    struct watch_event *event = &watch->events[i];
+    rc = (event->is_dir != 0) ? watch_dir_sync(watch, event->path)
+                              : watch_file_sync(watch, event->path);
+    ++i;
+  }
+  watch_events_clear(watch);
+  if ((rc == 0) && (watch->full != 0)) {
+    /* a failed walk is tried again at the next wakeup */
+    rc = (watch_round(watch) < 0) ? -1 : 0;
+  }
+  return rc;
+}
+
+/* replays the files' hits in search order, as a full search would see them,
+ * from the last snapshot before the first change */
+static int watch_results_print(struct watch *watch, enum print_format format) {
+  if (watch->changed == WATCH_UNCHANGED) {
+    return 0;
+  }
+  struct watch_snap *snap = &watch->snaps[watch->snaps_size - 1];
+  watch_snap_restore(watch, snap);
+  size_t hits = 0;
+  size_t i = snap->index;
+  while (i < watch->order_size) {
+    if (hits >= WATCH_SNAP_HITS) {
+      /* without it later changes replay from an earlier one */
+      watch_snap_add(watch, i);
+      hits = 0;
+    }
+    birch_hits_replay(&watch->replay, &watch->order[i]->hits);
+    hits += watch->order[i]->hits.size;
+    ++i;
+  }
+  watch->changed = WATCH_UNCHANGED;
+
+  char *printed = 0;
+  size_t printed_size = 0;
+  FILE *fp = open_memstream(&printed, &printed_size);
+  if (fp == 0) {
+    return -1;
+  }
+  results_print(fp, format, watch->results.results, watch->results.size);
+  fclose(fp);
+  if ((watch->printed == 0) || (strcmp(watch->printed, printed) != 0)) {
+    fputs(printed, stdout);
+    fflush(stdout);
+    free(watch->printed);
+    watch->printed = printed;
+  } else {
+    free(printed);
+  }
+  return 0;
+}
+
+static long long int now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((long long int)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/* blocks until there have been changes and then WATCH_SETTLE_MS without any,
+ * or WATCH_MAX_WAIT_MS since the first, recording the events. After a failed
+ * walk waits at most WATCH_RETRY_MS */
+static int watch_wait(struct watch *watch) {
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  int timeout = (watch->full != 0) ? WATCH_RETRY_MS : -1;
+  long long int deadline = 0;
+  while (1) {
+    if (deadline != 0) {
+      long long int left = deadline - now_ms();
+      if (left <= 0) {
+        return 0;
+      }
+      timeout = (left < WATCH_SETTLE_MS) ? (int)left : WATCH_SETTLE_MS;
+    }
+    struct pollfd pfd = {.fd = watch->inotify_fd, .events = POLLIN};
+    int rc = poll(&pfd, 1, timeout);
+    if (rc < 0) {
+      return -1;
+    } else if (rc == 0) {
+      return 0;
+    }
+    ssize_t size = read(watch->inotify_fd, buf, sizeof(buf));
+    if (size < 0) {
+      return -1;
+    }
+    char *ev = buf;
+    while (ev < (buf + size)) {
+      struct inotify_event *event = (struct inotify_event *)ev;
+      if (watch_event_add(watch, event) != 0) {
+        return -1;
+      }
+      ev += sizeof(*event) + event->len;
+    }
+    if (deadline == 0) {
+      deadline = now_ms() + WATCH_MAX_WAIT_MS;
+    }
+  }
+}
+
+static void watch_free(struct watch *watch) {
+  size_t i = 0;
+  while (i < watch->table_cap) {
+    struct watch_file *file = watch->table[i];
+    while (file != 0) {
+      struct watch_file *next = file->next;
+      watch_file_free(file);
+      file = next;
+    }
+    ++i;
+  }
+  free(watch->table);
+  free(watch->order);
+  i = 0;
+  while (i < watch->dirs_size) {
+    free(watch->dirs[i].path);
+    ++i;
+  }
+  free(watch->dirs);
+  watch_events_clear(watch);
+  free(watch->events);
+  i = 0;
+  while (i < watch->snaps_size) {
+    watch_snap_free(&watch->snaps[i]);
+    ++i;
+  }
+  free(watch->snaps);
+  free(watch->printed);
+  birch_scan_free(&watch->replay);
+  birch_results_free(&watch->results);
+  birch_scan_free(&watch->scan);
+  birch_results_free(&watch->scan_results);
+  close(watch->inotify_fd);
+}
+
+int birch_watch(char **roots, size_t roots_size, struct dir_tree_opts *walk,
+                struct birch_ptn_groups *groups, size_t results_size,
+                enum print_format format) {
+  size_t i = 0;
+  while (i < roots_size) {
+    if (strcmp(roots[i], DIR_TREE_STDIN) == 0) {
+      printf("streams cannot be watched\n");
+      return -1;
+    }
+    ++i;
+  }
+  struct dir_tree_opts watch_walk = *walk;
+  struct watch watch = {.groups = groups,
+                        .table = 0,
+                        .table_cap = 0,
+                        .size = 0,
+                        .order = 0,
+                        .order_size = 0,
+                        .order_cap = 0,
+                        .roots = roots,
+                        .roots_size = roots_size,
+                        .walk = &watch_walk,
+                        .dirs = 0,
+                        .dirs_size = 0,
+                        .events_size = 0,
+                        .full = 0,
+                        .err = 0,
+                        .changed = 0,
+                        .snaps = 0,
+                        .snaps_size = 0,
+                        .printed = 0};
+  /* links and depths below a changed directory depend on the walk from the
+   * roots */
+  watch.walk_only =
+      ((walk->follow_links != 0) || (walk->max_depth != UINT_MAX)) ? 1 : 0;
+  watch.inotify_fd = inotify_init1(IN_CLOEXEC);
+  if (watch.inotify_fd < 0) {
+    printf("inotify unavailable\n");
+    return -1;
+  }
+  watch.events = malloc(WATCH_EVENTS_MAX * sizeof(*watch.events));
+  if (watch.events == 0) {
+    close(watch.inotify_fd);
+    return -1;
+  }
+  /* the results of the recording scan are never used */
+  if (birch_results_init(&watch.scan_results, groups, 1) != 0) {
+    free(watch.events);
+    close(watch.inotify_fd);
+    return -1;
+  }
+  if (birch_scan_init(&watch.scan, groups, &watch.scan_results) != 0) {
+    birch_results_free(&watch.scan_results);
+    free(watch.events);
+    close(watch.inotify_fd);
+    return -1;
+  }
+  if (birch_results_init(&watch.results, groups, results_size) != 0) {
+    birch_scan_free(&watch.scan);
+    birch_results_free(&watch.scan_results);
+    free(watch.events);
+    close(watch.inotify_fd);
+    return -1;
+  }
+  if (birch_scan_init(&watch.replay, groups, &watch.results) != 0) {
+    birch_results_free(&watch.results);
+    birch_scan_free(&watch.scan);
+    birch_results_free(&watch.scan_results);
+    free(watch.events);
+    close(watch.inotify_fd);
+    return -1;
+  }
+  watch.scan.hit_cb = &birch_hits_cb;
+  watch_walk.dir_cb = &watch_dir_cb;
+  watch_walk.usr = &watch;
+
+  int rc = watch_snap_add(&watch, 0);
+  if (rc == 0) {
+    /* the roots must be walked once before watching */
+    rc = (watch_round(&watch) == 0) ? 0 : -1;
+  }
+  while ((rc == 0) && (watch_results_print(&watch, format) == 0) &&
+         (watch_wait(&watch) == 0)) {
+    rc = watch_update(&watch);
+  }
+  watch_free(&watch);
+  return -1;
+}
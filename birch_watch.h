@@ -0,0 +1,31 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BIRCH_WATCH_H
+#define BIRCH_WATCH_H
+
+#include "birch.h"
+#include "birch_print.h"
+#include "dir_tree.h"
+
+/* searches the roots then keeps watching them, rescanning only the files and
+ * directories named by events and printing the results again whenever they
+ * change. The hits of every file are kept, so memory grows with the total
+ * hits. Does not return unless an error occurs */
+int birch_watch(char **roots, size_t roots_size, struct dir_tree_opts *walk,
+                struct birch_ptn_groups *groups, size_t results_size,
+                enum print_format format);
+
+#endif
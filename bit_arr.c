@@ -15,63 +15,17 @@
 
 #include "bit_arr.h"
 
-#include <assert.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
-/* index should start as size_bytes - 1 */
-static unsigned char mul_10(unsigned char *arr, size_t index) {
-  unsigned char cur = arr[index];
-  unsigned char shift_1 = (cur << 1);
-  unsigned char shift_3 = (cur << 3);
-  unsigned char sum = 0;
-  if (index > 0) {
-    size_t prv_index = index - 1;
-    unsigned char prv = arr[prv_index];
-    shift_1 |= (prv >> (CHAR_BIT - 1));
-    shift_3 |= (prv >> (CHAR_BIT - 3));
-    sum = mul_10(arr, prv_index);
-  }
-  sum += shift_1;
-  unsigned char cout = (sum < shift_1) ? 1 : 0;
-  sum += shift_3;
-  cout |= (sum < shift_3) ? 1 : 0;
-  arr[index] = sum;
-  return cout;
-}
+/* decimal digits handled per limb multiply, 10^9 < 2^32 */
+#define DEC_CHUNK_DIGITS (9)
+#define LIMBS_STACK_SIZE (16)
 
-static void add_uchar(unsigned char *arr, size_t size_bytes, unsigned char c) {
-  if (size_bytes == 0) {
-    return;
-  }
-  arr[0] += c;
-  if (size_bytes == 1) {
-    return;
-  }
-  if (arr[0] < c) {
-    size_t i = 0;
-    do {
-      ++i;
-      arr[i] += 1;
-    } while (arr[i] == 0);
-  }
-}
-
-static void lshift(unsigned char *arr, size_t size_bytes, unsigned int shift) {
-  if ((size_bytes == 0) || (shift == 0)) {
-    return;
-  }
-  assert(shift < CHAR_BIT);
-  unsigned int rshift = CHAR_BIT - shift;
-  unsigned char prev = 0;
-  size_t i = 0;
-  while (i < size_bytes) {
-    unsigned char cur = arr[i];
-    arr[i] = (cur << shift) | (prev >> rshift);
-    prev = cur;
-    ++i;
-  }
-}
+static const uint32_t DEC_CHUNK_POW[DEC_CHUNK_DIGITS + 1] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
 
 static unsigned char hex_to_nibble(char hex) {
   if ((hex >= '0') && (hex <= '9')) {
@@ -84,21 +38,33 @@ static unsigned char hex_to_nibble(char hex) {
   return 0xff;
 }
 
+/* power of 2 bases, digits are written straight to their bit position from the
+ * least significant end, bits beyond size_bytes are dropped */
 static unsigned char *from_str(char *s, size_t size_bytes, unsigned char shift,
                                unsigned char max_char) {
   unsigned char *arr = calloc(size_bytes, sizeof(unsigned char));
   if (arr == 0) {
     return 0;
   }
-  while (*s != 0) {
-    lshift(arr, size_bytes, shift);
-    unsigned char v = hex_to_nibble(*s);
+  size_t len = strlen(s);
+  size_t bit = 0;
+  const size_t size_bits = size_bytes * CHAR_BIT;
+  while (len > 0) {
+    --len;
+    unsigned char v = hex_to_nibble(s[len]);
     if (v > max_char) {
       free(arr);
       return 0;
     }
-    add_uchar(arr, size_bytes, v);
-    ++s;
+    if (bit < size_bits) {
+      size_t byte = bit / CHAR_BIT;
+      unsigned int bit_offs = bit % CHAR_BIT;
+      arr[byte] |= v << bit_offs;
+      if (((bit_offs + shift) > CHAR_BIT) && ((byte + 1) < size_bytes)) {
+        arr[byte + 1] |= v >> (CHAR_BIT - bit_offs);
+      }
+    }
+    bit += shift;
   }
   return arr;
 }
@@ -111,24 +77,60 @@ static unsigned char *from_str_oct(char *s, size_t size_bytes) {
   return from_str(s, size_bytes, 3, 7);
 }
 
-static unsigned char *from_str_dec(char *s, size_t size_bytes) {
-  unsigned char *arr = calloc(size_bytes, sizeof(unsigned char));
-  if (arr == 0) {
-    return 0;
+/* limbs = (limbs * mul) + add, carries out of the top limb are dropped */
+static void limbs_mul_add(uint32_t *limbs, size_t limbs_size, uint32_t mul,
+                          uint32_t add) {
+  uint64_t carry = add;
+  size_t i = 0;
+  while (i < limbs_size) {
+    uint64_t v = ((uint64_t)limbs[i] * mul) + carry;
+    limbs[i] = (uint32_t)v;
+    carry = v >> 32;
+    ++i;
   }
-  while (*s != 0) {
-    char *jkl = bit_arr_to_str(arr, size_bytes);
-    free(jkl);
-    mul_10(arr, size_bytes - 1);
-    jkl = bit_arr_to_str(arr, size_bytes);
-    free(jkl);
-    unsigned char v = hex_to_nibble(*s);
-    if (v > 0x9) {
-      free(arr);
+}
+
+static unsigned char *from_str_dec(char *s, size_t size_bytes) {
+  size_t limbs_size = (size_bytes + (sizeof(uint32_t) - 1)) / sizeof(uint32_t);
+  uint32_t limbs_stack[LIMBS_STACK_SIZE];
+  uint32_t *limbs = limbs_stack;
+  if (limbs_size > LIMBS_STACK_SIZE) {
+    limbs = malloc(limbs_size * sizeof(*limbs));
+    if (limbs == 0) {
       return 0;
     }
-    add_uchar(arr, size_bytes, v);
-    ++s;
+  }
+  memset(limbs, 0, limbs_size * sizeof(*limbs));
+
+  unsigned char valid = 1;
+  while ((*s != 0) && (valid != 0)) {
+    /* up to DEC_CHUNK_DIGITS digits per pass over the limbs */
+    uint32_t chunk = 0;
+    unsigned int digits = 0;
+    while ((*s != 0) && (digits < DEC_CHUNK_DIGITS)) {
+      unsigned char v = hex_to_nibble(*s);
+      if (v > 0x9) {
+        valid = 0;
+        break;
+      }
+      chunk = (chunk * 10) + v;
+      ++digits;
+      ++s;
+    }
+    limbs_mul_add(limbs, limbs_size, DEC_CHUNK_POW[digits], chunk);
+  }
+
+  unsigned char *arr = (valid != 0) ? malloc(size_bytes) : 0;
+  if (arr != 0) {
+    size_t i = 0;
+    while (i < size_bytes) {
+      arr[i] = (unsigned char)(limbs[i / sizeof(uint32_t)] >>
+                               ((i % sizeof(uint32_t)) * CHAR_BIT));
+      ++i;
+    }
+  }
+  if (limbs != limbs_stack) {
+    free(limbs);
   }
   return arr;
 }
@@ -16,13 +16,322 @@
 #include "dir_tree.h"
 
 #include <dirent.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <pthread.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 
 #include <stdio.h>
 
 static const char PATH_DELIM = '/';
 
+struct ino_key {
+  dev_t dev;
+  ino_t ino;
+  unsigned char used;
+};
+
+/* open addressing set of (st_dev, st_ino) pairs already walked */
+struct ino_set {
+  struct ino_key *keys;
+  size_t size;
+  size_t cap; /* power of 2 */
+};
+
+enum dir_list_state { DIR_LIST_QUEUED, DIR_LIST_RUNNING, DIR_LIST_DONE };
+
+/* the entries of a directory and the walk_stat() of each */
+struct dir_list {
+  char *path;
+  size_t path_len; /* without trailing slashes */
+  unsigned int depth;
+  dev_t root_dev;
+  struct dirent **names;
+  size_t count;
+  struct stat *stats;
+  signed char *rcs; /* walk_stat() returns, 1 also if pruned by name */
+  unsigned char scan_failed;
+  unsigned char err;   /* out of memory */
+  unsigned char owned; /* by the walk, not the pool */
+  enum dir_list_state state;
+  struct dir_list *next;     /* in a map bucket */
+  struct dir_list *next_all; /* every list of the pool */
+};
+
+/* threads reading directories ahead of the walk, which stays on one thread so
+ * the tree and its order do not depend on their timing. Lists are found by
+ * path, the walk reads those not yet started itself */
+struct walk_pool {
+  pthread_mutex_t lock;
+  pthread_cond_t cond; /* lists queued or done, or stop */
+  pthread_t *threads;
+  size_t threads_size;
+  struct dir_list **stack; /* queued */
+  size_t stack_size;
+  size_t stack_cap;
+  struct dir_list **map; /* WALK_POOL_MAP_SIZE buckets, queued or read */
+  struct dir_list *all;
+  struct ino_set claimed; /* directories queued */
+  unsigned char stop;
+};
+
+static const size_t WALK_POOL_MAP_SIZE = 1 << 16;
+
+struct dir_tree_walk {
+  struct dir_tree_opts opts;
+  struct ino_set seen;
+  dev_t root_dev;
+  struct walk_pool *pool; /* may be 0 */
+};
+
+static const size_t INO_SET_INIT_CAP = 256;
+
+static size_t ino_hash(dev_t dev, ino_t ino) {
+  unsigned long long int h = ((unsigned long long int)dev << 32) ^
+                             (unsigned long long int)ino;
+  h *= 0x9E3779B97F4A7C15ull;
+  return (size_t)(h ^ (h >> 29));
+}
+
+static struct ino_key *ino_set_slot(struct ino_key *keys, size_t cap,
+                                    dev_t dev, ino_t ino) {
+  size_t i = ino_hash(dev, ino) & (cap - 1);
+  while ((keys[i].used != 0) &&
+         ((keys[i].dev != dev) || (keys[i].ino != ino))) {
+    i = (i + 1) & (cap - 1);
+  }
+  return &keys[i];
+}
+
+static int ino_set_grow(struct ino_set *set) {
+  size_t new_cap = (set->cap == 0) ? INO_SET_INIT_CAP : set->cap << 1;
+  struct ino_key *keys = calloc(new_cap, sizeof(*keys));
+  if (keys == 0) {
+    return -1;
+  }
+  size_t i = 0;
+  while (i < set->cap) {
+    if (set->keys[i].used != 0) {
+      *ino_set_slot(keys, new_cap, set->keys[i].dev, set->keys[i].ino) =
+          set->keys[i];
+    }
+    ++i;
+  }
+  free(set->keys);
+  set->keys = keys;
+  set->cap = new_cap;
+  return 0;
+}
+
+/* returns 1 if already present, 0 if added, -1 on failure */
+static int ino_set_add(struct ino_set *set, dev_t dev, ino_t ino) {
+  if (((set->size + 1) << 1) > set->cap) {
+    if (ino_set_grow(set) != 0) {
+      return -1;
+    }
+  }
+  struct ino_key *key = ino_set_slot(set->keys, set->cap, dev, ino);
+  if (key->used != 0) {
+    return 1;
+  }
+  key->dev = dev;
+  key->ino = ino;
+  key->used = 1;
+  ++set->size;
+  return 0;
+}
+
+void dir_tree_opts_init(struct dir_tree_opts *opts) {
+  opts->follow_links = 0;
+  opts->one_fs = 0;
+  opts->include = 0;
+  opts->include_size = 0;
+  opts->exclude = 0;
+  opts->exclude_size = 0;
+  opts->exclude_dir = 0;
+  opts->exclude_dir_size = 0;
+  opts->max_depth = UINT_MAX;
+  opts->min_size = 0;
+  opts->max_size = ULLONG_MAX;
+  opts->mtime_min = LLONG_MIN;
+  opts->mtime_max = LLONG_MAX;
+  opts->walk_threads = 0;
+  opts->dir_cb = 0;
+  opts->usr = 0;
+}
+
+void dir_tree_opts_free(struct dir_tree_opts *opts) {
+  free(opts->include);
+  free(opts->exclude);
+  free(opts->exclude_dir);
+  opts->include = 0;
+  opts->include_size = 0;
+  opts->exclude = 0;
+  opts->exclude_size = 0;
+  opts->exclude_dir = 0;
+  opts->exclude_dir_size = 0;
+}
+
+static int globs_add(char ***globs, size_t *size, char *glob) {
+  char **tmp = realloc(*globs, (*size + 1) * sizeof(*tmp));
+  if (tmp == 0) {
+    return -1;
+  }
+  tmp[*size] = glob;
+  *globs = tmp;
+  ++*size;
+  return 0;
+}
+
+/* bytes with an optional k, M, G or T binary suffix */
+static int size_parse(char *str, unsigned long long int *size) {
+  char *end;
+  *size = strtoull(str, &end, 10);
+  if (end == str) {
+    return -1;
+  }
+  const char *suffixes = "kMGT";
+  const char *suffix = (*end != '\0') ? strchr(suffixes, *end) : 0;
+  if (suffix != 0) {
+    *size <<= 10 * ((suffix - suffixes) + 1);
+    ++end;
+  }
+  return (*end == '\0') ? 0 : -1;
+}
+
+/* "@SECS" since the epoch, or an age with an optional s, m, h, d or w suffix
+ */
+static int time_parse(char *str, long long int *t) {
+  char *end;
+  if (str[0] == '@') {
+    *t = strtoll(&str[1], &end, 10);
+    return ((end != &str[1]) && (*end == '\0')) ? 0 : -1;
+  }
+  long long int age = strtoll(str, &end, 10);
+  if (end == str) {
+    return -1;
+  }
+  static const char suffixes[] = "smhdw";
+  static const long long int units[] = {1, 60, 3600, 86400, 604800};
+  const char *suffix = (*end != '\0') ? strchr(suffixes, *end) : 0;
+  if (suffix != 0) {
+    age *= units[suffix - suffixes];
+    ++end;
+  }
+  *t = (long long int)time(0) - age;
+  return (*end == '\0') ? 0 : -1;
+}
+
+int dir_tree_opts_parse(struct dir_tree_opts *opts, int argc, char *argv[],
+                        int *i) {
+  char *arg = argv[*i];
+  if (strcmp(arg, "--follow-symlinks") == 0) {
+    opts->follow_links = 1;
+    return 0;
+  } else if (strcmp(arg, "--one-file-system") == 0) {
+    opts->one_fs = 1;
+    return 0;
+  }
+  if ((strcmp(arg, "--include") != 0) && (strcmp(arg, "--exclude") != 0) &&
+      (strcmp(arg, "--exclude-dir") != 0) &&
+      (strcmp(arg, "--min-size") != 0) && (strcmp(arg, "--max-size") != 0) &&
+      (strcmp(arg, "--max-depth") != 0) && (strcmp(arg, "--newer") != 0) &&
+      (strcmp(arg, "--older") != 0) && (strcmp(arg, "--walk-threads") != 0)) {
+    return 1;
+  }
+  if ((*i + 1) >= argc) {
+    printf("%s requires a value\n", arg);
+    return -1;
+  }
+  ++*i;
+  char *value = argv[*i];
+  int rc = 0;
+  if (strcmp(arg, "--include") == 0) {
+    rc = globs_add(&opts->include, &opts->include_size, value);
+  } else if (strcmp(arg, "--exclude") == 0) {
+    rc = globs_add(&opts->exclude, &opts->exclude_size, value);
+  } else if (strcmp(arg, "--exclude-dir") == 0) {
+    rc = globs_add(&opts->exclude_dir, &opts->exclude_dir_size, value);
+  } else if (strcmp(arg, "--min-size") == 0) {
+    rc = size_parse(value, &opts->min_size);
+  } else if (strcmp(arg, "--max-size") == 0) {
+    rc = size_parse(value, &opts->max_size);
+  } else if (strcmp(arg, "--max-depth") == 0) {
+    char *end;
+    unsigned long int depth = strtoul(value, &end, 10);
+    opts->max_depth = (depth < UINT_MAX) ? depth : UINT_MAX;
+    rc = ((end != value) && (*end == '\0')) ? 0 : -1;
+  } else if (strcmp(arg, "--walk-threads") == 0) {
+    char *end;
+    unsigned long int threads = strtoul(value, &end, 10);
+    opts->walk_threads = (threads < 1024) ? threads : 1024;
+    rc = ((end != value) && (*end == '\0')) ? 0 : -1;
+  } else if (strcmp(arg, "--newer") == 0) {
+    rc = time_parse(value, &opts->mtime_min);
+  } else {
+    rc = time_parse(value, &opts->mtime_max);
+  }
+  if (rc != 0) {
+    printf("invalid value for %s: %s\n", arg, value);
+  }
+  return rc;
+}
+
+static unsigned char globs_match(char **globs, size_t size, char *name) {
+  size_t i = 0;
+  while (i < size) {
+    if (fnmatch(globs[i], name, 0) == 0) {
+      return 1;
+    }
+    ++i;
+  }
+  return 0;
+}
+
+/* the filters that need only the name, 1 if pruned */
+static unsigned char name_pruned(struct dir_tree_opts *opts, char *name,
+                                 unsigned char is_dir) {
+  if (is_dir != 0) {
+    return globs_match(opts->exclude_dir, opts->exclude_dir_size, name);
+  }
+  if ((opts->include_size != 0) &&
+      (globs_match(opts->include, opts->include_size, name) == 0)) {
+    return 1;
+  }
+  return globs_match(opts->exclude, opts->exclude_size, name);
+}
+
+static unsigned char stat_pruned(struct dir_tree_opts *opts, char *name,
+                                 struct stat *s) {
+  if (S_ISDIR(s->st_mode)) {
+    return name_pruned(opts, name, 1);
+  }
+  if (name_pruned(opts, name, 0) != 0) {
+    return 1;
+  }
+  unsigned long long int size = s->st_size;
+  long long int mtime = s->st_mtime;
+  return ((size < opts->min_size) || (size > opts->max_size) ||
+          (mtime < opts->mtime_min) || (mtime > opts->mtime_max))
+             ? 1
+             : 0;
+}
+
+unsigned char dir_tree_pruned(struct dir_tree_opts *opts, char *name,
+                              struct stat *s) {
+  return stat_pruned(opts, name, s);
+}
+
+/* scandir() filter, "." and ".." are not always the first names */
+static int not_dots(const struct dirent *name) {
+  return ((strcmp(name->d_name, ".") != 0) &&
+          (strcmp(name->d_name, "..") != 0))
+             ? 1
+             : 0;
+}
+
 static void free_nameslist(struct dirent **nameslist, size_t count) {
   size_t i = 0;
   while (i < count) {
@@ -32,47 +341,452 @@ static void free_nameslist(struct dirent **nameslist, size_t count) {
   free(nameslist);
 }
 
-/* may free path */
-static int dir_tree_mfp(struct dir_tree **el, char *path) {
-  struct stat s;
-  if (stat(path, &s) != 0) {
-    printf("stat failed: %s\n", path);
+/* roots are always followed, other symlinks only if opts.follow_links is set.
+ * Returns 1 if the path should be skipped */
+static int walk_stat(struct dir_tree_opts *opts, char *path,
+                     unsigned char is_root, struct stat *s) {
+  if ((is_root == 0) && (opts->follow_links == 0)) {
+    if (lstat(path, s) != 0) {
+      return -1;
+    }
+    return S_ISLNK(s->st_mode) ? 1 : 0;
+  }
+  if (stat(path, s) != 0) {
+    if ((is_root == 0) && (lstat(path, s) == 0)) {
+      /* dangling link */
+      return 1;
+    }
+    return -1;
+  }
+  return 0;
+}
+
+static char *path_join(char *path, size_t path_len, char *name) {
+  size_t name_len = strlen(name) + 1;
+  char *new_path = malloc(path_len + sizeof(PATH_DELIM) + name_len);
+  if (new_path == 0) {
+    return 0;
+  }
+  memcpy(new_path, path, path_len);
+  char *tmp = new_path + path_len;
+  memcpy(tmp, &PATH_DELIM, sizeof(PATH_DELIM));
+  memcpy(tmp + sizeof(PATH_DELIM), name, name_len);
+  return new_path;
+}
+
+/* takes path */
+static struct dir_list *dir_list_new(char *path, unsigned int depth,
+                                     dev_t root_dev) {
+  struct dir_list *list = calloc(1, sizeof(*list));
+  if (list == 0) {
+    free(path);
+    return 0;
+  }
+  list->path = path;
+  list->path_len = strlen(path);
+  while ((list->path_len >= 1) && (path[list->path_len - 1] == '/')) {
+    --list->path_len;
+  }
+  list->depth = depth;
+  list->root_dev = root_dev;
+  list->state = DIR_LIST_QUEUED;
+  return list;
+}
+
+static void dir_list_free_entries(struct dir_list *list) {
+  if (list->names != 0) {
+    free_nameslist(list->names, list->count);
+  }
+  free(list->stats);
+  free(list->rcs);
+  free(list->path);
+  list->names = 0;
+  list->count = 0;
+  list->stats = 0;
+  list->rcs = 0;
+  list->path = 0;
+}
+
+/* the blocking part of the walk, run by the pool ahead of it */
+static void dir_list_read(struct dir_tree_opts *opts, struct dir_list *list) {
+  int scan_count = scandir(list->path, &list->names, &not_dots, &alphasort);
+  if (scan_count < 0) {
+    list->names = 0;
+    list->scan_failed = 1;
+    return;
+  }
+  list->count = scan_count;
+  list->stats = malloc((list->count + 1) * sizeof(*list->stats));
+  list->rcs = malloc((list->count + 1) * sizeof(*list->rcs));
+  if ((list->stats == 0) || (list->rcs == 0)) {
+    list->err = 1;
+    return;
+  }
+  size_t i = 0;
+  while (i < list->count) {
+    struct dirent *name = list->names[i];
+    list->rcs[i] = 1;
+    /* when the type is known, names are pruned before the path is built or
+     * stat()ed */
+    if (((name->d_type != DT_DIR) && (name->d_type != DT_REG)) ||
+        (name_pruned(opts, name->d_name, (name->d_type == DT_DIR) ? 1 : 0) ==
+         0)) {
+      char *path = path_join(list->path, list->path_len, name->d_name);
+      if (path == 0) {
+        list->err = 1;
+        return;
+      }
+      list->rcs[i] = walk_stat(opts, path, 0, &list->stats[i]);
+      free(path);
+    }
+    ++i;
+  }
+}
+
+/* FNV-1a */
+static size_t path_hash(const char *path) {
+  unsigned long long int hash = 0xcbf29ce484222325ull;
+  while (*path != '\0') {
+    hash ^= (unsigned char)*path;
+    hash *= 0x100000001b3ull;
+    ++path;
+  }
+  return (size_t)hash & (WALK_POOL_MAP_SIZE - 1);
+}
+
+/* queues the subdirectories of list the walk may descend into, each physical
+ * directory once. With the lock held, best effort */
+static void pool_queue_children(struct dir_tree_walk *walk,
+                                struct dir_list *list) {
+  struct walk_pool *pool = walk->pool;
+  struct dir_tree_opts *opts = &walk->opts;
+  if ((list->depth + 1) >= opts->max_depth) {
+    return;
+  }
+  /* in reverse so the first subdirectory is read first */
+  size_t i = list->count;
+  while (i > 0) {
+    --i;
+    struct stat *s = &list->stats[i];
+    if ((list->rcs[i] != 0) || (S_ISDIR(s->st_mode) == 0) ||
+        ((opts->one_fs != 0) && (s->st_dev != list->root_dev)) ||
+        (stat_pruned(opts, list->names[i]->d_name, s) != 0) ||
+        (ino_set_add(&pool->claimed, s->st_dev, s->st_ino) != 0)) {
+      continue;
+    }
+    if (pool->stack_size == pool->stack_cap) {
+      size_t new_cap = (pool->stack_cap == 0) ? 64 : pool->stack_cap << 1;
+      struct dir_list **tmp =
+          realloc(pool->stack, new_cap * sizeof(*pool->stack));
+      if (tmp == 0) {
+        return;
+      }
+      pool->stack = tmp;
+      pool->stack_cap = new_cap;
+    }
+    char *path = path_join(list->path, list->path_len, list->names[i]->d_name);
+    struct dir_list *child =
+        (path != 0) ? dir_list_new(path, list->depth + 1, list->root_dev) : 0;
+    if (child == 0) {
+      return;
+    }
+    size_t bucket = path_hash(child->path);
+    child->next = pool->map[bucket];
+    pool->map[bucket] = child;
+    child->next_all = pool->all;
+    pool->all = child;
+    pool->stack[pool->stack_size] = child;
+    ++pool->stack_size;
+  }
+  pthread_cond_broadcast(&pool->cond);
+}
+
+static void *pool_worker(void *usr) {
+  struct dir_tree_walk *walk = usr;
+  struct walk_pool *pool = walk->pool;
+  pthread_mutex_lock(&pool->lock);
+  while (1) {
+    while ((pool->stack_size == 0) && (pool->stop == 0)) {
+      pthread_cond_wait(&pool->cond, &pool->lock);
+    }
+    if (pool->stop != 0) {
+      break;
+    }
+    --pool->stack_size;
+    struct dir_list *list = pool->stack[pool->stack_size];
+    if (list->state != DIR_LIST_QUEUED) {
+      /* taken by the walk */
+      continue;
+    }
+    list->state = DIR_LIST_RUNNING;
+    pthread_mutex_unlock(&pool->lock);
+    dir_list_read(&walk->opts, list);
+    pthread_mutex_lock(&pool->lock);
+    if ((list->err == 0) && (list->scan_failed == 0)) {
+      pool_queue_children(walk, list);
+    }
+    list->state = DIR_LIST_DONE;
+    pthread_cond_broadcast(&pool->cond);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return 0;
+}
+
+/* removes and returns the list queued for path, with the lock held */
+static struct dir_list *pool_take(struct walk_pool *pool, char *path) {
+  struct dir_list **link = &pool->map[path_hash(path)];
+  while (*link != 0) {
+    struct dir_list *list = *link;
+    if (strcmp(list->path, path) == 0) {
+      *link = list->next;
+      return list;
+    }
+    link = &list->next;
+  }
+  return 0;
+}
+
+/* the entries of the directory at path, read ahead by the pool or now. s is
+ * the directory's stat */
+static struct dir_list *walk_list(struct dir_tree_walk *walk, char *path,
+                                  unsigned int depth, struct stat *s) {
+  struct walk_pool *pool = walk->pool;
+  struct dir_list *list = 0;
+  if (pool != 0) {
+    pthread_mutex_lock(&pool->lock);
+    list = pool_take(pool, path);
+    if ((list != 0) && (list->state == DIR_LIST_QUEUED)) {
+      /* not started, the walk would only wait for it */
+      list->state = DIR_LIST_RUNNING;
+      pthread_mutex_unlock(&pool->lock);
+      dir_list_read(&walk->opts, list);
+      pthread_mutex_lock(&pool->lock);
+      if ((list->err == 0) && (list->scan_failed == 0)) {
+        pool_queue_children(walk, list);
+      }
+      list->state = DIR_LIST_DONE;
+    }
+    while ((list != 0) && (list->state != DIR_LIST_DONE)) {
+      pthread_cond_wait(&pool->cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (list != 0) {
+      return list;
+    }
+  }
+  char *path_copy = malloc(strlen(path) + 1);
+  if (path_copy == 0) {
+    return 0;
+  }
+  strcpy(path_copy, path);
+  list = dir_list_new(path_copy, depth, walk->root_dev);
+  if (list == 0) {
+    return 0;
+  }
+  list->owned = 1;
+  dir_list_read(&walk->opts, list);
+  if ((pool != 0) && (list->err == 0) && (list->scan_failed == 0)) {
+    pthread_mutex_lock(&pool->lock);
+    if (ino_set_add(&pool->claimed, s->st_dev, s->st_ino) >= 0) {
+      pool_queue_children(walk, list);
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+  return list;
+}
+
+/* lists of the pool are freed with it */
+static void walk_list_release(struct dir_list *list) {
+  if (list != 0) {
+    dir_list_free_entries(list);
+    if (list->owned != 0) {
+      free(list);
+    }
+  }
+}
+
+/* on failure the walk runs on one thread */
+static void walk_pool_start(struct dir_tree_walk *walk) {
+  size_t threads_size = walk->opts.walk_threads;
+  if (threads_size == 0) {
+    return;
+  }
+  struct walk_pool *pool = calloc(1, sizeof(*pool));
+  if (pool == 0) {
+    return;
+  }
+  pool->map = calloc(WALK_POOL_MAP_SIZE, sizeof(*pool->map));
+  pool->threads = malloc(threads_size * sizeof(*pool->threads));
+  if ((pool->map == 0) || (pool->threads == 0)) {
+    free(pool->map);
+    free(pool->threads);
+    free(pool);
+    return;
+  }
+  pthread_mutex_init(&pool->lock, 0);
+  pthread_cond_init(&pool->cond, 0);
+  walk->pool = pool;
+  while (pool->threads_size < threads_size) {
+    if (pthread_create(&pool->threads[pool->threads_size], 0, &pool_worker,
+                       walk) != 0) {
+      break;
+    }
+    ++pool->threads_size;
+  }
+}
+
+static void walk_pool_stop(struct dir_tree_walk *walk) {
+  struct walk_pool *pool = walk->pool;
+  if (pool == 0) {
+    return;
+  }
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+  size_t i = 0;
+  while (i < pool->threads_size) {
+    pthread_join(pool->threads[i], 0);
+    ++i;
+  }
+  while (pool->all != 0) {
+    struct dir_list *list = pool->all;
+    pool->all = list->next_all;
+    dir_list_free_entries(list);
+    free(list);
+  }
+  pthread_cond_destroy(&pool->cond);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->claimed.keys);
+  free(pool->stack);
+  free(pool->map);
+  free(pool->threads);
+  free(pool);
+  walk->pool = 0;
+}
+
+static void dir_tree_walk_init(struct dir_tree_walk *walk,
+                               struct dir_tree_opts *opts) {
+  if (opts != 0) {
+    walk->opts = *opts;
+  } else {
+    dir_tree_opts_init(&walk->opts);
+  }
+  walk->seen.keys = 0;
+  walk->seen.size = 0;
+  walk->seen.cap = 0;
+  walk->root_dev = 0;
+  walk->pool = 0;
+  walk_pool_start(walk);
+}
+
+static void dir_tree_walk_free(struct dir_tree_walk *walk) {
+  walk_pool_stop(walk);
+  free(walk->seen.keys);
+}
+
+/* a file element keeping path, path is freed on failure */
+static int dir_tree_file_new(struct dir_tree **el, char *path) {
+  struct dir_tree_file *file = malloc(sizeof(struct dir_tree_file));
+  if (file == 0) {
+    free(path);
     return -1;
   }
-  if ((s.st_mode & S_IFDIR) != 0) {
+  file->dir.contents = 0;
+  file->dir.size = 1;
+  file->path = path;
+  *el = &file->dir;
+  return 0;
+}
+
+/* frees path unless it is kept by a file element, *el is left as 0 if the path
+ * is skipped. Paths below the roots are entry index of the parent's list,
+ * depth is 0 for the roots */
+static int dir_tree_mfp(struct dir_tree_walk *walk, struct dir_tree **el,
+                        char *path, struct dir_list *parent, size_t index,
+                        unsigned int depth) {
+  unsigned char is_root = (parent == 0) ? 1 : 0;
+  if ((is_root != 0) && (strcmp(path, DIR_TREE_STDIN) == 0)) {
+    return dir_tree_file_new(el, path);
+  }
+  struct stat s;
+  int rc;
+  if (is_root != 0) {
+    rc = walk_stat(&walk->opts, path, is_root, &s);
+  } else {
+    rc = parent->rcs[index];
+    s = parent->stats[index];
+  }
+  if (rc != 0) {
+    if (rc < 0) {
+      printf("stat failed: %s\n", path);
+    }
+    free(path);
+    return (rc < 0) ? -1 : 0;
+  }
+  if (is_root != 0) {
+    walk->root_dev = s.st_dev;
+  } else if (((walk->opts.one_fs != 0) && (s.st_dev != walk->root_dev)) ||
+             (stat_pruned(&walk->opts, parent->names[index]->d_name, &s) !=
+              0)) {
+    free(path);
+    return 0;
+  }
+  if (S_ISDIR(s.st_mode) || S_ISREG(s.st_mode)) {
+    /* hardlinks, bind mounts, overlapping roots and symlink loops all show up
+     * as an already seen inode */
+    rc = ino_set_add(&walk->seen, s.st_dev, s.st_ino);
+    if (rc != 0) {
+      free(path);
+      return (rc < 0) ? -1 : 0;
+    }
+  }
+  if (S_ISDIR(s.st_mode)) {
     /* is dir */
     struct dir_tree *dir = calloc(1, sizeof(*dir));
     if (dir == 0) {
+      free(path);
       return -1;
     }
+    if (walk->opts.dir_cb != 0) {
+      walk->opts.dir_cb(path, walk->opts.usr);
+    }
 
-    struct dirent **nameslist;
-    size_t path_len = strlen(path);
-    while ((path_len >= 1) && (path[path_len - 1] == '/')) {
-      --path_len;
+    /* directories at the max depth are recorded empty */
+    struct dir_list *list = 0;
+    if (depth < walk->opts.max_depth) {
+      list = walk_list(walk, path, depth, &s);
+      if ((list == 0) || (list->err != 0)) {
+        walk_list_release(list);
+        free(path);
+        dir_tree_free(dir);
+        return -1;
+      }
+      if (list->scan_failed != 0) {
+        printf("scandir failed: %s\n", path);
+      }
     }
-    size_t count = scandir(path, &nameslist, 0, &alphasort);
-    size_t i = 2; /* should ignore "." and ".." */
+    free(path);
+    size_t count = (list != 0) ? list->count : 0;
+    size_t i = 0;
     while (i < count) {
-      struct dirent *name = nameslist[i];
-      size_t name_len = strlen(name->d_name) + 1;
-      const size_t new_len = path_len + sizeof(PATH_DELIM) + name_len;
-      char *new_path = malloc(new_len);
+      /* pruned by name or a link not followed */
+      if (list->rcs[i] == 1) {
+        ++i;
+        continue;
+      }
+      char *new_path =
+          path_join(list->path, list->path_len, list->names[i]->d_name);
       if (new_path == 0) {
+        walk_list_release(list);
         dir_tree_free(dir);
-        free_nameslist(nameslist, count);
         return -1;
       }
-      memcpy(new_path, path, path_len);
-      char *tmp = new_path + path_len;
-      memcpy(tmp, &PATH_DELIM, sizeof(PATH_DELIM));
-      memcpy(tmp + sizeof(PATH_DELIM), name->d_name, name_len);
 
       struct dir_tree *child = 0;
-      if (dir_tree_mfp(&child, new_path) != 0) {
-        free(new_path);
+      if (dir_tree_mfp(walk, &child, new_path, list, i, depth + 1) != 0) {
+        walk_list_release(list);
         dir_tree_free(dir);
-        free_nameslist(nameslist, count);
         return -1;
       }
 
@@ -81,9 +795,9 @@ static int dir_tree_mfp(struct dir_tree **el, char *path) {
         size_t new_size = dir->size + 1;
         struct dir_tree **tmp = realloc(dir->contents, new_size * sizeof(*tmp));
         if (tmp == 0) {
+          walk_list_release(list);
           dir_tree_free(child);
           dir_tree_free(dir);
-          free_nameslist(nameslist, count);
           return -1;
         }
         tmp[dir->size] = child;
@@ -92,40 +806,50 @@ static int dir_tree_mfp(struct dir_tree **el, char *path) {
       }
       ++i;
     }
+    walk_list_release(list);
     *el = dir;
-    free(path);
-    free_nameslist(nameslist, count);
-  } else if ((s.st_mode & S_IFREG) != 0) {
+  } else if (S_ISREG(s.st_mode)) {
     /* is file */
-    struct dir_tree_file *file = malloc(sizeof(struct dir_tree_file));
-    if (file == 0) {
-      return -1;
+    return dir_tree_file_new(el, path);
+  } else if ((is_root != 0) && (S_ISFIFO(s.st_mode) || S_ISCHR(s.st_mode) ||
+                                S_ISBLK(s.st_mode))) {
+    /* streams are searched as a single file when given as roots, never when
+     * found below one */
+    return dir_tree_file_new(el, path);
+  } else {
+    if (is_root != 0) {
+      printf("not a file or directory: %s\n", path);
     }
-    file->dir.contents = 0;
-    file->dir.size = 1;
-    file->path = path;
-    *el = &file->dir;
+    free(path);
   }
   return 0;
 }
 
-int dir_tree(struct dir_tree **el, char *path) {
+static int dir_tree_walk_root(struct dir_tree_walk *walk, struct dir_tree **el,
+                              char *path) {
   size_t path_len = strlen(path) + 1;
   char *heap_path = malloc(path_len);
-  memcpy(heap_path, path, path_len);
   if (heap_path == 0) {
     return -1;
-  } else {
-    int rc = dir_tree_mfp(el, heap_path);
-    if (rc != 0) {
-      free(heap_path);
-      return rc;
-    }
   }
-  return 0;
+  memcpy(heap_path, path, path_len);
+  *el = 0;
+  return dir_tree_mfp(walk, el, heap_path, 0, 0, 0);
 }
 
-int dir_tree_multi(struct dir_tree **el, char **paths, size_t paths_size) {
+int dir_tree(struct dir_tree **el, char *path, struct dir_tree_opts *opts) {
+  struct dir_tree_walk walk;
+  dir_tree_walk_init(&walk, opts);
+  int rc = dir_tree_walk_root(&walk, el, path);
+  dir_tree_walk_free(&walk);
+  if ((rc == 0) && (*el == 0)) {
+    return -1;
+  }
+  return rc;
+}
+
+int dir_tree_multi(struct dir_tree **el, char **paths, size_t paths_size,
+                   struct dir_tree_opts *opts) {
   struct dir_tree *false_root;
   false_root = malloc(sizeof(*false_root));
   if (false_root == 0) {
@@ -137,14 +861,24 @@ int dir_tree_multi(struct dir_tree **el, char **paths, size_t paths_size) {
     return -1;
   }
   false_root->size = 0;
-  while (false_root->size < paths_size) {
-    if (dir_tree(&false_root->contents[false_root->size],
-                 paths[false_root->size]) != 0) {
+  struct dir_tree_walk walk;
+  dir_tree_walk_init(&walk, opts);
+  size_t i = 0;
+  while (i < paths_size) {
+    struct dir_tree *root;
+    if (dir_tree_walk_root(&walk, &root, paths[i]) != 0) {
+      dir_tree_walk_free(&walk);
       dir_tree_free(false_root);
       return -1;
     }
-    ++false_root->size;
+    /* a root already covered by an earlier one is skipped */
+    if (root != 0) {
+      false_root->contents[false_root->size] = root;
+      ++false_root->size;
+    }
+    ++i;
   }
+  dir_tree_walk_free(&walk);
   *el = false_root;
   return 0;
 }
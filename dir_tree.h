@@ -17,6 +17,10 @@
 #define DIR_TREE_H
 
 #include <stdlib.h>
+#include <sys/stat.h>
+
+/* root path read from standard input */
+#define DIR_TREE_STDIN "-"
 
 struct dir_tree {
   struct dir_tree **contents;
@@ -29,8 +33,48 @@ struct dir_tree_file {
   void *usr;
 };
 
-int dir_tree(struct dir_tree **el, char *path);
-int dir_tree_multi(struct dir_tree **el, char **paths, size_t paths_size);
+struct dir_tree_opts {
+  unsigned char follow_links; /* follow symlinks below the roots */
+  unsigned char one_fs;       /* do not cross filesystem boundaries */
+  /* filters for what is below the roots, applied during the walk so pruned
+   * directories are never read and pruned files never recorded. Globs match
+   * names, the arrays are owned but not the globs */
+  char **include; /* if any, a file must match one */
+  size_t include_size;
+  char **exclude;
+  size_t exclude_size;
+  char **exclude_dir;
+  size_t exclude_dir_size;
+  unsigned int max_depth; /* of files and directories, roots are depth 0 */
+  unsigned long long int min_size;
+  unsigned long long int max_size;
+  long long int mtime_min; /* seconds since the epoch */
+  long long int mtime_max;
+  /* threads reading directories ahead of the walk, 0 for none. The tree is
+   * the same for any number */
+  unsigned int walk_threads;
+  /* called with the path of each directory walked, may be 0 */
+  void (*dir_cb)(char *path, void *usr);
+  void *usr;
+};
+
+void dir_tree_opts_init(struct dir_tree_opts *opts);
+void dir_tree_opts_free(struct dir_tree_opts *opts);
+/* parses the walk option at argv[*i], leaving i at the last arg consumed.
+ * Returns 1 if it is not a walk option, -1 on error */
+int dir_tree_opts_parse(struct dir_tree_opts *opts, int argc, char *argv[],
+                        int *i);
+
+/* 1 if the filters of opts prune the file or directory name (not a path)
+ * with the lstat s, as the walk does below the roots */
+unsigned char dir_tree_pruned(struct dir_tree_opts *opts, char *name,
+                              struct stat *s);
+
+/* opts may be 0 for the defaults. Each physical file or directory (st_dev,
+ * st_ino) is recorded once, the first time it is seen in walk order */
+int dir_tree(struct dir_tree **el, char *path, struct dir_tree_opts *opts);
+int dir_tree_multi(struct dir_tree **el, char **paths, size_t paths_size,
+                   struct dir_tree_opts *opts);
 void dir_tree_print(struct dir_tree *el);
 void dir_tree_free(struct dir_tree *el);
 
@@ -0,0 +1,484 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* differential test of the matcher engines. The state machine alone
+ * (birch_ptn_groups_engines() with no flags) is the reference for int, float
+ * and string patterns, including the partial masks of unaligned variants where
+ * its replay is not a plain masked search. Wildcard patterns, which only the
+ * bitap takes, are checked against a brute force masked search. Each engine
+ * must give the same hits, in the same order, and the same results */
+
+#include "../birch.h"
+
+/* the checks are asserts, kept whatever DEFINES holds */
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define ROUNDS (24)
+#define DATA_SIZE (1024 * 32)
+#define PLANTS_SIZE (64)
+#define ARGS_SIZE (1024)
+#define ARG_SIZE (64)
+#define RESULTS_SIZE (4)
+#define PERF_DATA_SIZE (1024 * 1024)
+#define PERF_PTNS_SIZE (200)
+
+static const unsigned int ENGINES[] = {BIRCH_ENGINE_SET, BIRCH_ENGINE_BITAP,
+                                       BIRCH_ENGINE_ALL};
+static const char *ENGINE_NAMES[] = {"set", "bitap", "all"};
+#define ENGINES_SIZE (sizeof(ENGINES) / sizeof(*ENGINES))
+
+static unsigned long int rand_state = 1;
+
+static unsigned int rand_next(void) {
+  rand_state = (rand_state * 1103515245) + 12345;
+  return (rand_state >> 16) & 0x7fff;
+}
+
+static unsigned long long int rand_wide(void) {
+  unsigned long long int r = 0;
+  unsigned int i = 0;
+  while (i < 5) {
+    r = (r << 15) | rand_next();
+    ++i;
+  }
+  return r;
+}
+
+struct args {
+  char *argv[ARGS_SIZE];
+  char strs[ARGS_SIZE][ARG_SIZE];
+  int argc;
+};
+
+static void args_add(struct args *args, const char *arg) {
+  assert(args->argc < ARGS_SIZE);
+  snprintf(args->strs[args->argc], ARG_SIZE, "%s", arg);
+  args->argv[args->argc] = args->strs[args->argc];
+  ++args->argc;
+}
+
+/* flags for a new group or linked to the last */
+static void args_flags(struct args *args, const char *flags) {
+  char str[ARG_SIZE];
+  snprintf(str, sizeof(str), "-%s%s", ((rand_next() % 3) != 0) ? "g" : "",
+           flags);
+  args_add(args, str);
+}
+
+/* random patterns without wildcards, many of the same width so the sets are
+ * used, plus unaligned and both endian variants */
+static void args_exact(struct args *args, size_t ptns_size) {
+  static const char *INT_FLAGS[] = {"ial", "iab", "ialb", "iul", "iulb"};
+  static const unsigned int INT_SIZES[] = {8, 16, 32, 64, 24, 12};
+  char str[ARG_SIZE];
+  size_t i = 0;
+  while (i < ptns_size) {
+    unsigned int kind = rand_next() % 8;
+    if (kind < 5) {
+      unsigned int size = INT_SIZES[rand_next() % (kind < 3 ? 4 : 6)];
+      args_flags(args, INT_FLAGS[kind]);
+      snprintf(str, sizeof(str), "%u", size);
+      args_add(args, str);
+      unsigned long long int v = rand_wide();
+      if (size < 64) {
+        v &= (1ull << size) - 1;
+      }
+      snprintf(str, sizeof(str), "%llu", v);
+      args_add(args, str);
+    } else if (kind == 5) {
+      args_flags(args, ((rand_next() & 1) != 0) ? "fal" : "fab");
+      args_add(args, "32");
+      snprintf(str, sizeof(str), "%d.5", (int)(rand_next() % 100));
+      args_add(args, str);
+    } else {
+      args_flags(args, (kind == 6) ? "sa" : "swu");
+      unsigned int len = (rand_next() % 6) + 1;
+      unsigned int j = 0;
+      while (j < len) {
+        str[j] = 'a' + (rand_next() % 4);
+        ++j;
+      }
+      str[j] = '\0';
+      char size_str[ARG_SIZE];
+      snprintf(size_str, sizeof(size_str), "%u", len * 8);
+      args_add(args, size_str);
+      args_add(args, str);
+    }
+    ++i;
+  }
+}
+
+/* random hex and case-insensitive patterns */
+static void args_wild(struct args *args, size_t ptns_size) {
+  static const char NIBBLES[] = "0123????";
+  char str[ARG_SIZE];
+  size_t i = 0;
+  while (i < ptns_size) {
+    if ((rand_next() % 4) != 0) {
+      args_flags(args, ((rand_next() % 4) == 0) ? "xu" : "xa");
+      unsigned int len = (rand_next() % 9) + 1;
+      unsigned int j = 0;
+      while (j < len) {
+        str[j * 3] = NIBBLES[rand_next() % 8];
+        str[(j * 3) + 1] = NIBBLES[rand_next() % 8];
+        str[(j * 3) + 2] = ' ';
+        ++j;
+      }
+      str[(j * 3) - 1] = '\0';
+      if ((rand_next() % 4) == 0) {
+        strcpy(&str[(j * 3) - 1], "/0F");
+      }
+      args_add(args, str);
+    } else {
+      args_flags(args, ((rand_next() & 1) != 0) ? "sIa" : "swIa");
+      unsigned int len = (rand_next() % 4) + 1;
+      unsigned int j = 0;
+      while (j < len) {
+        str[j] = (((rand_next() & 1) != 0) ? 'A' : 'a') + (rand_next() % 3);
+        ++j;
+      }
+      str[j] = '\0';
+      char size_str[ARG_SIZE];
+      snprintf(size_str, sizeof(size_str), "%u", len * 8);
+      args_add(args, size_str);
+      args_add(args, str);
+    }
+    ++i;
+  }
+}
+
+/* random data over a small alphabet, with aligned variants of the patterns
+ * planted whole and with their last byte changed */
+static void data_gen(unsigned char *data, size_t size,
+                     struct birch_ptn_groups *groups, unsigned char alphabet) {
+  size_t i = 0;
+  while (i < size) {
+    data[i] = (alphabet == 0) ? rand_next() : (rand_next() % alphabet);
+    ++i;
+  }
+  i = 0;
+  while (i < PLANTS_SIZE) {
+    struct birch_ptn_group *group = &groups->groups[rand_next() % groups->size];
+    struct birch_ptn *ptn = &group->ptns[rand_next() % group->size];
+    size_t at = rand_next() % (size - ptn->size_bytes);
+    size_t j = 0;
+    while (j < ptn->size_bytes) {
+      data[at + j] = (data[at + j] & ~ptn->mask[j]) | ptn->ptn[j];
+      ++j;
+    }
+    if ((i & 1) != 0) {
+      data[(at + ptn->size_bytes) - 1] ^= 1 << (rand_next() % CHAR_BIT);
+    }
+    ++i;
+  }
+}
+
+/* brute force masked search, in the scanner's (offs, ptn) order */
+static void hits_brute(struct birch_hits *hits, struct birch_ptn_groups *groups,
+                       char *path, unsigned char *data, size_t size) {
+  size_t end = 0;
+  while (end < size) {
+    size_t i = 0;
+    while (i < groups->size) {
+      struct birch_ptn_group *group = &groups->groups[i];
+      size_t j = 0;
+      while (j < group->size) {
+        struct birch_ptn *ptn = &group->ptns[j];
+        size_t k = 0;
+        while ((k < ptn->size_bytes) && (ptn->size_bytes <= (end + 1)) &&
+               ((data[(end + 1 - ptn->size_bytes) + k] & ptn->mask[k]) ==
+                ptn->ptn[k])) {
+          ++k;
+        }
+        if (k == ptn->size_bytes) {
+          struct birch_match match = {
+              .ptn = ptn,
+              .path = path,
+              .offs = (((end * CHAR_BIT) + ptn->offs) - ptn->size) + CHAR_BIT};
+          birch_hits_cb(i, &match, hits);
+        }
+        ++j;
+      }
+      ++i;
+    }
+    ++end;
+  }
+}
+
+/* scans data as two files, each split over several buffers. Records hits if
+ * hits is not 0, returns the seconds taken */
+static char *PATHS[] = {"a/x", "a/y"};
+
+static double scan(struct birch_ptn_groups *groups,
+                   struct birch_results *results, struct birch_hits *hits,
+                   unsigned char *data, size_t size, unsigned int split) {
+  struct birch_scan scan;
+  int rc = birch_scan_init(&scan, groups, results);
+  assert(rc == 0);
+  if (hits != 0) {
+    scan.hit_cb = &birch_hits_cb;
+    scan.hit_usr = hits;
+  }
+  clock_t start = clock();
+  size_t half = size >> 1;
+  unsigned int file = 0;
+  while (file < 2) {
+    unsigned char *buf = &data[file * half];
+    size_t buf_size = (file == 0) ? half : size - half;
+    birch_scan_begin(&scan, PATHS[file]);
+    size_t done = 0;
+    while (done < buf_size) {
+      size_t chunk = (split == 0) ? buf_size : (split + (done % 7));
+      if (chunk > (buf_size - done)) {
+        chunk = buf_size - done;
+      }
+      birch_scan_buf(&scan, &buf[done], chunk);
+      done += chunk;
+    }
+    ++file;
+  }
+  double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+  birch_scan_free(&scan);
+  return secs;
+}
+
+/* the second file's hits are offset from its start, the brute force search
+ * is run per file */
+static void hits_brute_files(struct birch_hits *hits,
+                             struct birch_ptn_groups *groups,
+                             unsigned char *data, size_t size) {
+  size_t half = size >> 1;
+  hits_brute(hits, groups, PATHS[0], data, half);
+  hits_brute(hits, groups, PATHS[1], &data[half], size - half);
+}
+
+static void hits_cmp(struct birch_hits *a, struct birch_hits *b) {
+  assert(a->err == 0);
+  assert(b->err == 0);
+  assert(a->size == b->size);
+  size_t i = 0;
+  while (i < a->size) {
+    assert(a->hits[i].group_index == b->hits[i].group_index);
+    assert(a->hits[i].match.ptn == b->hits[i].match.ptn);
+    assert(a->hits[i].match.offs == b->hits[i].match.offs);
+    ++i;
+  }
+}
+
+static void results_cmp(struct birch_results *a, struct birch_results *b) {
+  size_t i = 0;
+  while (i < a->size) {
+    struct birch_ptn_groups *ra = &a->results[i];
+    struct birch_ptn_groups *rb = &b->results[i];
+    assert(memcmp(ra->match_dist, rb->match_dist, sizeof(ra->match_dist)) ==
+           0);
+    size_t j = 0;
+    while (j < ra->size) {
+      assert(ra->groups[j].match.ptn == rb->groups[j].match.ptn);
+      assert(ra->groups[j].match.offs == rb->groups[j].match.offs);
+      assert(ra->groups[j].match.path == rb->groups[j].match.path);
+      ++j;
+    }
+    ++i;
+  }
+}
+
+/* compares every engine with the reference, the state machine if brute is 0.
+ * Returns the number of reference hits */
+static size_t round_check(struct args *args, unsigned char *data, size_t size,
+                          unsigned char brute, unsigned char alphabet) {
+  struct birch_ptn_groups groups;
+  int rc = birch_compile(&groups, args->argc, args->argv);
+  assert(rc == 0);
+  data_gen(data, size, &groups, alphabet);
+  unsigned int split = (rand_next() % 2) * ((rand_next() % 100) + 1);
+
+  struct birch_hits ref_hits;
+  struct birch_results ref_results;
+  birch_hits_init(&ref_hits);
+  rc = birch_results_init(&ref_results, &groups, RESULTS_SIZE);
+  assert(rc == 0);
+  rc = birch_ptn_groups_engines(&groups, 0);
+  assert(rc == 0);
+  if (brute != 0) {
+    hits_brute_files(&ref_hits, &groups, data, size);
+  } else {
+    scan(&groups, &ref_results, &ref_hits, data, size, split);
+  }
+  /* results from the hits as found, replayed with a null hit_cb */
+  struct birch_scan replay;
+  rc = birch_scan_init(&replay, &groups, &ref_results);
+  assert(rc == 0);
+  birch_hits_replay(&replay, &ref_hits);
+  birch_scan_free(&replay);
+
+  unsigned int e = 0;
+  while (e < ENGINES_SIZE) {
+    /* without the bitap, wildcards fall back to the state machine */
+    if ((brute != 0) && ((ENGINES[e] & BIRCH_ENGINE_BITAP) == 0)) {
+      ++e;
+      continue;
+    }
+    rc = birch_ptn_groups_engines(&groups, ENGINES[e]);
+    assert(rc == 0);
+    struct birch_hits hits;
+    struct birch_results results;
+    birch_hits_init(&hits);
+    rc = birch_results_init(&results, &groups, RESULTS_SIZE);
+    assert(rc == 0);
+    scan(&groups, &results, &hits, data, size, split);
+    hits_cmp(&ref_hits, &hits);
+    birch_results_free(&results);
+    /* and the results of a scan without hit_cb */
+    rc = birch_results_init(&results, &groups, RESULTS_SIZE);
+    assert(rc == 0);
+    scan(&groups, &results, 0, data, size, split);
+    results_cmp(&ref_results, &results);
+    birch_results_free(&results);
+    birch_hits_free(&hits);
+    ++e;
+  }
+
+  size_t hits_size = ref_hits.size;
+  birch_hits_free(&ref_hits);
+  birch_results_free(&ref_results);
+  birch_ptn_groups_free(&groups);
+  return hits_size;
+}
+
+static void perf(struct args *args, unsigned char *data, size_t size,
+                 const char *name) {
+  struct birch_ptn_groups groups;
+  int rc = birch_compile(&groups, args->argc, args->argv);
+  assert(rc == 0);
+  data_gen(data, size, &groups, 0);
+  double mib = (double)size / (1024 * 1024);
+  printf("%s, %d args over %.0f MiB:", name, args->argc, mib);
+  rc = birch_ptn_groups_engines(&groups, 0);
+  assert(rc == 0);
+  struct birch_results results;
+  rc = birch_results_init(&results, &groups, RESULTS_SIZE);
+  assert(rc == 0);
+  printf(" state machine %.1f MiB/s",
+         mib / scan(&groups, &results, 0, data, size, 0));
+  birch_results_free(&results);
+  unsigned int e = 0;
+  while (e < ENGINES_SIZE) {
+    rc = birch_ptn_groups_engines(&groups, ENGINES[e]);
+    assert(rc == 0);
+    rc = birch_results_init(&results, &groups, RESULTS_SIZE);
+    assert(rc == 0);
+    printf(", %s %.1f MiB/s", ENGINE_NAMES[e],
+           mib / scan(&groups, &results, 0, data, size, 0));
+    birch_results_free(&results);
+    ++e;
+  }
+  printf("\n");
+  birch_ptn_groups_free(&groups);
+}
+
+/* a far match is kept for a closer hit of the other group: foo in the first
+ * file, then bar far from it and bar close to it in the second */
+static void max_dist_check(void) {
+  char *argv[] = {"-s", "24", "foo", "-s", "24", "bar"};
+  struct birch_ptn_groups groups;
+  int rc = birch_compile(&groups, 6, argv);
+  assert(rc == 0);
+  struct birch_results results;
+  rc = birch_results_init(&results, &groups, 1);
+  assert(rc == 0);
+  results.max = 1;
+  results.max_dist[MATCH_DIR_DIFF] = ULONG_MAX;
+  results.max_dist[MATCH_FILE_DIFF] = 1;
+  results.max_dist[MATCH_OFFS_DIFF] = 1000;
+  static unsigned char files[2][2000];
+  memcpy(&files[0][1250], "foo", 3);
+  memcpy(&files[1][12], "bar", 3);
+  memcpy(&files[1][1240], "bar", 3);
+  struct birch_scan scan;
+  rc = birch_scan_init(&scan, &groups, &results);
+  assert(rc == 0);
+  char *paths[] = {"m/1", "m/2"};
+  unsigned int file = 0;
+  while (file < 2) {
+    birch_scan_begin(&scan, paths[file]);
+    birch_scan_buf(&scan, files[file], sizeof(files[file]));
+    ++file;
+  }
+  struct birch_ptn_groups *result = &results.results[0];
+  assert(result->match_dist[MATCH_NEXIST] == 0);
+  assert(result->groups[1].match.offs == 1240 * 8);
+  assert(result->match_dist[MATCH_OFFS_DIFF] <= 1000);
+  birch_scan_free(&scan);
+  birch_results_free(&results);
+  birch_ptn_groups_free(&groups);
+}
+
+int main() {
+  unsigned char *data = malloc(PERF_DATA_SIZE);
+  assert(data != 0);
+  static struct args args;
+
+  size_t exact_hits = 0;
+  size_t wild_hits = 0;
+  unsigned int round = 0;
+  while (round < ROUNDS) {
+    args.argc = 0;
+    args_exact(&args, (rand_next() % 40) + 1);
+    exact_hits +=
+        round_check(&args, data, DATA_SIZE, 0, (round & 1) ? 0 : 4);
+    args.argc = 0;
+    args_wild(&args, (rand_next() % 20) + 1);
+    wild_hits +=
+        round_check(&args, data, DATA_SIZE, 1, (round & 1) ? 0 : 4);
+    ++round;
+  }
+  printf("%u rounds: %lu exact hits, %lu wildcard hits\n", ROUNDS, exact_hits,
+         wild_hits);
+  assert((exact_hits > 0) && (wild_hits > 0));
+
+  max_dist_check();
+
+  /* throughput of each engine on the same inputs */
+  args.argc = 0;
+  char str[ARG_SIZE];
+  size_t i = 0;
+  while (i < PERF_PTNS_SIZE) {
+    args_add(&args, (i == 0) ? "-ial" : "-gial");
+    args_add(&args, "32");
+    snprintf(str, sizeof(str), "%u", (rand_next() << 15) | rand_next());
+    args_add(&args, str);
+    ++i;
+  }
+  perf(&args, data, PERF_DATA_SIZE, "32 bit ints");
+  args.argc = 0;
+  i = 0;
+  while (i < PERF_PTNS_SIZE) {
+    args_add(&args, (i == 0) ? "-x" : "-gx");
+    snprintf(str, sizeof(str), "%02X ?? %02X ?? ?? 0? %02X ?%X",
+             rand_next() & 0xff, rand_next() & 0xff, rand_next() & 0xff,
+             rand_next() & 0xf);
+    args_add(&args, str);
+    ++i;
+  }
+  perf(&args, data, PERF_DATA_SIZE, "wildcards");
+
+  free(data);
+  return 0;
+}
@@ -0,0 +1,336 @@
+/* Copyright 2021 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../birch.h"
+#include "../birch_bps.h"
+
+/* the checks are asserts, kept whatever DEFINES holds */
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DATA_SIZE (1024 * 1024)
+#define PERF_DATA_SIZE (1024 * 1024 * 16)
+#define PERF_PTNS_SIZE (64)
+
+static unsigned long int rand_state = 1;
+
+static unsigned int rand_next(void) {
+  rand_state = (rand_state * 1103515245) + 12345;
+  return (rand_state >> 16) & 0x7fff;
+}
+
+/* every hit with an (offs, ptn) order, as the scanner reports them */
+static void hits_expect(struct birch_hits *hits, struct birch_ptn_groups *groups,
+                        unsigned char *data, size_t size) {
+  size_t end = 0;
+  while (end < size) {
+    size_t i = 0;
+    while (i < groups->size) {
+      struct birch_ptn_group *group = &groups->groups[i];
+      size_t j = 0;
+      while (j < group->size) {
+        struct birch_ptn *ptn = &group->ptns[j];
+        size_t k = 0;
+        while ((k < ptn->size_bytes) && (ptn->size_bytes <= (end + 1)) &&
+               ((data[(end + 1 - ptn->size_bytes) + k] & ptn->mask[k]) ==
+                ptn->ptn[k])) {
+          ++k;
+        }
+        if (k == ptn->size_bytes) {
+          struct birch_match match = {
+              .ptn = ptn,
+              .path = 0,
+              .offs = (((end * CHAR_BIT) + ptn->offs) - ptn->size) + CHAR_BIT};
+          birch_hits_cb(i, &match, hits);
+        }
+        ++j;
+      }
+      ++i;
+    }
+    ++end;
+  }
+}
+
+static void hits_scan(struct birch_hits *hits, struct birch_ptn_groups *groups,
+                      unsigned char *data, size_t size, size_t split) {
+  struct birch_results results;
+  int rc = birch_results_init(&results, groups, 1);
+  assert(rc == 0);
+  struct birch_scan scan;
+  rc = birch_scan_init(&scan, groups, &results);
+  assert(rc == 0);
+  scan.hit_cb = &birch_hits_cb;
+  scan.hit_usr = hits;
+  birch_scan_begin(&scan, 0);
+  birch_scan_buf(&scan, data, split);
+  birch_scan_buf(&scan, data + split, size - split);
+  birch_scan_free(&scan);
+  birch_results_free(&results);
+}
+
+static void hits_check(struct birch_hits *a, struct birch_hits *b) {
+  assert(a->size == b->size);
+  size_t i = 0;
+  while (i < a->size) {
+    assert(a->hits[i].group_index == b->hits[i].group_index);
+    assert(a->hits[i].match.ptn == b->hits[i].match.ptn);
+    assert(a->hits[i].match.offs == b->hits[i].match.offs);
+    ++i;
+  }
+}
+
+static size_t match_check(char **argv, int argc, unsigned char *data,
+                        size_t size) {
+  struct birch_ptn_groups groups;
+  int rc = birch_compile(&groups, argc, argv);
+  assert(rc == 0);
+  struct birch_hits expected;
+  struct birch_hits hits;
+  birch_hits_init(&expected);
+  birch_hits_init(&hits);
+  hits_expect(&expected, &groups, data, size);
+  hits_scan(&hits, &groups, data, size, size / 3);
+  hits_check(&expected, &hits);
+  size_t hits_size = hits.size;
+  birch_hits_free(&expected);
+  birch_hits_free(&hits);
+  birch_ptn_groups_free(&groups);
+  return hits_size;
+}
+
+/* a pattern set written to a file and loaded back finds the same hits */
+static void bps_check(char **argv, int argc, unsigned char *data,
+                      size_t size) {
+  struct birch_ptn_groups groups;
+  int rc = birch_compile(&groups, argc, argv);
+  assert(rc == 0);
+  char path[] = "/tmp/birch_bps_testXXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+  rc = birch_bps_write(&groups, argv, argc, path);
+  assert(rc == 0);
+  struct birch_ptn_groups loaded;
+  birch_ptn_groups_init(&loaded);
+  rc = birch_bps_load(&loaded, path, 0, 0);
+  assert(rc == 0);
+  unlink(path);
+  assert(loaded.size == groups.size);
+  struct birch_hits expected;
+  struct birch_hits hits;
+  birch_hits_init(&expected);
+  birch_hits_init(&hits);
+  hits_scan(&expected, &groups, data, size, size / 3);
+  hits_scan(&hits, &loaded, data, size, size / 2);
+  assert(expected.size == hits.size);
+  size_t i = 0;
+  while (i < hits.size) {
+    struct birch_match *a = &expected.hits[i].match;
+    struct birch_match *b = &hits.hits[i].match;
+    assert(expected.hits[i].group_index == hits.hits[i].group_index);
+    assert(strcmp(a->ptn->arg_str, b->ptn->arg_str) == 0);
+    assert(a->ptn->offs == b->ptn->offs);
+    assert(a->offs == b->offs);
+    ++i;
+  }
+  birch_hits_free(&expected);
+  birch_hits_free(&hits);
+  birch_ptn_groups_free(&loaded);
+  birch_ptn_groups_free(&groups);
+}
+
+static double perf_scan(struct birch_ptn_groups *groups, unsigned char *data,
+                        size_t size) {
+  struct birch_results results;
+  int rc = birch_results_init(&results, groups, 1);
+  assert(rc == 0);
+  struct birch_scan scan;
+  rc = birch_scan_init(&scan, groups, &results);
+  assert(rc == 0);
+  clock_t start = clock();
+  birch_scan_begin(&scan, "perf");
+  birch_scan_buf(&scan, data, size);
+  double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+  birch_scan_free(&scan);
+  birch_results_free(&results);
+  return secs;
+}
+
+int main() {
+  unsigned char *data = malloc(PERF_DATA_SIZE);
+  assert(data != 0);
+  size_t i = 0;
+  while (i < PERF_DATA_SIZE) {
+    data[i] = rand_next() & 0x7;
+    ++i;
+  }
+
+  /* overlapping wildcards the replay of ptn_match() would miss */
+  unsigned char overlap[] = {0x41, 0x41, 0x41, 0x42};
+  char *overlap_argv[] = {"-x", "41 ?? 42"};
+  size_t hits_size = match_check(overlap_argv, 2, overlap, sizeof(overlap));
+  assert(hits_size == 1);
+
+  /* masks */
+  unsigned char masked[] = {0x4D, 0x5A, 0x90, 0x00, 0x50, 0x45, 0x07, 0x4D,
+                            0x5A, 0x11, 0x22, 0x50, 0x45, 0x0F};
+  char *masked_argv[] = {"-x", "4D5A ?? ?? 50 45 0?", "-gx", "?5/0F"};
+  hits_size = match_check(masked_argv, 4, masked, sizeof(masked));
+  assert(hits_size == 4);
+
+  /* invalid specs */
+  struct birch_ptn_groups groups;
+  char *invalid_argv[] = {"-x", "4D5"};
+  int rc = birch_compile(&groups, 2, invalid_argv);
+  assert(rc != 0);
+  char *invalid_mask_argv[] = {"-x", "4D/G0"};
+  rc = birch_compile(&groups, 2, invalid_mask_argv);
+  assert(rc != 0);
+  /* an empty pattern arg is too short, not an option */
+  char *empty_argv[] = {"-s", "40", ""};
+  rc = birch_compile(&groups, 3, empty_argv);
+  assert(rc != 0);
+
+  /* structs, fields at bit offsets with the gaps masked, hits at the start
+   * of the record */
+  unsigned char record[] = {0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0xC0, 0x3F,
+                            0x99, 0x99, 0x99, 0x99, 'I',  'D',  0x37, 0x07,
+                            0x00, 0x00, 0x00, 0x00, 0x00, 0xC0, 0x3F, 0x11,
+                            0x11, 0x11, 0x11, 'i',  'd',  0x00};
+  char *struct_argv[] = {"-t", "0 il 32 7, 32 fl 32 1.5, 96 sI 16 ID",
+                         "-gt", "0 i 4 7, 4 ib 4 3"};
+  hits_size = match_check(struct_argv, 4, record, sizeof(record));
+  assert(hits_size == 3);
+  char *invalid_struct_argv[] = {"-t", "0 il 32 7, 32 lb 32 1"};
+  rc = birch_compile(&groups, 2, invalid_struct_argv);
+  assert(rc != 0);
+  /* overlapping fields must agree */
+  char *conflict_argv[] = {"-t", "0 il 32 7, 0 il 32 8"};
+  rc = birch_compile(&groups, 2, conflict_argv);
+  assert(rc != 0);
+  char *agree_argv[] = {"-t", "0 il 32 7, 0 i 8 7, 8 x 00"};
+  rc = birch_compile(&groups, 2, agree_argv);
+  assert(rc == 0);
+  birch_ptn_groups_free(&groups);
+  /* wide fields are in the field's endian */
+  unsigned char wide_record[] = {0x11, 0x00, 'I', 0x00, 'D', 0x11};
+  char *wide_struct_argv[] = {"-t", "0 swb 16 ID"};
+  hits_size =
+      match_check(wide_struct_argv, 2, wide_record, sizeof(wide_record));
+  assert(hits_size == 1);
+
+  /* numbers, every encoding the value is exact in, in one group */
+  char *num_argv[] = {"-N", "300"};
+  rc = birch_compile(&groups, 2, num_argv);
+  assert(rc == 0);
+  assert(groups.size == 1);
+  /* both endians of ints of 16 bits up, f16, bf16, f32 and f64, varint and
+   * zigzag */
+  assert(groups.groups[0].size == 16);
+  birch_ptn_groups_free(&groups);
+  char *inexact_argv[] = {"-N", "0.1"};
+  rc = birch_compile(&groups, 2, inexact_argv);
+  assert(rc == 0);
+  /* only the double it parses to */
+  assert(groups.groups[0].size == 2);
+  birch_ptn_groups_free(&groups);
+  char *invalid_num_argv[] = {"-N", "1x"};
+  rc = birch_compile(&groups, 2, invalid_num_argv);
+  assert(rc != 0);
+  unsigned char nums[] = {0x11, 0xF9, 0xFF, 0xFF, 0xFF, 0x11, 0x0D, 0x11,
+                          0x3F, 0x00, 0x11, 0x00, 0x00, 0x00, 0x00, 0x00,
+                          0x00, 0xE0, 0x3F, 0x11, 0xC7, 0x00, 0x11};
+  char *nums_argv[] = {"-N", "-7", "-gN", "0.5"};
+  hits_size = match_check(nums_argv, 4, nums, sizeof(nums));
+  assert(hits_size == 7);
+  bps_check(nums_argv, 4, nums, sizeof(nums));
+
+  /* string variants, case folded through masks */
+  unsigned char strs[] = {'x', 'H', 0, 'e', 0, 'L', 0, 'L', 0, 'o', 0, 0,
+                          'h', 0, 'E', 0, 'l', 0, 'l', 0, 'O', 'h', 'e',
+                          'l', 'l', 'o', '@', 'e', 'l', 'l', 'o'};
+  char *wide_argv[] = {"-sw", "40", "hello"};
+  hits_size = match_check(wide_argv, 3, strs, sizeof(strs));
+  assert(hits_size == 1);
+  char *wide_nocase_argv[] = {"-swI", "40", "hello"};
+  hits_size = match_check(wide_nocase_argv, 3, strs, sizeof(strs));
+  assert(hits_size == 3);
+  char *nocase_argv[] = {"-sIu", "32", "ELLO"};
+  hits_size = match_check(nocase_argv, 3, strs, sizeof(strs));
+  assert(hits_size == 2);
+
+  /* random data, small alphabet for many overlapping hits, aligned and
+   * unaligned, long patterns span several state words */
+  char *random_argv[] = {"-x", "0? 01 ?? 02", "-gx", "03/03 ?? ?? 0?",
+                         "-xu", "01 ?2 03", "-gxa",
+                         "01 02 03 04 05 06 07 00 01 02 03 04 05 06 07 00 "
+                         "01 02 03 04 05 06 07 00 01 02 03 04 05 06 07 00 "
+                         "01 02 03 04 05 06 07 00 01 02 03 04 05 06 07 00 "
+                         "01 02 03 04 05 06 07 00 01 02 03 04 05 06 07 ??"};
+  memcpy(&data[DATA_SIZE >> 1], "\1\2\3\4\5\6\7\0\1\2\3\4\5\6\7\0"
+                                "\1\2\3\4\5\6\7\0\1\2\3\4\5\6\7\0"
+                                "\1\2\3\4\5\6\7\0\1\2\3\4\5\6\7\0"
+                                "\1\2\3\4\5\6\7\0\1\2\3\4\5\6\7\0",
+         64);
+  hits_size = match_check(random_argv, 8, data, DATA_SIZE);
+  printf("random: %lu hits\n", hits_size);
+  assert(hits_size > 0);
+  bps_check(random_argv, 8, data, DATA_SIZE);
+  bps_check(struct_argv, 4, record, sizeof(record));
+
+  /* literals of every width for the sets, both endians and unaligned */
+  char *literal_argv[] = {"-ialb", "32", "0x01020304", "-gia", "32",
+                          "0x04030201", "-gia", "16", "0x0102", "-gia",
+                          "16", "0x0304", "-gia", "16", "0x0506", "-gia",
+                          "16", "0x0607", "-gia", "8", "3", "-giulb", "24",
+                          "0x030201"};
+  bps_check(literal_argv, 24, data, DATA_SIZE);
+
+  /* many wildcards, the state machine is only timed, its replay can miss
+   * overlapping matches */
+  i = 0;
+  while (i < PERF_DATA_SIZE) {
+    data[i] = rand_next();
+    ++i;
+  }
+  char *perf_argv[PERF_PTNS_SIZE * 2];
+  char perf_ptns[PERF_PTNS_SIZE][64];
+  i = 0;
+  while (i < PERF_PTNS_SIZE) {
+    snprintf(perf_ptns[i], sizeof(perf_ptns[i]),
+             "%02X ?? %02X ?? ?? 0? %02X ?? ?? ?? ?%X", rand_next() & 0xff,
+             rand_next() & 0xff, rand_next() & 0xff, rand_next() & 0xf);
+    perf_argv[i * 2] = (i == 0) ? "-x" : "-gx";
+    perf_argv[(i * 2) + 1] = perf_ptns[i];
+    ++i;
+  }
+  rc = birch_compile(&groups, PERF_PTNS_SIZE * 2, perf_argv);
+  assert(rc == 0);
+  double bitap_secs = perf_scan(&groups, data, PERF_DATA_SIZE);
+  rc = birch_ptn_groups_engines(&groups, 0);
+  assert(rc == 0);
+  double sm_secs = perf_scan(&groups, data, PERF_DATA_SIZE);
+  birch_ptn_groups_free(&groups);
+  double mib = (double)PERF_DATA_SIZE / (1024 * 1024);
+  printf("%u wildcard patterns: bitap %.1f MiB/s, state machine %.1f MiB/s\n",
+         PERF_PTNS_SIZE, mib / bitap_secs, mib / sm_secs);
+
+  free(data);
+  return 0;
+}
@@ -15,7 +15,10 @@
 
 #include "../bit_arr.h"
 
+/* the checks are asserts, kept whatever DEFINES holds */
+#undef NDEBUG
 #include <assert.h>
+#include <stdio.h>
 #include <string.h>
 
 int main() {
@@ -50,5 +53,42 @@ int main() {
   free(arr);
   free(str);
 
+  /* short values are zero extended */
+  char test_str_small[] = "7";
+  arr = bit_arr_from_str(test_str_small, 4);
+  assert(arr != 0);
+  str = bit_arr_to_str(arr, 4);
+  printf("%s\n", str);
+  assert(strcmp(str, "0x00000007") == 0);
+  free(arr);
+  free(str);
+
+  /* values wider than the array are truncated */
+  char test_str_wide[] = "300";
+  arr = bit_arr_from_str(test_str_wide, 1);
+  assert(arr != 0);
+  str = bit_arr_to_str(arr, 1);
+  printf("%s\n", str);
+  assert(strcmp(str, "0x2C") == 0);
+  free(arr);
+  free(str);
+
+  char test_str_hex_odd[] = "0xABC";
+  arr = bit_arr_from_str(test_str_hex_odd, 2);
+  assert(arr != 0);
+  str = bit_arr_to_str(arr, 2);
+  printf("%s\n", str);
+  assert(strcmp(str, "0x0ABC") == 0);
+  free(arr);
+  free(str);
+
+  /* invalid digits */
+  char test_str_bad_dec[] = "12a";
+  arr = bit_arr_from_str(test_str_bad_dec, 4);
+  assert(arr == 0);
+  char test_str_bad_oct[] = "018";
+  arr = bit_arr_from_str(test_str_bad_oct, 4);
+  assert(arr == 0);
+
   return 0;
 }
@@ -0,0 +1,80 @@
+#!/bin/sh
+# Copyright 2021 Julian Ingram
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# the output of a sharded dump and merge, --order inode and a search
+# interrupted and resumed from its checkpoint must be that of a plain search
+# of the same fixture tree. Usage: cli_test.sh BIRCH
+
+BIRCH=$1
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+fail() {
+  echo "cli test failed: $1"
+  exit 1
+}
+
+# many equally close pairs, so the order files are searched in picks the
+# results, and pairs split across files
+for d in a a/x a/x/y b c c/z; do
+  mkdir -p "fix/$d"
+  i=1
+  while [ $i -le 6 ]; do
+    printf 'xx%0*dfooyy%0*dbarzz' $((i % 3 * 4)) 0 $((i % 2 * 8)) 0 \
+      > "fix/$d/f$i"
+    i=$((i + 1))
+  done
+  printf 'foo' > "fix/$d/g"
+  printf 'bar' > "fix/$d/h"
+done
+printf 'barfoo' > fix/top
+PTNS="-s 24 foo -s 24 bar -r 8"
+
+"$BIRCH" fix $PTNS > plain.txt || fail "plain search"
+[ -s plain.txt ] || fail "no results"
+
+i=0
+while [ $i -lt 3 ]; do
+  "$BIRCH" fix $PTNS --shard $i/3 --dump "dump$i" > /dev/null ||
+    fail "shard $i"
+  i=$((i + 1))
+done
+"$BIRCH" merge dump0 dump1 dump2 > merged.txt || fail "merge"
+cmp -s plain.txt merged.txt || fail "merge differs"
+
+"$BIRCH" fix $PTNS --order inode > inode.txt || fail "--order inode"
+cmp -s plain.txt inode.txt || fail "--order inode differs"
+
+# root files are searched first, a fifo holds the search in its first file
+# while it is interrupted. It stops once that file is read, the resumed
+# search does not open the fifo again
+mkfifo pipe
+printf 'foobar' > pipe &
+"$BIRCH" pipe fix $PTNS > plain_pipe.txt || fail "plain search of a fifo"
+"$BIRCH" pipe fix $PTNS --checkpoint checkpoint > stopped.txt &
+PID=$!
+# opening the fifo to write waits for the search to open it to read, after
+# the signal handlers are set
+exec 3> pipe
+kill -INT $PID
+printf 'foobar' >&3
+exec 3>&-
+wait $PID
+grep -q "search stopped" stopped.txt || fail "not interrupted"
+"$BIRCH" pipe fix $PTNS --resume checkpoint > resumed.txt || fail "resume"
+cmp -s plain_pipe.txt resumed.txt || fail "resume differs"
+
+echo "cli: merge, --order inode and --resume match a plain search"